@@ -12,16 +12,28 @@ void construct_arg_desc(argdesc_vt& x) {
 	x.push_back( new barg_t("--help", false, &Args::help, "print this message" ));
 	x.push_back( new barg_t("--trace", false, &Args::trace, "sets the flag for tracing"));
     x.push_back( new sarg_t("--trace-path", "./", &Args::trace_path, "path to log files"));
+    x.push_back( new uarg_t("--trace-level", 3u, &Args::trace_level, "sets the trace level (1: error, 2: info, 3: debug)"));
     x.push_back( new uarg_t("--buffer-size", 10240000, &Args::buffer_size, "sets the size of the memory buffer"));
     x.push_back( new uarg_t("--port", 8080u, &Args::port, "sets the port on which the server listens"));
+    x.push_back( new uarg_t("--threads", 0u, &Args::threads, "sets the number of server threads (0: one per core)"));
+    x.push_back( new barg_t("--thread-per-core", false, &Args::thread_per_core, "every server thread owns a shard of the keyspace"));
+    x.push_back( new uarg_t("--maxmemory", 0u, &Args::maxmemory, "runs as an in-memory cache of this many MiB (0: keys are stored on disk)"));
+    x.push_back( new sarg_t("--eviction", "lru", &Args::eviction, "keys a full cache evicts (lru: least recently used, lfu: least frequently used)"));
+    x.push_back( new uarg_t("--row-cache", 16u, &Args::row_cache, "caches the decoded records of hot keys read from disk in this many MiB (0: off)"));
 }
 
 Args::Args() noexcept
     : m_help(false)
     , m_trace(false)
     , m_trace_path("./")
+    , m_trace_level(3u)
     , m_buffer_size(2500 * PAGE_SIZE)
     , m_port(8080u)
+    , m_threads(0u)
+    , m_thread_per_core(false)
+    , m_maxmemory(0u)
+    , m_eviction("lru")
+    , m_row_cache(16u)
 {}
 
 Args::~Args() noexcept = default;
@@ -56,6 +68,16 @@ void Args::trace_path(const std::string& x) noexcept
     m_trace_path = x; 
 }
 
+uint Args::trace_level() const noexcept
+{
+    return m_trace_level;
+}
+
+void Args::trace_level(const uint& x) noexcept
+{
+    m_trace_level = x;
+}
+
 uint Args::buffer_size() const noexcept
 {
     return m_buffer_size;
@@ -75,3 +97,53 @@ void Args::port(const uint& x) noexcept
 {
     m_port = x;
 }
+
+uint Args::threads() const noexcept
+{
+    return m_threads;
+}
+
+void Args::threads(const uint& x) noexcept
+{
+    m_threads = x;
+}
+
+bool Args::thread_per_core() const noexcept
+{
+    return m_thread_per_core;
+}
+
+void Args::thread_per_core(const bool& x) noexcept
+{
+    m_thread_per_core = x;
+}
+
+uint Args::maxmemory() const noexcept
+{
+    return m_maxmemory;
+}
+
+void Args::maxmemory(const uint& x) noexcept
+{
+    m_maxmemory = x;
+}
+
+const std::string Args::eviction() const noexcept
+{
+    return m_eviction;
+}
+
+void Args::eviction(const std::string& x) noexcept
+{
+    m_eviction = x;
+}
+
+uint Args::row_cache() const noexcept
+{
+    return m_row_cache;
+}
+
+void Args::row_cache(const uint& x) noexcept
+{
+    m_row_cache = x;
+}
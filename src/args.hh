@@ -41,18 +41,42 @@ class Args
         const std::string   trace_path()                        const noexcept;
         void                trace_path(const std::string& x)          noexcept;
 
+        uint                trace_level()                       const noexcept;
+        void                trace_level(const uint& x)                noexcept;
+
         uint                buffer_size()                       const noexcept;
         void                buffer_size(const uint& x)                noexcept;
 
         uint                port()                              const noexcept;
         void                port(const uint& x)                       noexcept;
 
+        uint                threads()                           const noexcept;
+        void                threads(const uint& x)                    noexcept;
+
+        bool                thread_per_core()                   const noexcept;
+        void                thread_per_core(const bool& x)            noexcept;
+
+        uint                maxmemory()                         const noexcept;
+        void                maxmemory(const uint& x)                  noexcept;
+
+        const std::string   eviction()                          const noexcept;
+        void                eviction(const std::string& x)            noexcept;
+
+        uint                row_cache()                         const noexcept;
+        void                row_cache(const uint& x)                  noexcept;
+
     private:
         bool        m_help;
         bool        m_trace;
         std::string m_trace_path;
+        uint        m_trace_level;
         uint        m_buffer_size;
         uint        m_port;
+        uint        m_threads;
+        bool        m_thread_per_core;
+        uint        m_maxmemory;
+        std::string m_eviction;
+        uint        m_row_cache;
 };
 
 using argdesc_vt = std::vector<argdescbase_t<Args> *>;
@@ -0,0 +1,487 @@
+/**
+ *  @file    cache_manager.hh
+ *  @author  Nick Weber
+ *  @brief   The keys of a shard in cache mode, kept in memory within a budget
+ *  @bugs    Currently no bugs known
+ *  @todos   -
+ *
+ *  @section DESCRIPTION
+ *      In cache mode (see CB::max_memory) a shard keeps the newest value of every key in a hash
+ *      table. There is no write buffer, no flush and no partition file, a key that does not fit
+ *      any more is lost. The memory of the table is accounted by the heap blocks it allocates
+ *      (see malloc_size), K and V report theirs with allocated().
+ *      A write that exceeds the budget evicts keys like Redis does: a few random entries are
+ *      sampled and the one the policy ranks lowest is evicted, an expired one right away. LRU ranks
+ *      by the last access. LFU ranks by a logarithmic access counter, the more accesses a key has
+ *      the less likely the next one increments it, and it decays by one every minute.
+ *      Versions count the writes of the shard like in disk mode. There are no snapshots, reads see
+ *      the newest values.
+ */
+#pragma once
+
+#include "types.hh"
+#include "trace.hh"
+#include "merge_operator.hh"
+
+#include <atomic>
+#include <random>
+#include <shared_mutex>
+#include <unordered_map>
+#include <vector>
+
+template<typename K, typename V>
+class CacheManager final
+{
+    public:
+        using key_type = K;
+        using value_type = V;
+        using key_val_type = key_val_t<key_type, value_type>;
+        using read_handle_type = read_handle_t<key_type, value_type>;
+
+    private:
+        CacheManager()                                                    noexcept = delete;
+        explicit CacheManager(size_t aShard)                              noexcept;
+        CacheManager(const CacheManager&)                                 noexcept = delete;
+        CacheManager& operator=(const CacheManager&)                      noexcept = delete;
+        CacheManager(CacheManager&&)                                      noexcept = delete;
+        CacheManager& operator=(CacheManager&&)                           noexcept = delete;
+
+    public:
+        ~CacheManager()                                                   noexcept;
+        static CacheManager& get_instance(size_t aShard = 0)              noexcept
+        {
+            //every shard of the keyspace has its own instance, shard 0 is the default one
+            assert(aShard < MAX_SHARDS);
+            static std::unique_ptr<CacheManager> lInstances[MAX_SHARDS];
+            static std::once_flag lCreated[MAX_SHARDS];
+            std::call_once(lCreated[aShard], [aShard](){ lInstances[aShard].reset(new CacheManager(aShard)); });
+            return *lInstances[aShard];
+        }
+        // the shards share the memory budget of the control block evenly
+        void init(const CB& aCB, size_t aShards = 1)                      noexcept;
+        // folds the operands of merge() into the values
+        void merge_operator(merge_fn_t<V> aMerge)                         noexcept;
+
+    public:
+        read_handle_type find(const key_type& aKey)                       noexcept;
+        // find for all keys under one lock, the results are appended to aHandles
+        void            find(const std::vector<key_type>& aKeys, std::vector<read_handle_type>& aHandles) noexcept;
+        // aExpiry is the time the value expires at (see now_ms), 0 if it never does
+        void            put(const key_type& aKey, const value_type& aVal, uint64_t aExpiry = 0) noexcept;
+        // returns whether the key had a live value
+        bool            del(const key_type& aKey)                         noexcept;
+        // applies the operand to the value right away, it keeps its expiry time
+        void            merge(const key_type& aKey, const value_type& aOperand) noexcept;
+        // applies all puts and deletes of the batch under one lock, the batch is empty afterwards
+        void            write(write_batch_t<K,V>& aBatch)                 noexcept;
+        // stores the value only if the current version of the key is aVersion, 0 stands for a key
+        // without value. aResult receives the new version on success, the current one otherwise
+        bool            put_if(const key_type& aKey, const value_type& aVal, uint64_t aVersion, uint64_t& aResult, uint64_t aExpiry = 0) noexcept;
+        // looks at the next aMax entries of the table and removes the expired ones, returns how many
+        size_t          sweep(size_t aMax)                                noexcept;
+        void            clear()                                           noexcept;
+        // the heap memory of the table in bytes
+        size_t          used_memory()                               const noexcept;
+        size_t          max_memory()                                const noexcept { return m_max_memory; }
+        size_t          size()                                      const noexcept;
+        // the keys evicted so far
+        uint64_t        evictions()                                 const noexcept { return m_evictions.load(std::memory_order_relaxed); }
+
+    private:
+        struct entry_t final
+        {
+            entry_t(key_val_spt<K,V>&& aKeyVal, size_t aCharge, uint64_t aAccess) noexcept
+                : m_key_val(std::move(aKeyVal)), m_charge(aCharge), m_access(aAccess)
+            {}
+
+            key_val_spt<K,V>                m_key_val;  // shared with the read handles
+            size_t                          m_charge;   // the heap memory of the entry
+            mutable std::atomic<uint64_t>   m_access;   // LRU: the clock of the last access, LFU: minutes << 8 | counter
+        };
+        using table_type = std::unordered_map<K, entry_t>;
+
+    private:
+        // numbers the entry and replaces the current value of its key
+        void            store_no_lock(std::shared_ptr<key_val_type>&& aEntry) noexcept;
+        void            erase_no_lock(typename table_type::iterator aIt)  noexcept;
+        // evicts entries until the table fits into the budget, aKeep only if it is the last one
+        void            evict_no_lock(const key_type* aKeep)              noexcept;
+        typename table_type::iterator random_no_lock()                    noexcept;
+        size_t          used_memory_no_lock()                       const noexcept;
+        uint64_t        first_access()                                    noexcept;
+        void            touch(const entry_t& aEntry)                      noexcept;
+        // entries ranked lower are evicted first
+        uint64_t        rank(const entry_t& aEntry)                 const noexcept;
+        static size_t   charge(const key_val_type& aKeyVal)               noexcept;
+        static uint32_t lfu_minutes()                                     noexcept;
+        static uint32_t lfu_decay(uint32_t aAccess)                       noexcept;
+
+    private:
+        static constexpr size_t     EVICTION_SAMPLES = 5;
+        static constexpr uint32_t   LFU_INIT = 5;       // the counter of a new key, it is not evicted before it had a chance
+        static constexpr uint32_t   LFU_LOG_FACTOR = 10;
+
+    private:
+        mutable std::shared_mutex   m_mtx;
+        const CB*                   m_cb;
+        size_t                      m_max_memory;
+        EVICTION                    m_eviction;
+        merge_fn_t<V>               m_merge;
+        uint64_t                    m_sequence; // of the last write, only changed under the exclusive lock
+        size_t                      m_used;     // the heap memory of the entries, without the buckets
+        std::atomic<uint64_t>       m_clock;    // LRU: the accesses so far, 64 bits never wrap
+        std::atomic<uint64_t>       m_evictions;
+        size_t                      m_cursor;   // the bucket the next sweep starts at
+        std::minstd_rand            m_random;   // only used under the exclusive lock
+        table_type                  m_table;
+
+};
+
+template<typename K, typename V>
+CacheManager<K,V>::CacheManager(size_t aShard) noexcept
+    : m_mtx()
+    , m_cb(nullptr)
+    , m_max_memory(0)
+    , m_eviction(EVICTION::kLRU)
+    , m_merge(merge_operator_t<V>{})
+    , m_sequence(0)
+    , m_used(0)
+    , m_clock(0)
+    , m_evictions(0)
+    , m_cursor(0)
+    , m_random(static_cast<std::minstd_rand::result_type>(aShard + 1))
+    , m_table()
+{
+    TRACE_INFO("CacheManager constructed");
+}
+
+template<typename K, typename V>
+CacheManager<K,V>::~CacheManager() noexcept = default;
+
+template<typename K, typename V>
+void CacheManager<K,V>::init(const CB& aCB, size_t aShards) noexcept
+{
+    if(!m_cb)
+    {
+        TRACE_INFO("CacheManager initialized");
+        m_cb = &aCB;
+        m_max_memory = aCB.max_memory() / std::max<size_t>(aShards, 1);
+        m_eviction = aCB.eviction();
+    }
+}
+
+template<typename K, typename V>
+void CacheManager<K,V>::merge_operator(merge_fn_t<V> aMerge) noexcept
+{
+    std::lock_guard lock(m_mtx);
+    m_merge = std::move(aMerge);
+}
+
+template<typename K, typename V>
+typename CacheManager<K,V>::read_handle_type CacheManager<K,V>::find(const key_type& aKey) noexcept
+{
+    std::shared_lock lock(m_mtx);
+    const auto it = m_table.find(aKey);
+    if(it == m_table.end())
+    {
+        TRACE("Key not found in CacheManager");
+        return read_handle_type(FIND::kABSENT);
+    }
+    if(it->second.m_key_val->expired(now_ms()))
+    {
+        TRACE("Found Expired Key.");
+        return read_handle_type(FIND::kEXPIRED);
+    }
+    touch(it->second);
+    return read_handle_type(it->second.m_key_val);
+}
+
+template<typename K, typename V>
+void CacheManager<K,V>::find(const std::vector<key_type>& aKeys, std::vector<read_handle_type>& aHandles) noexcept
+{
+    std::shared_lock lock(m_mtx);
+    const uint64_t now = now_ms();
+    for(const auto& key : aKeys)
+    {
+        const auto it = m_table.find(key);
+        if(it == m_table.end() || it->second.m_key_val->expired(now))
+        {
+            aHandles.emplace_back(it == m_table.end() ? FIND::kABSENT : FIND::kEXPIRED);
+            continue;
+        }
+        touch(it->second);
+        aHandles.emplace_back(it->second.m_key_val);
+    }
+}
+
+template<typename K, typename V>
+void CacheManager<K,V>::put(const key_type& aKey, const value_type& aVal, uint64_t aExpiry) noexcept
+{
+    std::shared_ptr<key_val_type> data = std::make_shared<key_val_type>(aKey, aVal, MOD::kINSERT, 0, aExpiry);
+    std::lock_guard lock(m_mtx);
+    store_no_lock(std::move(data));
+    evict_no_lock(&aKey);
+}
+
+template<typename K, typename V>
+bool CacheManager<K,V>::del(const key_type& aKey) noexcept
+{
+    std::lock_guard lock(m_mtx);
+    const auto it = m_table.find(aKey);
+    if(it == m_table.end())
+    {
+        return false;
+    }
+    const bool live = !it->second.m_key_val->expired(now_ms());
+    erase_no_lock(it);
+    return live;
+}
+
+template<typename K, typename V>
+void CacheManager<K,V>::merge(const key_type& aKey, const value_type& aOperand) noexcept
+{
+    std::lock_guard lock(m_mtx);
+    const auto it = m_table.find(aKey);
+    const key_val_type* base = it == m_table.end() || it->second.m_key_val->expired(now_ms()) ? nullptr : it->second.m_key_val.get();
+    V value = merge_value(m_merge, aKey, base ? &base->val() : nullptr, aOperand, base && base->expiry() != 0);
+    store_no_lock(std::make_shared<key_val_type>(aKey, std::move(value), MOD::kINSERT, 0, base ? base->expiry() : 0));
+    evict_no_lock(&aKey);
+}
+
+template<typename K, typename V>
+void CacheManager<K,V>::write(write_batch_t<K,V>& aBatch) noexcept
+{
+    std::lock_guard lock(m_mtx);
+    TRACE("Apply batch of " + std::to_string(aBatch.size()) + " KV-pairs to the cache");
+    for(auto& entry : aBatch.entries())
+    {
+        if(entry->ins())
+        {
+            store_no_lock(std::move(entry));
+            continue;
+        }
+        const auto it = m_table.find(entry->key());
+        if(it != m_table.end())
+        {
+            erase_no_lock(it);
+        }
+    }
+    aBatch.clear();
+    evict_no_lock(nullptr);
+}
+
+template<typename K, typename V>
+bool CacheManager<K,V>::put_if(const key_type& aKey, const value_type& aVal, uint64_t aVersion, uint64_t& aResult, uint64_t aExpiry) noexcept
+{
+    std::shared_ptr<key_val_type> data = std::make_shared<key_val_type>(aKey, aVal, MOD::kINSERT, 0, aExpiry);
+    std::lock_guard lock(m_mtx);
+    const auto it = m_table.find(aKey);
+    aResult = it == m_table.end() || it->second.m_key_val->expired(now_ms()) ? 0 : it->second.m_key_val->seq();
+    if(aResult != aVersion)
+    {
+        TRACE("Version mismatch of key '" + aKey.to_string() + "'");
+        return false;
+    }
+    store_no_lock(std::move(data));
+    aResult = m_sequence;
+    evict_no_lock(&aKey);
+    return true;
+}
+
+template<typename K, typename V>
+size_t CacheManager<K,V>::sweep(size_t aMax) noexcept
+{
+    std::lock_guard lock(m_mtx);
+    if(m_table.empty())
+    {
+        return 0;
+    }
+    //walks the buckets round robin, a rehash only makes it skip or repeat some
+    const uint64_t now = now_ms();
+    std::vector<key_type> expired;
+    size_t seen = 0;
+    for(size_t i = 0; i < m_table.bucket_count() && seen < aMax; ++i)
+    {
+        m_cursor = (m_cursor + 1) % m_table.bucket_count();
+        for(auto it = m_table.begin(m_cursor); it != m_table.end(m_cursor); ++it, ++seen)
+        {
+            if(it->second.m_key_val->expired(now))
+            {
+                expired.push_back(it->first);
+            }
+        }
+    }
+    for(const auto& key : expired)
+    {
+        erase_no_lock(m_table.find(key));
+    }
+    TRACE("Swept " + std::to_string(expired.size()) + " expired keys of " + std::to_string(seen));
+    return expired.size();
+}
+
+template<typename K, typename V>
+void CacheManager<K,V>::clear() noexcept
+{
+    std::lock_guard lock(m_mtx);
+    TRACE_INFO("Clear the cache");
+    m_table.clear();
+    m_used = 0;
+}
+
+template<typename K, typename V>
+size_t CacheManager<K,V>::used_memory() const noexcept
+{
+    std::shared_lock lock(m_mtx);
+    return used_memory_no_lock();
+}
+
+template<typename K, typename V>
+size_t CacheManager<K,V>::size() const noexcept
+{
+    std::shared_lock lock(m_mtx);
+    return m_table.size();
+}
+
+template<typename K, typename V>
+void CacheManager<K,V>::store_no_lock(std::shared_ptr<key_val_type>&& aEntry) noexcept
+{
+    aEntry->seq(++m_sequence);
+    const size_t lCharge = charge(*aEntry);
+    m_used += lCharge;
+    const auto it = m_table.find(aEntry->key());
+    if(it == m_table.end())
+    {
+        const K& lKey = aEntry->key();
+        m_table.emplace(std::piecewise_construct, std::forward_as_tuple(lKey), std::forward_as_tuple(std::move(aEntry), lCharge, first_access()));
+        return;
+    }
+    //an overwrite counts as an access, LFU keeps the counter of the key
+    m_used -= it->second.m_charge;
+    it->second.m_key_val = std::move(aEntry);
+    it->second.m_charge = lCharge;
+    touch(it->second);
+}
+
+template<typename K, typename V>
+void CacheManager<K,V>::erase_no_lock(typename table_type::iterator aIt) noexcept
+{
+    m_used -= aIt->second.m_charge;
+    m_table.erase(aIt);
+}
+
+template<typename K, typename V>
+void CacheManager<K,V>::evict_no_lock(const key_type* aKeep) noexcept
+{
+    const uint64_t now = now_ms();
+    while(!m_table.empty() && used_memory_no_lock() > m_max_memory)
+    {
+        typename table_type::iterator victim = m_table.end();
+        for(size_t i = 0; i < EVICTION_SAMPLES; ++i)
+        {
+            const auto it = random_no_lock();
+            if(m_table.size() > 1 && aKeep && it->first == *aKeep)
+            {
+                continue;
+            }
+            if(it->second.m_key_val->expired(now))
+            {
+                victim = it;
+                break;
+            }
+            if(victim == m_table.end() || rank(it->second) < rank(victim->second))
+            {
+                victim = it;
+            }
+        }
+        if(victim != m_table.end())
+        {
+            TRACE("Evict '" + victim->first.to_string() + "' from the cache");
+            erase_no_lock(victim);
+            m_evictions.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+}
+
+template<typename K, typename V>
+typename CacheManager<K,V>::table_type::iterator CacheManager<K,V>::random_no_lock() noexcept
+{
+    //a random bucket, or the next one that is not empty, and a random entry of it
+    size_t bucket = m_random() % m_table.bucket_count();
+    while(m_table.bucket_size(bucket) == 0)
+    {
+        bucket = (bucket + 1) % m_table.bucket_count();
+    }
+    auto it = m_table.begin(bucket);
+    std::advance(it, static_cast<std::ptrdiff_t>(m_random() % m_table.bucket_size(bucket)));
+    return m_table.find(it->first);
+}
+
+template<typename K, typename V>
+size_t CacheManager<K,V>::used_memory_no_lock() const noexcept
+{
+    return m_used + malloc_size(m_table.bucket_count() * sizeof(void*));
+}
+
+template<typename K, typename V>
+uint64_t CacheManager<K,V>::first_access() noexcept
+{
+    if(m_eviction == EVICTION::kLFU)
+    {
+        return lfu_minutes() << 8 | LFU_INIT;
+    }
+    return m_clock.fetch_add(1, std::memory_order_relaxed) + 1;
+}
+
+template<typename K, typename V>
+void CacheManager<K,V>::touch(const entry_t& aEntry) noexcept
+{
+    //readers share the lock, concurrent updates of an entry may get lost, which is fine for a ranking
+    if(m_eviction != EVICTION::kLFU)
+    {
+        aEntry.m_access.store(m_clock.fetch_add(1, std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        return;
+    }
+    uint32_t lCounter = lfu_decay(static_cast<uint32_t>(aEntry.m_access.load(std::memory_order_relaxed)));
+    if(lCounter < 255)
+    {
+        thread_local std::minstd_rand tRandom(std::random_device{}());
+        const double lProbability = 1.0 / ((lCounter > LFU_INIT ? lCounter - LFU_INIT : 0) * LFU_LOG_FACTOR + 1);
+        if(std::uniform_real_distribution<double>(0.0, 1.0)(tRandom) < lProbability)
+        {
+            ++lCounter;
+        }
+    }
+    aEntry.m_access.store(lfu_minutes() << 8 | lCounter, std::memory_order_relaxed);
+}
+
+template<typename K, typename V>
+uint64_t CacheManager<K,V>::rank(const entry_t& aEntry) const noexcept
+{
+    const uint64_t lAccess = aEntry.m_access.load(std::memory_order_relaxed);
+    return m_eviction == EVICTION::kLFU ? lfu_decay(static_cast<uint32_t>(lAccess)) : lAccess;
+}
+
+template<typename K, typename V>
+size_t CacheManager<K,V>::charge(const key_val_type& aKeyVal) noexcept
+{
+    //the node of the table with its copy of the key, and the block of make_shared with the entry
+    //behind the reference counts and their vtable
+    const size_t lNode = malloc_size(sizeof(void*) + sizeof(typename table_type::value_type)) + aKeyVal.key().allocated();
+    const size_t lEntry = malloc_size(sizeof(void*) + 2 * sizeof(int) + sizeof(key_val_type)) + aKeyVal.key().allocated() + aKeyVal.val().allocated();
+    return lNode + lEntry;
+}
+
+template<typename K, typename V>
+uint32_t CacheManager<K,V>::lfu_minutes() noexcept
+{
+    return static_cast<uint32_t>(now_ms() / 60000) & 0xFFFFFF;
+}
+
+template<typename K, typename V>
+uint32_t CacheManager<K,V>::lfu_decay(uint32_t aAccess) noexcept
+{
+    //the counter loses one per minute since the last access, the minutes wrap around after 32 years
+    const uint32_t lElapsed = (lfu_minutes() - (aAccess >> 8)) & 0xFFFFFF;
+    const uint32_t lCounter = aAccess & 0xFF;
+    return lCounter > lElapsed ? lCounter - lElapsed : 0;
+}
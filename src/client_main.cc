@@ -7,15 +7,19 @@
 
 using boost::asio::ip::tcp;
 
-inline std::string make_string(boost::asio::streambuf& streambuf)
-{
-    return {buffers_begin(streambuf.data()), buffers_end(streambuf.data())};
-}
-
 int main()
 {
     try
     {
+        //one connection is kept open for all messages
+        boost::asio::io_service io_service;
+        tcp::resolver resolver(io_service);
+        tcp::resolver::query query("localhost", "8080");
+        tcp::resolver::iterator endpoint_iterator = resolver.resolve(query);
+        tcp::socket socket(io_service);
+        boost::asio::connect(socket, endpoint_iterator);
+
+        boost::asio::streambuf buf;
         bool exit = false;
         std::string msg;
         string_vt ans_vec;
@@ -25,27 +29,19 @@ int main()
         {
             std::cout << "Enter Message: " << std::endl;
             std::getline (std::cin,msg);
-            exit = msg == "END" || msg == "EXIT" || msg == "QUIT";
+            exit = msg == "END" || msg == "EXIT" || msg == "QUIT" || !std::cin;
             if(!exit)
             {
                 std::cout << "Send Message '" << msg << "' to Server" << std::endl;
                 msg.append("\n");
 
-                boost::asio::io_service io_service;
-                tcp::resolver resolver(io_service);
-                tcp::resolver::query query("localhost", "8080");
-                tcp::resolver::iterator endpoint_iterator = resolver.resolve(query);
-                tcp::socket socket(io_service);
-                boost::asio::connect(socket, endpoint_iterator);
-
-                boost::system::error_code error;
-
                 boost::asio::write(socket, boost::asio::buffer(msg, msg.size()));
 
-                boost::asio::streambuf buf;
-                boost::asio::read_until(socket, buf, '\n');
-                std::cout << "Received: " << make_string(buf) << std::endl;
-                ans_vec = StringUtil::splitString(make_string(buf), ':');
+                const size_t length = boost::asio::read_until(socket, buf, '\n');
+                const std::string line(buffers_begin(buf.data()), buffers_begin(buf.data()) + static_cast<std::ptrdiff_t>(length));
+                buf.consume(length);
+                std::cout << "Received: " << line << std::endl;
+                ans_vec = StringUtil::splitString(line, ':');
                 status = ans_vec.at(0);
                 ans = ans_vec.at(1);
                 if(status == "OK")
@@ -62,10 +58,6 @@ int main()
                     std::cout << status << " : " << ans; 
                 }
                 std::cout << std::endl;
-                
-
-                if(error)
-                    throw boost::system::system_error(error); // Some other error.
             }
         }
         while(!exit);
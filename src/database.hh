@@ -5,17 +5,23 @@
 #include "trace.hh"
 #include "write_manager.hh"
 #include "storage_manager.hh"
+#include "cache_manager.hh"
+#include "merge_operator.hh"
 
-template<typename K, typename V>
+// M is the merge operator of INCRBY, APPEND and merge() (see merge_operator.hh). In cache mode (see
+// CB::max_memory) the keys are held by the cache manager, there is no write or storage manager
+template<typename K, typename V, typename M = merge_operator_t<V>>
 class KeyValueStore final
 {
     public:
         using key_type = K;
         using value_type = V;
         using key_val_type = key_val_t<key_type,value_type>;
+        using read_handle_type = read_handle_t<key_type,value_type>;
 
     private:
-        KeyValueStore()                                                   noexcept;
+        KeyValueStore()                                                   noexcept = delete;
+        explicit KeyValueStore(size_t aShard)                             noexcept;
         KeyValueStore(const KeyValueStore&)                               noexcept = delete;
         KeyValueStore& operator=(const KeyValueStore&)                    noexcept = delete;
         KeyValueStore(KeyValueStore&&)                                    noexcept = delete;
@@ -23,125 +29,497 @@ class KeyValueStore final
 
     public:
         ~KeyValueStore()                                                  noexcept;
-        static KeyValueStore& get_instance()                              noexcept
+        static KeyValueStore& get_instance(size_t aShard = 0)             noexcept
         {
-            static KeyValueStore lInstance;
-            return lInstance;
+            //every shard of the keyspace has its own instance, shard 0 is the default one
+            assert(aShard < MAX_SHARDS);
+            static std::unique_ptr<KeyValueStore> lInstances[MAX_SHARDS];
+            static std::once_flag lCreated[MAX_SHARDS];
+            std::call_once(lCreated[aShard], [aShard](){ lInstances[aShard].reset(new KeyValueStore(aShard)); });
+            return *lInstances[aShard];
         }
-        void init(const CB& aCB)                                          noexcept;
+        // aShards share the memory budget of a cache
+        void init(const CB& aCB, size_t aShards = 1)                      noexcept;
+        bool cache_mode()                                           const noexcept { return m_cache != nullptr; }
 
     public:
-        answer_t        request_handler(const string_vt& args)            noexcept;
+        answer_t        request_handler(const request_t& aRequest)        noexcept;
 
     public:
+        // a consistent view for reads, it keeps the versions it sees until it is destroyed. A cache
+        // has no snapshots, reads through it see the newest values
+        snapshot_t      snapshot()                                        noexcept;
         key_val_type    get(const key_type& aKey);
-        void            put(const key_type& aKey, const value_type& aVal) noexcept;
-        void            del(const key_type& aKey)                         noexcept;
-        void            flush()                                           noexcept;
+        read_handle_type read(const key_type& aKey);
+        // the newest version of the key the snapshot sees
+        read_handle_type find(const key_type& aKey, const snapshot_t& aSnapshot = snapshot_t());
+        // find on the memtable only, never blocks on I/O. Absent if the value needs to come from disk
+        read_handle_type find_in_memory(const key_type& aKey)             noexcept;
+        // find for a batch of keys, the keys missing in the memtable share the page reads. All keys
+        // are read from the same snapshot, a new one unless it is given
+        std::vector<read_handle_type> multi_get(const std::vector<key_type>& aKeys);
+        std::vector<read_handle_type> multi_get(const std::vector<key_type>& aKeys, const snapshot_t& aSnapshot);
+        // the writes return false and store nothing if a record does not fit into a page, see
+        // MAX_RECORD_SIZE. A merge checks its operand, see merge_value for the values it grows
+        bool            put(const key_type& aKey, const value_type& aVal) noexcept;
+        // the value expires at aExpiry (see now_ms), it is not found afterwards
+        bool            put(const key_type& aKey, const value_type& aVal, uint64_t aExpiry) noexcept;
+        // sets the expiry time of the current value, false if the key has no value. aFits is false and
+        // nothing changes if the value does not fit into a page together with the expiry time
+        bool            expire(const key_type& aKey, uint64_t aExpiry, bool& aFits);
+        // returns whether the key had a live value, the check and the delete are one step
+        bool            del(const key_type& aKey);
+        // adds aDelta to the integer value of the key, a key without value counts as 0. aResult receives
+        // the sum. False and nothing changes if the value is no integer or the sum overflows
+        bool            increment(const key_type& aKey, int64_t aDelta, int64_t& aResult);
+        // records aOperand for the merge operator, the value is not read
+        bool            merge(const key_type& aKey, const value_type& aOperand) noexcept;
+        // applies all puts and deletes of the batch atomically, the batch is empty afterwards
+        bool            write(write_batch_t<K,V>& aBatch)                 noexcept;
+        // compare and set: stores the value only if the key is at version aVersion (0: it has no
+        // value). aResult receives the new version on success and the current one otherwise, it is
+        // 0 for a value that does not fit into a page
+        bool            put_if(const key_type& aKey, const value_type& aVal, uint64_t aVersion, uint64_t& aResult);
+        // deletes the keys of up to aMax records on disk that have expired, a cache looks at up to
+        // aMax of its keys. Returns the number of records looked at, respectively keys deleted, more
+        // may have expired if it is aMax
+        size_t          sweep(size_t aMax = SWEEP_BATCH);
+        // moves the buffered writes to the disk in the background, they are found meanwhile. With
+        // aWait it returns once they are on disk and a purge of the versions they replaced ran
+        void            flush(bool aWait = false)                         noexcept;
+        // removes all keys
+        void            clear()                                           noexcept;
+        // the memory a cache accounts for in bytes, 0 outside of cache mode
+        size_t          used_memory()                               const noexcept;
 
 
+    public:
+        static constexpr size_t SWEEP_BATCH = 1024;
+
     private:
         const CB&       cb()                                        const noexcept { return *m_cb; }
-        auto&           get_write_mngr()                                  noexcept { return m_write_mngr; }
-        auto&           get_storage_mngr()                                noexcept { return m_storage_mngr; }
+        auto&           get_write_mngr()                                  noexcept { return *m_write_mngr; }
+        auto&           get_storage_mngr()                                noexcept { return *m_storage_mngr; }
+        auto&           get_cache()                                       noexcept { return *m_cache; }
+        // applies the operands, newest first, to the value of aBase
+        read_handle_type fold(const key_type& aKey, read_handle_type&& aBase, const key_val_spvt<K,V>& aOperands) const noexcept;
 
     private:
         const CB*               m_cb;
-        WriteManager<K,V>&      m_write_mngr;
-        StorageManager<K,V>&    m_storage_mngr;
+        const size_t            m_shard;
+        WriteManager<K,V>*      m_write_mngr;   // of the same shard, null in cache mode
+        StorageManager<K,V>*    m_storage_mngr;
+        CacheManager<K,V>*      m_cache;        // of the same shard in cache mode
+        const M                 m_merge;
 
 };
 
-template<typename K, typename V>
-KeyValueStore<K,V>::KeyValueStore() noexcept
+template<typename K, typename V, typename M>
+KeyValueStore<K,V,M>::KeyValueStore(size_t aShard) noexcept
     : m_cb(nullptr)
-    , m_write_mngr(WriteManager<K,V>::get_instance())
-    , m_storage_mngr(StorageManager<K,V>::get_instance())
+    , m_shard(aShard)
+    , m_write_mngr(nullptr)
+    , m_storage_mngr(nullptr)
+    , m_cache(nullptr)
+    , m_merge()
 {
-
 }
 
-template<typename K, typename V>
-KeyValueStore<K,V>::~KeyValueStore() noexcept = default;
+template<typename K, typename V, typename M>
+KeyValueStore<K,V,M>::~KeyValueStore() noexcept = default;
 
-template<typename K, typename V>
-void KeyValueStore<K,V>::init(const CB& aCB) noexcept
+template<typename K, typename V, typename M>
+void KeyValueStore<K,V,M>::init(const CB& aCB, size_t aShards) noexcept
 {
     if(!m_cb)
     {
+        //the managers of the other mode are not even created, a cache has no partition file
         m_cb = &aCB;
+        if(aCB.cache_mode())
+        {
+            m_cache = &CacheManager<K,V>::get_instance(m_shard);
+            get_cache().init(aCB, aShards);
+            get_cache().merge_operator(m_merge);
+            return;
+        }
+        m_write_mngr = &WriteManager<K,V>::get_instance(m_shard);
+        m_storage_mngr = &StorageManager<K,V>::get_instance(m_shard);
         get_write_mngr().init(aCB);
-        get_storage_mngr().init(aCB);
+        get_storage_mngr().init(aCB, aShards);
+        get_storage_mngr().merge_operator(m_merge);
     }
 }
 
-template<typename K, typename V>
-answer_t KeyValueStore<K,V>::request_handler(const string_vt& args) noexcept
+template<typename K, typename V, typename M>
+answer_t KeyValueStore<K,V,M>::request_handler(const request_t& aRequest) noexcept
 {
-    if(args.at(0) == "GET")
+    switch(aRequest.m_cmd)
     {
-        try
+        case CMD::kGET:
         {
-            auto kv = get(key_type(args.at(1)));
-            return std::make_pair("OK", kv.to_string_f());
+            const auto handle = find(key_type(std::string(aRequest.arg(1))));
+            if(!handle)
+            {
+                return miss_answer(handle.status());
+            }
+            return std::make_pair("OK", handle.to_key_val().to_string_f());
         }
-        catch(KeyNotInStorageManagerException& ex)
+        case CMD::kPUT:
+            if(!put(key_type(std::string(aRequest.arg(1))), value_type(std::string(aRequest.arg(2)))))
+            {
+                return std::make_pair("ERROR", "Record too large");
+            }
+            return std::make_pair("OK", "Successful Insert");
+        case CMD::kDEL:
+            del(key_type(std::string(aRequest.arg(1))));
+            return std::make_pair("OK", "Successful Delete");
+        case CMD::kFLUSH:
+            flush();
+            return std::make_pair("OK", "Successful Flush");
+        case CMD::kMSET:
         {
-            return std::make_pair("ERROR", ex.what());
+            //either all pairs are stored or none
+            std::vector<std::pair<key_type, value_type>> pairs;
+            for(size_t i = 1; i + 1 < aRequest.size(); i += 2)
+            {
+                pairs.emplace_back(key_type(std::string(aRequest.arg(i))), value_type(std::string(aRequest.arg(i + 1))));
+                if(key_val_type::disk_size(pairs.back().first, pairs.back().second, false) > MAX_RECORD_SIZE)
+                {
+                    return std::make_pair("ERROR", "Record too large");
+                }
+            }
+            for(const auto& [key, val] : pairs)
+            {
+                put(key, val);
+            }
+            return std::make_pair("OK", "Successful Insert");
         }
-        catch(KeyIsDeletedInWriteManagerException& ex)
+        case CMD::kCLEAR:
+            clear();
+            return std::make_pair("OK", "Successful Clear");
+        case CMD::kINCRBY:
         {
-            return std::make_pair("ERROR", ex.what());
+            int64_t delta;
+            if(!parse_integer(aRequest.arg(2), delta))
+            {
+                return std::make_pair("ERROR", "Value is not an integer");
+            }
+            if(!merge(key_type(std::string(aRequest.arg(1))), M::increment(delta)))
+            {
+                return std::make_pair("ERROR", "Record too large");
+            }
+            return std::make_pair("OK", "Successful Merge");
         }
+        case CMD::kAPPEND:
+            if(!merge(key_type(std::string(aRequest.arg(1))), M::append(aRequest.arg(2))))
+            {
+                return std::make_pair("ERROR", "Record too large");
+            }
+            return std::make_pair("OK", "Successful Merge");
+        case CMD::kMGET:
+        case CMD::kBATCH:
+        case CMD::kCAS:
+        case CMD::kGETIF:
+        case CMD::kPUTEX:
+        case CMD::kEXPIRE:
+        case CMD::kPING:
+        case CMD::kINVALID:
+        default:
+            return std::make_pair("ERROR", "INVALID REQUEST");
+    }
+}
+
+template<typename K, typename V, typename M>
+snapshot_t KeyValueStore<K,V,M>::snapshot() noexcept
+{
+    return cache_mode() ? snapshot_t() : get_write_mngr().snapshot();
+}
+
+template<typename K, typename V, typename M>
+typename KeyValueStore<K,V,M>::key_val_type KeyValueStore<K,V,M>::get(const key_type& aKey)
+{
+    return read(aKey).to_key_val();
+}
+
+template<typename K, typename V, typename M>
+typename KeyValueStore<K,V,M>::read_handle_type KeyValueStore<K,V,M>::read(const key_type& aKey)
+{
+    read_handle_type handle = find(aKey);
+    if(handle.deleted())
+    {
+        throw KeyIsDeletedInWriteManagerException(FLF);
+    }
+    else if(!handle)
+    {
+        throw KeyNotInStorageManagerException(FLF);
+    }
+    return handle;
+}
+
+template<typename K, typename V, typename M>
+typename KeyValueStore<K,V,M>::read_handle_type KeyValueStore<K,V,M>::find(const key_type& aKey, const snapshot_t& aSnapshot)
+{
+    if(cache_mode())
+    {
+        return get_cache().find(aKey);
+    }
+    key_val_spvt<K,V> operands;
+    snapshot_t on_disk;
+    read_handle_type handle = get_write_mngr().find(aKey, operands, aSnapshot, on_disk);
+    if(handle.absent())
+    {
+        handle = get_storage_mngr().find(aKey, on_disk);
+    }
+    return operands.empty() ? std::move(handle) : fold(aKey, std::move(handle), operands);
+}
+
+template<typename K, typename V, typename M>
+typename KeyValueStore<K,V,M>::read_handle_type KeyValueStore<K,V,M>::fold(const key_type& aKey, read_handle_type&& aBase, const key_val_spvt<K,V>& aOperands) const noexcept
+{
+    //the folded value has the version of the newest operand and expires with the value it is based on
+    const uint64_t expiry = aBase.found() ? aBase.expiry() : 0;
+    bool has_value = aBase.found();
+    V value = has_value ? V(std::string(aBase.val())) : V();
+    for(auto it = aOperands.rbegin(); it != aOperands.rend(); ++it)
+    {
+        value = merge_value(m_merge, aKey, has_value ? &value : nullptr, (*it)->val(), expiry != 0);
+        has_value = true;
     }
-    else if(args.at(0) == "PUT")
+    return read_handle_type(std::make_shared<const key_val_type>(aKey, value, MOD::kINSERT, aOperands.front()->seq(), expiry));
+}
+
+template<typename K, typename V, typename M>
+std::vector<typename KeyValueStore<K,V,M>::read_handle_type> KeyValueStore<K,V,M>::multi_get(const std::vector<key_type>& aKeys)
+{
+    //the memtable is searched under one lock, the snapshot keeps the disk reads consistent with it
+    return multi_get(aKeys, snapshot());
+}
+
+template<typename K, typename V, typename M>
+std::vector<typename KeyValueStore<K,V,M>::read_handle_type> KeyValueStore<K,V,M>::multi_get(const std::vector<key_type>& aKeys, const snapshot_t& aSnapshot)
+{
+    std::vector<read_handle_type> handles;
+    handles.reserve(aKeys.size());
+    if(cache_mode())
     {
-        put(key_type(args.at(1)), value_type(args.at(2)));
-        return std::make_pair("OK", "Successful Insert");
+        get_cache().find(aKeys, handles);
+        return handles;
     }
-    else if(args.at(0) == "DEL")
+    std::vector<key_val_spvt<K,V>> operands;
+    snapshot_t on_disk;
+    get_write_mngr().find(aKeys, handles, operands, aSnapshot, on_disk);
+    std::vector<size_t> misses;
+    for(size_t i = 0; i < aKeys.size(); ++i)
     {
-        del(key_type(args.at(1)));
-        return std::make_pair("OK", "Successful Delete");
+        if(handles[i].absent())
+        {
+            misses.push_back(i);
+        }
     }
-    else if(args.at(0) == "FLUSH")
+    if(!misses.empty())
     {
-        flush();
-        return std::make_pair("OK", "Successful Flush");
+        get_storage_mngr().multi_find(aKeys, misses, handles, on_disk);
     }
-    else
+    for(size_t i = 0; i < aKeys.size(); ++i)
     {
-        return std::make_pair("ERROR", "INVALID REQUEST");
+        if(!operands[i].empty())
+        {
+            handles[i] = fold(aKeys[i], std::move(handles[i]), operands[i]);
+        }
     }
+    return handles;
 }
 
-template<typename K, typename V>
-typename KeyValueStore<K,V>::key_val_type KeyValueStore<K,V>::get(const key_type& aKey)
+template<typename K, typename V, typename M>
+typename KeyValueStore<K,V,M>::read_handle_type KeyValueStore<K,V,M>::find_in_memory(const key_type& aKey) noexcept
 {
-    try
+    if(cache_mode())
     {
-        return get_write_mngr().get(aKey);
+        return get_cache().find(aKey);
     }
-    catch(KeyNotInWriteManagerException& ex)
+    key_val_spvt<K,V> operands;
+    read_handle_type handle = get_write_mngr().find(aKey, operands);
+    if(operands.empty() || handle.absent())
     {
-        return get_storage_mngr().get(aKey);
+        return operands.empty() ? std::move(handle) : read_handle_type(FIND::kABSENT);
     }
+    return fold(aKey, std::move(handle), operands);
 }
         
-template<typename K, typename V>
-void KeyValueStore<K,V>::put(const key_type& aKey, const value_type& aVal) noexcept
+template<typename K, typename V, typename M>
+bool KeyValueStore<K,V,M>::put(const key_type& aKey, const value_type& aVal) noexcept
 {
-    get_write_mngr().put(aKey, aVal, MOD::kINSERT);
+    return put(aKey, aVal, 0);
 }
 
-template<typename K, typename V>
-void KeyValueStore<K,V>::del(const key_type& aKey) noexcept
+template<typename K, typename V, typename M>
+bool KeyValueStore<K,V,M>::put(const key_type& aKey, const value_type& aVal, uint64_t aExpiry) noexcept
 {
-    get_write_mngr().put(aKey, V(), MOD::kDELETE);
+    if(key_val_type::disk_size(aKey, aVal, aExpiry != 0) > MAX_RECORD_SIZE)
+    {
+        TRACE_ERROR("Record of key '" + aKey.to_string() + "' is larger than a page");
+        return false;
+    }
+    if(cache_mode())
+    {
+        get_cache().put(aKey, aVal, aExpiry);
+        return true;
+    }
+    get_write_mngr().put(aKey, aVal, MOD::kINSERT, aExpiry);
+    return true;
+}
+
+template<typename K, typename V, typename M>
+bool KeyValueStore<K,V,M>::expire(const key_type& aKey, uint64_t aExpiry, bool& aFits)
+{
+    //writes the current value again with the new expiry time, unless it changed meanwhile
+    aFits = true;
+    while(true)
+    {
+        const read_handle_type handle = find(aKey);
+        if(!handle)
+        {
+            return false;
+        }
+        uint64_t result;
+        const V value(std::string(handle.val()));
+        if(key_val_type::disk_size(aKey, value, true) > MAX_RECORD_SIZE)
+        {
+            TRACE_ERROR("Record of key '" + aKey.to_string() + "' with an expiry time is larger than a page");
+            aFits = false;
+            return false;
+        }
+        if(cache_mode() ? get_cache().put_if(aKey, value, handle.seq(), result, aExpiry) : get_write_mngr().put_if(aKey, value, handle.seq(), result, aExpiry))
+        {
+            return true;
+        }
+    }
+}
+
+template<typename K, typename V, typename M>
+bool KeyValueStore<K,V,M>::increment(const key_type& aKey, int64_t aDelta, int64_t& aResult)
+{
+    //like expire: the sum is written unless the value changed meanwhile, it keeps its expiry time
+    while(true)
+    {
+        const read_handle_type handle = find(aKey);
+        int64_t value = 0;
+        if((handle && !parse_integer(handle.val(), value)) || __builtin_add_overflow(value, aDelta, &aResult))
+        {
+            return false;
+        }
+        const V sum(std::to_string(aResult));
+        const uint64_t expiry = handle ? handle.expiry() : 0;
+        if(key_val_type::disk_size(aKey, sum, expiry != 0) > MAX_RECORD_SIZE)
+        {
+            TRACE_ERROR("Record of key '" + aKey.to_string() + "' is larger than a page");
+            return false;
+        }
+        uint64_t result;
+        const uint64_t version = handle ? handle.seq() : 0;
+        if(cache_mode() ? get_cache().put_if(aKey, sum, version, result, expiry) : get_write_mngr().put_if(aKey, sum, version, result, expiry))
+        {
+            return true;
+        }
+    }
+}
+
+template<typename K, typename V, typename M>
+size_t KeyValueStore<K,V,M>::sweep(size_t aMax)
+{
+    if(cache_mode())
+    {
+        return get_cache().sweep(aMax);
+    }
+    std::vector<key_type> keys;
+    const size_t records = get_storage_mngr().expired(now_ms(), aMax, keys);
+    if(!keys.empty())
+    {
+        get_write_mngr().del_expired(keys);
+    }
+    //the replaced versions and tombstones on disk are purged by the flusher of the write manager
+    return records;
+}
+
+template<typename K, typename V, typename M>
+bool KeyValueStore<K,V,M>::del(const key_type& aKey)
+{
+    return cache_mode() ? get_cache().del(aKey) : get_write_mngr().del(aKey);
+}
+
+template<typename K, typename V, typename M>
+bool KeyValueStore<K,V,M>::merge(const key_type& aKey, const value_type& aOperand) noexcept
+{
+    if(key_val_type::disk_size(aKey, aOperand, false) > MAX_RECORD_SIZE)
+    {
+        TRACE_ERROR("Merge operand of key '" + aKey.to_string() + "' is larger than a page");
+        return false;
+    }
+    if(cache_mode())
+    {
+        get_cache().merge(aKey, aOperand);
+        return true;
+    }
+    get_write_mngr().put(aKey, aOperand, MOD::kMERGE);
+    return true;
+}
+
+template<typename K, typename V, typename M>
+bool KeyValueStore<K,V,M>::put_if(const key_type& aKey, const value_type& aVal, uint64_t aVersion, uint64_t& aResult)
+{
+    if(key_val_type::disk_size(aKey, aVal, false) > MAX_RECORD_SIZE)
+    {
+        TRACE_ERROR("Record of key '" + aKey.to_string() + "' is larger than a page");
+        aResult = 0;
+        return false;
+    }
+    return cache_mode() ? get_cache().put_if(aKey, aVal, aVersion, aResult) : get_write_mngr().put_if(aKey, aVal, aVersion, aResult);
+}
+
+template<typename K, typename V, typename M>
+bool KeyValueStore<K,V,M>::write(write_batch_t<K,V>& aBatch) noexcept
+{
+    if(aBatch.empty())
+    {
+        return true;
+    }
+    if(!aBatch.fits_page())
+    {
+        TRACE_ERROR("Batch with a record larger than a page");
+        return false;
+    }
+    if(cache_mode())
+    {
+        get_cache().write(aBatch);
+        return true;
+    }
+    get_write_mngr().write(aBatch);
+    return true;
+}
+
+template<typename K, typename V, typename M>
+void KeyValueStore<K,V,M>::flush(bool aWait) noexcept
+{
+    //a cache has nothing to write
+    if(!cache_mode())
+    {
+        get_write_mngr().flush(aWait);
+    }
+}
+
+template<typename K, typename V, typename M>
+void KeyValueStore<K,V,M>::clear() noexcept
+{
+    if(cache_mode())
+    {
+        get_cache().clear();
+        return;
+    }
+    get_write_mngr().clear();
 }
 
-template<typename K, typename V>
-void KeyValueStore<K,V>::flush() noexcept
+template<typename K, typename V, typename M>
+size_t KeyValueStore<K,V,M>::used_memory() const noexcept
 {
-    get_write_mngr().flush();
+    return m_cache ? m_cache->used_memory() : 0;
 }
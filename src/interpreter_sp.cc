@@ -1,6 +1,9 @@
 #include "interpreter_sp.hh"
 #include <sstream>
 
+// an empty page takes a record of MAX_RECORD_SIZE bytes, see add_new_record
+static_assert(MAX_RECORD_SIZE == ((PAGE_SIZE - sizeof(InterpreterSP::sp_header_t) - sizeof(InterpreterSP::slot_t)) & ~size_t(7)), "MAX_RECORD_SIZE does not match the page layout");
+
 std::string InterpreterSP::sp_header_t::to_string() noexcept
 {
     std::ostringstream strm;
@@ -32,7 +32,7 @@ int main(const int argc, const char* argv[])
         return -1;
     }
     
-    const CB lCB(lArgs.trace(), lArgs.trace_path(), lArgs.buffer_size(), lArgs.port());
+    const CB lCB(lArgs.trace(), lArgs.trace_path(), lArgs.buffer_size(), lArgs.port(), lArgs.trace_level());
 
     Trace::get_instance().init(lCB);
     auto& kv_store = KeyValueStore<str_key, str_val>::get_instance();
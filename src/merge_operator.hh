@@ -0,0 +1,94 @@
+/**
+ *  @file    merge_operator.hh
+ *  @author  Nick Weber
+ *  @brief   Read-modify-write operations that are recorded as operands and folded lazily
+ *  @bugs    Currently no bugs known
+ *  @todos   -
+ *
+ *  @section DESCRIPTION
+ *      A merge is buffered as an operand (MOD::kMERGE) instead of a value, nothing is read when it
+ *      is written. The operands of a key are folded into its value when the key is read and when it
+ *      is flushed to disk, so the disk only ever holds values. A merge operator is a function object
+ *      V(const V* aBase, const V& aOperand), aBase is null if the key has no value. To serve INCRBY
+ *      and APPEND it also needs to encode their operands, see merge_operator_t.
+ */
+#pragma once
+
+#include "types.hh"
+
+#include <charconv>
+#include <functional>
+#include <string>
+#include <string_view>
+
+// the type erased merge operator used by the storage manager when flushing
+template<typename V>
+using merge_fn_t = std::function<V(const V*, const V&)>;
+
+// a complete signed decimal number, an empty string counts as 0
+inline bool parse_integer(std::string_view aText, int64_t& aValue) noexcept
+{
+    aValue = 0;
+    if(aText.empty())
+    {
+        return true;
+    }
+    const auto [lEnd, lErr] = std::from_chars(aText.data(), aText.data() + aText.size(), aValue);
+    return lErr == std::errc() && lEnd == aText.data() + aText.size();
+}
+
+/* The default merge operator, the first byte of an operand selects its operation:
+ *  'I' <signed decimal>   adds the number to the value, a missing value counts as 0
+ *  'A' <bytes>            appends the bytes to the value, a missing value counts as empty
+ * An increment of a value that is no number, or that would overflow, leaves the value unchanged. */
+template<typename V>
+struct merge_operator_t final
+{
+    static constexpr char INCREMENT = 'I';
+    static constexpr char APPEND = 'A';
+
+    static V increment(int64_t aDelta) noexcept
+    {
+        return V(std::string(1, INCREMENT) + std::to_string(aDelta));
+    }
+
+    static V append(std::string_view aSuffix) noexcept
+    {
+        std::string lOperand(1, APPEND);
+        lOperand.append(aSuffix);
+        return V(std::move(lOperand));
+    }
+
+    V operator()(const V* aBase, const V& aOperand) const noexcept
+    {
+        const std::string_view lOperand = aOperand.view();
+        const std::string_view lBase = aBase ? aBase->view() : std::string_view();
+        if(!lOperand.empty() && lOperand[0] == APPEND)
+        {
+            std::string lValue(lBase);
+            lValue.append(lOperand.substr(1));
+            return V(std::move(lValue));
+        }
+        int64_t lValue;
+        int64_t lDelta;
+        if(!lOperand.empty() && lOperand[0] == INCREMENT && parse_integer(lBase, lValue) && parse_integer(lOperand.substr(1), lDelta)
+            && !__builtin_add_overflow(lValue, lDelta, &lValue))
+        {
+            return V(std::to_string(lValue));
+        }
+        return aBase ? *aBase : V();
+    }
+};
+
+// applies the merge operator aMerge to the value of aKey. A value the operand would grow beyond a page
+// (see MAX_RECORD_SIZE) stays unchanged like the one of an overflowing increment, it could not be stored
+template<typename F, typename K, typename V>
+V merge_value(const F& aMerge, const K& aKey, const V* aBase, const V& aOperand, bool aExpires) noexcept
+{
+    V lValue = aMerge(aBase, aOperand);
+    if(key_val_t<K,V>::disk_size(aKey, lValue, aExpires) > MAX_RECORD_SIZE)
+    {
+        return aBase ? *aBase : V();
+    }
+    return lValue;
+}
@@ -18,6 +18,7 @@ PartitionBase::PartitionBase(const std::string& aPath, const std::string& aName)
 	_pageSize(PAGE_SIZE),
 	_sizeInPages(0),
 	_openCount(0),
+	_openMutex(),
 	_fileDescriptor(-1)
 {
 }
@@ -26,13 +27,14 @@ PartitionBase::~PartitionBase() noexcept = default;
 
 void PartitionBase::open()
 {
+	std::lock_guard<std::mutex> lock(_openMutex);
 	if(_openCount == 0)
 	{
 		_fileDescriptor = ::open(_partitionPath.c_str(), O_RDWR); // call open in global namespace
 		if(_fileDescriptor == -1)
 		{
             const std::string lErrMsg = std::string("An error occured while opening the file: '") + std::string(std::strerror(errno));
-            TRACE(lErrMsg);
+            TRACE_ERROR(lErrMsg);
             throw FileException(FLF, _partitionPath.c_str(), lErrMsg);
 		}
 	}
@@ -41,12 +43,13 @@ void PartitionBase::open()
 
 void PartitionBase::close()
 {
+	std::lock_guard<std::mutex> lock(_openMutex);
 	if(_openCount == 1)
 	{
 		if(::close(_fileDescriptor) == -1) // call close in global namespace
 		{
             const std::string lErrMsg = std::string("An error occured while closing the file: '") + std::string(std::strerror(errno));
-            TRACE(lErrMsg);
+            TRACE_ERROR(lErrMsg);
             throw FileException(FLF, _partitionPath.c_str(), lErrMsg);
 		}
 		--_openCount;
@@ -76,7 +79,7 @@ uint32_t PartitionBase::allocPage()
 		    if(lIndexOfNextFSIP >= _sizeInPages) // Next offset is bigger than the partition
             {
                 const std::string lErrMsg("The partition is full. Can not allocate any new pages on fsip: " + std::to_string(lIndexOfFSIP));
-                TRACE(lErrMsg);
+                TRACE_ERROR(lErrMsg);
 				close();
                 // if file partition: can recover by growing file
                 throw PartitionFullException(FLF, lPagePointer, lIndexOfFSIP); 
@@ -115,18 +118,28 @@ void PartitionBase::readPage(byte* aBuffer, const uint32_t aPageIndex, const uin
 	if(pread(_fileDescriptor, aBuffer, aBufferSize, (aPageIndex * _pageSize)) == -1)
 	{
         const std::string lErrMsg = std::string("An error occured while reading the file: '") + std::string(std::strerror(errno));
-        TRACE(lErrMsg);
+        TRACE_ERROR(lErrMsg);
         throw FileException(FLF, _partitionPath.c_str(), lErrMsg);
 	}
 }
 
+void PartitionBase::prefetchPage(const uint32_t aPageIndex) noexcept
+{
+#ifdef POSIX_FADV_WILLNEED
+	//only a hint, a failure just means the page is read synchronously later
+	static_cast<void>(posix_fadvise(_fileDescriptor, static_cast<off_t>(aPageIndex) * _pageSize, _pageSize, POSIX_FADV_WILLNEED));
+#else
+	static_cast<void>(aPageIndex);
+#endif
+}
+
 void PartitionBase::writePage(const byte* aBuffer, const uint32_t aPageIndex, const uint aBufferSize)
 {
     assert(aBufferSize == PAGE_SIZE && aBufferSize == _pageSize);
 	if(pwrite(_fileDescriptor, aBuffer, aBufferSize, (aPageIndex * _pageSize)) == -1)
 	{
         const std::string lErrMsg = std::string("An error occured while writing the file: '") + std::string(std::strerror(errno));
-        TRACE(lErrMsg);
+        TRACE_ERROR(lErrMsg);
         throw FileException(FLF, _partitionPath.c_str(), lErrMsg);
 	}
 }
@@ -28,6 +28,7 @@
 #endif
 
 #include <iostream>
+#include <mutex>
 #include <string>
 
 class PartitionBase 
@@ -46,7 +47,7 @@ class PartitionBase
     public:
         /**
          *  @brief  Opens the partition in read/write mode. If the partition is already open, an open counter
-         *          will be increased
+         *          will be increased. Safe to call from concurrent readers
          *  @throws FileException on failure
          *  @see    infra/exception.hh
          */
@@ -89,6 +90,13 @@ class PartitionBase
          *  @see    infra/exception.hh
          */
         void                readPage(byte* aBuffer, uint32_t aPageIndex, uint aBufferSize = PAGE_SIZE);
+
+        /**
+         *  @brief  Hints the kernel that a page will be read soon, the pages of several hints are fetched in parallel
+         *
+         *  @param  aPageIndex: an index indicating which page will be read
+         */
+        void                prefetchPage(uint32_t aPageIndex) noexcept;
     
         /**
          *  @brief  Write a page from a main memory buffer on the partition
@@ -153,6 +161,7 @@ class PartitionBase
         uint _pageSize;             // The page size in bytes, used by the partition
         uint _sizeInPages;          // The current size of the partition in number of pages
         uint _openCount;            // Counts the number of open calls
+        std::mutex _openMutex;      // Guards the open count and the file descriptor against concurrent readers
         int _fileDescriptor;        // The partitions file descriptor
 };
 
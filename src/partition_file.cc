@@ -16,7 +16,7 @@ PartitionFile::PartitionFile(const std::string& aPath, const std::string& aName,
         _growthIndicator = 8;
     }
     create();
-    TRACE("'PartitionFile' object constructed (For a new partition)");
+    TRACE_INFO("'PartitionFile' object constructed (For a new partition)");
     TRACE("Initial partition size in pages: " + std::to_string(partSizeInPages()));
 }
 
@@ -24,7 +24,7 @@ PartitionFile::~PartitionFile() noexcept
 {
     close();
     remove();
-    TRACE("'PartitionFile' object destructed");
+    TRACE_INFO("'PartitionFile' object destructed");
 }
 
 uint32_t PartitionFile::allocPage()
@@ -40,11 +40,11 @@ uint32_t PartitionFile::allocPage()
         // Open file again for recovering from the exception
         open();
         // extend
-        TRACE("Extending the file partition. Grow by " + std::to_string(static_cast<uint32_t>(getGrowthIndicator())) + " pages (currently " + std::to_string(_sizeInPages) + " pages)");
+        TRACE_INFO("Extending the file partition. Grow by " + std::to_string(static_cast<uint32_t>(getGrowthIndicator())) + " pages (currently " + std::to_string(_sizeInPages) + " pages)");
         const size_t lNewSize = (_sizeInPages + _growthIndicator) * _pageSize;
         FileUtil::resize(_partitionPath, lNewSize);
         _sizeInPages = lNewSize / _pageSize;
-        TRACE("Extending the file partition was successful. New size is " + std::to_string(_sizeInPages) + " pages");
+        TRACE_INFO("Extending the file partition was successful. New size is " + std::to_string(_sizeInPages) + " pages");
         // extend finished
         // grow fsip
         InterpreterFSIP lFSIP;
@@ -81,7 +81,7 @@ void PartitionFile::create()
 {   
 	if(exists())
 	{
-        TRACE("Partition already exists and cannot be created");
+        TRACE_ERROR("Partition already exists and cannot be created");
         throw PartitionExistsException(FLF);
     }
     TRACE("Creating a file at '" + _partitionPath + "'");
@@ -92,13 +92,13 @@ void PartitionFile::create()
         const size_t lFileSize = _growthIndicator * _pageSize;
         FileUtil::resize(_partitionPath, lFileSize);
         _sizeInPages = partSizeInPages(); 
-        TRACE("File partition (with " + std::to_string(_sizeInPages) + " pages) was successfully created in the file system");
+        TRACE_INFO("File partition (with " + std::to_string(_sizeInPages) + " pages) was successfully created in the file system");
         format(); // may throw
     }
     else
     {
         const std::string lMsg = "Something went wrong while trying to create the file";
-        TRACE(lMsg); 
+        TRACE_ERROR(lMsg); 
         throw PartitionException(FLF, lMsg);
     }
 }
@@ -122,7 +122,7 @@ void PartitionFile::remove()
     else
     {
         lTraceMsg = "Something went wrong while trying to remove the file from the file system";
-        TRACE(lTraceMsg); 
+        TRACE_ERROR(lTraceMsg); 
         throw PartitionException(FLF, lTraceMsg);
     }
 }
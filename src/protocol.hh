@@ -0,0 +1,924 @@
+/**
+ *  @file    protocol.hh
+ *  @author  Nick Weber
+ *  @brief   Wire formats of requests and answers
+ *  @bugs    Currently no bugs known
+ *  @todos   -
+ *
+ *  @section DESCRIPTION
+ *      Text protocol: one request per line, arguments separated by single spaces, the answer is
+ *      'STATUS:MESSAGE\n'.
+ *      Binary protocol: every frame starts with a fixed size header (magic, opcode, flags, status,
+ *      key length, value length, request id; integers little endian), followed by the key and the
+ *      value. Keys and values may contain any byte, the size of a frame is known after its header.
+ *      RESP: the subset of the Redis protocol (version 2) for GET, SET, DEL, MGET, MSET, PING and
+ *      FLUSHALL. Requests are arrays of bulk strings.
+ *      A connection speaks the binary protocol if its first byte is the request magic and RESP if it
+ *      is '*'.
+ *
+ *      The answer writers append to a sink, which provides
+ *          copy(std::string_view)  append a copy of the data
+ *          ref(std::string_view)   append the data, it stays valid until the answer is written
+ *          keep(read_handle&&)     keeps the record referenced by ref() alive
+ */
+#pragma once
+
+#include "types.hh"
+#include "database.hh"
+
+#include <charconv>
+#include <cctype>
+#include <string>
+#include <string_view>
+
+namespace Protocol
+{
+    // the keys of a multi key request, starting at argument 1
+    template<typename K>
+    std::vector<K> request_keys(const request_t& aRequest) noexcept
+    {
+        std::vector<K> lKeys;
+        lKeys.reserve(aRequest.size() - 1);
+        for(size_t i = 1; i < aRequest.size(); ++i)
+        {
+            lKeys.emplace_back(std::string(aRequest.arg(i)));
+        }
+        return lKeys;
+    }
+}
+
+namespace Binary
+{
+    constexpr uint8_t REQUEST_MAGIC = 0xB7;
+    constexpr uint8_t RESPONSE_MAGIC = 0xB8;
+    constexpr size_t HEADER_SIZE = 16;
+    constexpr size_t MAX_FRAME_SIZE = 64 * 1024 * 1024;
+    // the answer may be sent as soon as it is ready, the client matches it by the request id
+    constexpr uint8_t FLAG_UNORDERED = 0x01;
+
+    enum class STATUS : uint8_t
+    {
+        kOK = 0,
+        kNOT_FOUND = 1,
+        kDELETED = 2,
+        kERROR = 3,
+        kVERSION_MISMATCH = 4,  // CAS, the payload is the current version
+        kNOT_MODIFIED = 5       // GETIF
+    };
+
+    struct header_t final
+    {
+        uint8_t     m_magic;
+        uint8_t     m_opcode;   // the value of the CMD
+        uint8_t     m_flags;    // FLAG_UNORDERED, echoed in the answer
+        uint8_t     m_status;   // answers only
+        uint32_t    m_key_length;
+        uint32_t    m_val_length;
+        uint32_t    m_request_id;
+
+        size_t      frame_size()    const noexcept { return HEADER_SIZE + m_key_length + m_val_length; }
+    };
+
+    inline uint32_t load_u32(const char* aMem) noexcept
+    {
+        uint32_t lValue = 0;
+        for(size_t i = 0; i < 4; ++i)
+        {
+            lValue |= static_cast<uint32_t>(static_cast<uint8_t>(aMem[i])) << (8 * i);
+        }
+        return lValue;
+    }
+
+    inline void store_u32(char* aMem, uint32_t aValue) noexcept
+    {
+        for(size_t i = 0; i < 4; ++i)
+        {
+            aMem[i] = static_cast<char>((aValue >> (8 * i)) & 0xFF);
+        }
+    }
+
+    // versions and times to live travel as 8 byte little endian numbers
+    constexpr size_t VERSION_SIZE = 8;
+
+    inline uint64_t load_u64(const char* aMem) noexcept
+    {
+        return static_cast<uint64_t>(load_u32(aMem)) | (static_cast<uint64_t>(load_u32(aMem + 4)) << 32);
+    }
+
+    inline void store_u64(char* aMem, uint64_t aValue) noexcept
+    {
+        store_u32(aMem, static_cast<uint32_t>(aValue & 0xFFFFFFFF));
+        store_u32(aMem + 4, static_cast<uint32_t>(aValue >> 32));
+    }
+
+    // aMem needs to hold at least HEADER_SIZE bytes
+    inline header_t decode(const char* aMem) noexcept
+    {
+        header_t lHeader;
+        lHeader.m_magic = static_cast<uint8_t>(aMem[0]);
+        lHeader.m_opcode = static_cast<uint8_t>(aMem[1]);
+        lHeader.m_flags = static_cast<uint8_t>(aMem[2]);
+        lHeader.m_status = static_cast<uint8_t>(aMem[3]);
+        lHeader.m_key_length = load_u32(aMem + 4);
+        lHeader.m_val_length = load_u32(aMem + 8);
+        lHeader.m_request_id = load_u32(aMem + 12);
+        return lHeader;
+    }
+
+    inline void encode(const header_t& aHeader, char* aMem) noexcept
+    {
+        aMem[0] = static_cast<char>(aHeader.m_magic);
+        aMem[1] = static_cast<char>(aHeader.m_opcode);
+        aMem[2] = static_cast<char>(aHeader.m_flags);
+        aMem[3] = static_cast<char>(aHeader.m_status);
+        store_u32(aMem + 4, aHeader.m_key_length);
+        store_u32(aMem + 8, aHeader.m_val_length);
+        store_u32(aMem + 12, aHeader.m_request_id);
+    }
+
+    /**
+     * @brief  The size of the frame at the start of aBuffer, which may hold only a part of it
+     * @return 0 if the header is incomplete or aError is set: it is no request or larger than MAX_FRAME_SIZE
+     */
+    inline size_t frame_size(std::string_view aBuffer, bool& aError) noexcept
+    {
+        aError = false;
+        if(aBuffer.size() < HEADER_SIZE)
+        {
+            return 0;
+        }
+        const header_t lHeader = decode(aBuffer.data());
+        aError = lHeader.m_magic != REQUEST_MAGIC || lHeader.frame_size() > MAX_FRAME_SIZE;
+        return aError ? 0 : lHeader.frame_size();
+    }
+
+    inline CMD to_cmd(uint8_t aOpcode) noexcept
+    {
+        const bool lKnown = aOpcode <= static_cast<uint8_t>(CMD::kFLUSH) || (aOpcode >= static_cast<uint8_t>(CMD::kBATCH) && aOpcode <= static_cast<uint8_t>(CMD::kEXPIRE));
+        return lKnown ? static_cast<CMD>(aOpcode) : CMD::kINVALID;
+    }
+
+    // aFrame is one complete frame, the arguments of the request are views into it
+    inline void parse_request(std::string_view aFrame, request_t& aRequest) noexcept
+    {
+        const header_t lHeader = decode(aFrame.data());
+        aRequest.m_cmd = to_cmd(lHeader.m_opcode);
+        aRequest.m_protocol = PROTOCOL::kBINARY;
+        aRequest.m_id = lHeader.m_request_id;
+        aRequest.m_unordered = (lHeader.m_flags & FLAG_UNORDERED) != 0;
+        aRequest.m_args.clear();
+        aRequest.m_args.push_back(std::string_view());
+        aRequest.m_args.push_back(aFrame.substr(HEADER_SIZE, lHeader.m_key_length));
+        //the value of a BATCH holds the PUT and DEL frames of its operations, INCRBY a decimal number
+        if(aRequest.m_cmd == CMD::kPUT || aRequest.m_cmd == CMD::kBATCH || aRequest.m_cmd == CMD::kINCRBY || aRequest.m_cmd == CMD::kAPPEND)
+        {
+            aRequest.m_args.push_back(aFrame.substr(HEADER_SIZE + lHeader.m_key_length, lHeader.m_val_length));
+        }
+        //the value of CAS and GETIF starts with the version, the one of PUTEX and EXPIRE with the time
+        //to live in seconds. A shorter one leaves the request invalid
+        const bool lNumbered = aRequest.m_cmd == CMD::kCAS || aRequest.m_cmd == CMD::kGETIF || aRequest.m_cmd == CMD::kPUTEX || aRequest.m_cmd == CMD::kEXPIRE;
+        if(lNumbered && lHeader.m_val_length >= VERSION_SIZE)
+        {
+            const std::string_view lValue = aFrame.substr(HEADER_SIZE + lHeader.m_key_length, lHeader.m_val_length);
+            aRequest.m_args.push_back(lValue.substr(0, VERSION_SIZE));
+            if(aRequest.m_cmd == CMD::kCAS || aRequest.m_cmd == CMD::kPUTEX)
+            {
+                aRequest.m_args.push_back(lValue.substr(VERSION_SIZE));
+            }
+        }
+    }
+
+    // writes the header of an answer with a payload of aLength bytes, the caller appends the payload
+    template<typename S>
+    void write_header(S& aSink, const request_t& aRequest, STATUS aStatus, size_t aLength) noexcept
+    {
+        char lHeader[HEADER_SIZE];
+        const uint8_t lFlags = aRequest.m_unordered ? FLAG_UNORDERED : 0;
+        encode({RESPONSE_MAGIC, static_cast<uint8_t>(aRequest.m_cmd), lFlags, static_cast<uint8_t>(aStatus), 0, static_cast<uint32_t>(aLength), aRequest.m_id}, lHeader);
+        aSink.copy(std::string_view(lHeader, HEADER_SIZE));
+    }
+
+    template<typename S>
+    void write_header(S& aSink, const request_t& aRequest, STATUS aStatus, std::string_view aValue) noexcept
+    {
+        write_header(aSink, aRequest, aStatus, aValue.size());
+    }
+
+    template<typename S>
+    void write_version(S& aSink, uint64_t aVersion) noexcept
+    {
+        char lVersion[VERSION_SIZE];
+        store_u64(lVersion, aVersion);
+        aSink.copy(std::string_view(lVersion, VERSION_SIZE));
+    }
+}
+
+namespace Resp
+{
+    constexpr size_t MAX_ARGS = 1024 * 1024;
+    constexpr size_t MAX_LINE = 32;    // a '*' or '$' line with its number
+
+    inline bool equals_upper(std::string_view aToken, std::string_view aUpper) noexcept
+    {
+        if(aToken.size() != aUpper.size())
+        {
+            return false;
+        }
+        for(size_t i = 0; i < aToken.size(); ++i)
+        {
+            if(std::toupper(static_cast<unsigned char>(aToken[i])) != aUpper[i])
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // command names are case insensitive, SET stores, SETEX stores with a time to live and FLUSHALL
+    // removes all keys
+    inline CMD to_cmd(std::string_view aToken) noexcept
+    {
+        CMD result = CMD::kINVALID;
+        switch(aToken.size())
+        {
+            case 3:
+                if(equals_upper(aToken, "GET")) { result = CMD::kGET; }
+                else if(equals_upper(aToken, "SET")) { result = CMD::kPUT; }
+                else if(equals_upper(aToken, "DEL")) { result = CMD::kDEL; }
+                else if(equals_upper(aToken, "CAS")) { result = CMD::kCAS; }
+                break;
+            case 4:
+                if(equals_upper(aToken, "MGET")) { result = CMD::kMGET; }
+                else if(equals_upper(aToken, "MSET")) { result = CMD::kMSET; }
+                else if(equals_upper(aToken, "PING")) { result = CMD::kPING; }
+                break;
+            case 5:
+                if(equals_upper(aToken, "BATCH")) { result = CMD::kBATCH; }
+                else if(equals_upper(aToken, "GETIF")) { result = CMD::kGETIF; }
+                else if(equals_upper(aToken, "SETEX")) { result = CMD::kPUTEX; }
+                break;
+            case 6:
+                if(equals_upper(aToken, "INCRBY")) { result = CMD::kINCRBY; }
+                else if(equals_upper(aToken, "APPEND")) { result = CMD::kAPPEND; }
+                else if(equals_upper(aToken, "EXPIRE")) { result = CMD::kEXPIRE; }
+                break;
+            case 8:
+                if(equals_upper(aToken, "FLUSHALL")) { result = CMD::kCLEAR; }
+                break;
+            default: result = CMD::kINVALID;
+        }
+        return result;
+    }
+
+    // reads '<aType><number>\r\n' at aPos. Returns false if the line is incomplete, sets aError if it is malformed
+    inline bool read_number(std::string_view aBuffer, size_t& aPos, char aType, size_t& aNumber, bool& aError) noexcept
+    {
+        const size_t lEnd = aBuffer.find("\r\n", aPos);
+        if(lEnd == std::string_view::npos)
+        {
+            aError = aBuffer.size() - aPos > MAX_LINE;
+            return false;
+        }
+        if(aBuffer[aPos] != aType || lEnd == aPos + 1 || lEnd - aPos > MAX_LINE)
+        {
+            aError = true;
+            return false;
+        }
+        size_t lNumber = 0;
+        for(size_t i = aPos + 1; i < lEnd; ++i)
+        {
+            if(aBuffer[i] < '0' || aBuffer[i] > '9')
+            {
+                aError = true;
+                return false;
+            }
+            lNumber = lNumber * 10 + static_cast<size_t>(aBuffer[i] - '0');
+        }
+        aNumber = lNumber;
+        aPos = lEnd + 2;
+        return true;
+    }
+
+    /**
+     * @brief  Parses an array of bulk strings at the start of aBuffer
+     * @return the size of the request, 0 if it is incomplete or aError is set because it is malformed
+     */
+    inline size_t parse_request(std::string_view aBuffer, request_t& aRequest, bool& aError) noexcept
+    {
+        aError = false;
+        size_t lPos = 0;
+        size_t lCount;
+        if(!read_number(aBuffer, lPos, '*', lCount, aError))
+        {
+            return 0;
+        }
+        if(lCount == 0 || lCount > MAX_ARGS)
+        {
+            aError = true;
+            return 0;
+        }
+        aRequest.m_args.clear();
+        for(size_t i = 0; i < lCount; ++i)
+        {
+            size_t lLength;
+            if(!read_number(aBuffer, lPos, '$', lLength, aError))
+            {
+                return 0;
+            }
+            if(lLength > Binary::MAX_FRAME_SIZE)
+            {
+                aError = true;
+                return 0;
+            }
+            if(aBuffer.size() - lPos < lLength + 2)
+            {
+                return 0;
+            }
+            if(aBuffer[lPos + lLength] != '\r' || aBuffer[lPos + lLength + 1] != '\n')
+            {
+                aError = true;
+                return 0;
+            }
+            aRequest.m_args.push_back(aBuffer.substr(lPos, lLength));
+            lPos += lLength + 2;
+        }
+        aRequest.m_cmd = to_cmd(aRequest.arg(0));
+        aRequest.m_protocol = PROTOCOL::kRESP;
+        aRequest.m_id = 0;
+        aRequest.m_unordered = false;
+        return lPos;
+    }
+
+    // aValue is a size or, for ':', any integer
+    template<typename S, typename I>
+    void write_integer(S& aSink, char aType, I aValue) noexcept
+    {
+        char lBuffer[24];
+        lBuffer[0] = aType;
+        const auto [lEnd, lErr] = std::to_chars(lBuffer + 1, lBuffer + sizeof(lBuffer) - 2, aValue);
+        static_cast<void>(lErr);
+        lEnd[0] = '\r';
+        lEnd[1] = '\n';
+        aSink.copy(std::string_view(lBuffer, static_cast<size_t>(lEnd + 2 - lBuffer)));
+    }
+
+    template<typename S, typename H>
+    void write_bulk(S& aSink, H&& aHandle) noexcept
+    {
+        write_integer(aSink, '$', aHandle.val().size());
+        aSink.ref(aHandle.val());
+        aSink.copy("\r\n");
+        aSink.keep(std::forward<H>(aHandle));
+    }
+
+    template<typename S, typename K, typename V, typename M>
+    void write_value(S& aSink, KeyValueStore<K,V,M>& aStore, std::string_view aKey) noexcept
+    {
+        auto handle = aStore.find(K(std::string(aKey)));
+        if(handle)
+        {
+            write_bulk(aSink, std::move(handle));
+        }
+        else
+        {
+            aSink.copy("$-1\r\n");
+        }
+    }
+
+    // the commands whose answers are not derived from the request handlers answer
+    template<typename S, typename K, typename V, typename M>
+    bool execute(S& aSink, KeyValueStore<K,V,M>& aStore, const request_t& aRequest) noexcept
+    {
+        switch(aRequest.m_cmd)
+        {
+            case CMD::kGET:
+                write_value(aSink, aStore, aRequest.arg(1));
+                return true;
+            case CMD::kMGET:
+                write_integer(aSink, '*', aRequest.size() - 1);
+                for(auto& handle : aStore.multi_get(Protocol::request_keys<K>(aRequest)))
+                {
+                    if(handle)
+                    {
+                        write_bulk(aSink, std::move(handle));
+                    }
+                    else
+                    {
+                        aSink.copy("$-1\r\n");
+                    }
+                }
+                return true;
+            case CMD::kDEL:
+            {
+                //answers the number of keys that existed
+                size_t lDeleted = 0;
+                for(size_t i = 1; i < aRequest.size(); ++i)
+                {
+                    lDeleted += aStore.del(K(std::string(aRequest.arg(i))));
+                }
+                write_integer(aSink, ':', lDeleted);
+                return true;
+            }
+            case CMD::kINCRBY:
+            {
+                //answers the new value, the other protocols only record the increment
+                int64_t lDelta;
+                int64_t lValue;
+                if(!parse_integer(aRequest.arg(2), lDelta) || !aStore.increment(K(std::string(aRequest.arg(1))), lDelta, lValue))
+                {
+                    aSink.copy("-ERR value is not an integer or out of range\r\n");
+                    return true;
+                }
+                write_integer(aSink, ':', lValue);
+                return true;
+            }
+            case CMD::kPING:
+                if(aRequest.size() == 2)
+                {
+                    write_integer(aSink, '$', aRequest.arg(1).size());
+                    aSink.copy(aRequest.arg(1));
+                    aSink.copy("\r\n");
+                }
+                else
+                {
+                    aSink.copy("+PONG\r\n");
+                }
+                return true;
+            case CMD::kPUT:
+                if(aRequest.size() != 3)
+                {
+                    //options of SET are not supported
+                    aSink.copy("-ERR syntax error\r\n");
+                    return true;
+                }
+                return false;
+            default:
+                return false;
+        }
+    }
+}
+
+namespace Protocol
+{
+    // parses a complete request of any protocol: a text line, a binary frame or a RESP array
+    inline void parse_request(PROTOCOL aProtocol, std::string_view aRaw, request_t& aRequest) noexcept
+    {
+        bool lError;
+        switch(aProtocol)
+        {
+            case PROTOCOL::kBINARY: Binary::parse_request(aRaw, aRequest); break;
+            case PROTOCOL::kRESP: Resp::parse_request(aRaw, aRequest, lError); break;
+            case PROTOCOL::kTEXT:
+            case PROTOCOL::kUNKNOWN:
+            default: ::parse_request(aRaw, aRequest);
+        }
+    }
+
+    // calls aFunction(cmd, key, value) for every operation of a BATCH request, returns false if the
+    // request is malformed. Text and RESP requests list the operations as arguments, PUT (SET in RESP)
+    // <key> <value> or DEL <key>. The value of a binary request is the sequence of their frames
+    template<typename F>
+    bool for_each_operation(const request_t& aRequest, F&& aFunction) noexcept
+    {
+        if(aRequest.m_protocol == PROTOCOL::kBINARY)
+        {
+            std::string_view lFrames = aRequest.arg(2);
+            while(!lFrames.empty())
+            {
+                if(lFrames.size() < Binary::HEADER_SIZE)
+                {
+                    return false;
+                }
+                const Binary::header_t lHeader = Binary::decode(lFrames.data());
+                const CMD lCmd = Binary::to_cmd(lHeader.m_opcode);
+                if(lHeader.m_magic != Binary::REQUEST_MAGIC || lFrames.size() < lHeader.frame_size() || (lCmd != CMD::kPUT && lCmd != CMD::kDEL))
+                {
+                    return false;
+                }
+                aFunction(lCmd, lFrames.substr(Binary::HEADER_SIZE, lHeader.m_key_length), lFrames.substr(Binary::HEADER_SIZE + lHeader.m_key_length, lHeader.m_val_length));
+                lFrames.remove_prefix(lHeader.frame_size());
+            }
+            return true;
+        }
+        size_t i = 1;
+        while(i < aRequest.size())
+        {
+            const CMD lCmd = aRequest.m_protocol == PROTOCOL::kRESP ? Resp::to_cmd(aRequest.arg(i)) : ::to_cmd(aRequest.arg(i));
+            const size_t lArgs = lCmd == CMD::kPUT ? 3 : (lCmd == CMD::kDEL ? 2 : 0);
+            if(lArgs == 0 || i + lArgs > aRequest.size())
+            {
+                return false;
+            }
+            aFunction(lCmd, aRequest.arg(i + 1), lArgs == 3 ? aRequest.arg(i + 2) : std::string_view());
+            i += lArgs;
+        }
+        return true;
+    }
+
+    // calls aFunction for every key of the request, a valid request with a key is expected
+    template<typename F>
+    void for_each_key(const request_t& aRequest, F&& aFunction) noexcept
+    {
+        if(aRequest.m_cmd == CMD::kBATCH)
+        {
+            for_each_operation(aRequest, [&](CMD, std::string_view aKey, std::string_view){ aFunction(aKey); });
+            return;
+        }
+        //besides MGET and MSET only a RESP DEL has several keys, the other arguments are values or versions
+        size_t lEnd = 2;
+        size_t lStep = 1;
+        const bool lMulti = aRequest.m_cmd == CMD::kMGET || aRequest.m_cmd == CMD::kMSET;
+        if(lMulti || (aRequest.m_protocol == PROTOCOL::kRESP && aRequest.m_cmd == CMD::kDEL))
+        {
+            lEnd = aRequest.size();
+            lStep = aRequest.m_cmd == CMD::kMSET ? 2 : 1;
+        }
+        for(size_t i = 1; i < lEnd; i += lStep)
+        {
+            aFunction(aRequest.arg(i));
+        }
+    }
+
+    // the size of the disk record a write of aKey and aVal leaves, see key_val_t::diskB
+    inline size_t record_size(std::string_view aKey, std::string_view aVal, bool aExpires) noexcept
+    {
+        return string_t::disk_size(aKey.size()) + string_t::disk_size(aVal.size()) + sizeof(uint64_t) * (aExpires ? 2 : 1);
+    }
+
+    // whether the records a valid request writes fit into a page, see MAX_RECORD_SIZE. The values of
+    // a binary BATCH and of RESP arguments may be far larger, they are rejected before they are copied
+    inline bool fits_page(const request_t& aRequest) noexcept
+    {
+        switch(aRequest.m_cmd)
+        {
+            case CMD::kPUT:
+            case CMD::kAPPEND:
+                return record_size(aRequest.arg(1), aRequest.arg(2), false) <= MAX_RECORD_SIZE;
+            case CMD::kMSET:
+                for(size_t i = 1; i + 1 < aRequest.size(); i += 2)
+                {
+                    if(record_size(aRequest.arg(i), aRequest.arg(i + 1), false) > MAX_RECORD_SIZE)
+                    {
+                        return false;
+                    }
+                }
+                return true;
+            case CMD::kCAS:
+            case CMD::kPUTEX:
+                return record_size(aRequest.arg(1), aRequest.arg(3), aRequest.m_cmd == CMD::kPUTEX) <= MAX_RECORD_SIZE;
+            case CMD::kEXPIRE:
+                //the stored value is only known to KeyValueStore::expire, it checks the record again
+                return record_size(aRequest.arg(1), std::string_view(), true) <= MAX_RECORD_SIZE;
+            case CMD::kBATCH:
+            {
+                //a malformed batch is left to the check of its operations
+                bool lFits = true;
+                for_each_operation(aRequest, [&](CMD, std::string_view aKey, std::string_view aVal)
+                {
+                    lFits = lFits && record_size(aKey, aVal, false) <= MAX_RECORD_SIZE;
+                });
+                return lFits;
+            }
+            case CMD::kGET:
+            case CMD::kDEL:
+            case CMD::kFLUSH:
+            case CMD::kMGET:
+            case CMD::kPING:
+            case CMD::kCLEAR:
+            case CMD::kINCRBY:
+            case CMD::kGETIF:
+            case CMD::kINVALID:
+            default:
+                return true;
+        }
+    }
+
+    template<typename S>
+    void write_answer(S& aSink, const request_t& aRequest, const answer_t& aAnswer) noexcept
+    {
+        if(aRequest.m_protocol == PROTOCOL::kBINARY)
+        {
+            //successful answers have no payload, errors carry their message
+            const bool lOk = aAnswer.first == "OK";
+            const std::string_view lValue = lOk ? std::string_view() : std::string_view(aAnswer.second);
+            Binary::write_header(aSink, aRequest, lOk ? Binary::STATUS::kOK : Binary::STATUS::kERROR, lValue);
+            aSink.copy(lValue);
+            return;
+        }
+        if(aRequest.m_protocol == PROTOCOL::kRESP)
+        {
+            aSink.copy(aAnswer.first == "OK" ? "+OK" : "-ERR ");
+            aSink.copy(aAnswer.first == "OK" ? std::string_view() : std::string_view(aAnswer.second));
+            aSink.copy("\r\n");
+            return;
+        }
+        aSink.copy(aAnswer.first);
+        aSink.copy(":");
+        aSink.copy(aAnswer.second);
+        aSink.copy("\n");
+    }
+
+    template<typename S, typename H>
+    void write_found(S& aSink, const request_t& aRequest, H&& aHandle) noexcept
+    {
+        if(aRequest.m_protocol == PROTOCOL::kBINARY)
+        {
+            Binary::write_header(aSink, aRequest, Binary::STATUS::kOK, aHandle.val());
+            aSink.ref(aHandle.val());
+        }
+        else if(aRequest.m_protocol == PROTOCOL::kRESP)
+        {
+            Resp::write_bulk(aSink, std::forward<H>(aHandle));
+            return;
+        }
+        else
+        {
+            aSink.copy("OK:<'");
+            aSink.ref(aHandle.key());
+            aSink.copy("', '");
+            aSink.ref(aHandle.val());
+            aSink.copy("'>\n");
+        }
+        aSink.keep(std::forward<H>(aHandle));
+    }
+
+    template<typename S>
+    void write_miss(S& aSink, const request_t& aRequest, FIND aStatus) noexcept
+    {
+        if(aRequest.m_protocol == PROTOCOL::kBINARY)
+        {
+            Binary::write_header(aSink, aRequest, aStatus == FIND::kDELETED ? Binary::STATUS::kDELETED : Binary::STATUS::kNOT_FOUND, std::string_view());
+            return;
+        }
+        if(aRequest.m_protocol == PROTOCOL::kRESP)
+        {
+            aSink.copy("$-1\r\n");
+            return;
+        }
+        write_answer(aSink, aRequest, miss_answer(aStatus));
+    }
+
+    // the answer of a CAS: the new version, or the current one if it did not match
+    template<typename S>
+    void write_cas(S& aSink, const request_t& aRequest, bool aSuccess, uint64_t aVersion) noexcept
+    {
+        if(aRequest.m_protocol == PROTOCOL::kBINARY)
+        {
+            Binary::write_header(aSink, aRequest, aSuccess ? Binary::STATUS::kOK : Binary::STATUS::kVERSION_MISMATCH, Binary::VERSION_SIZE);
+            Binary::write_version(aSink, aVersion);
+            return;
+        }
+        if(aRequest.m_protocol == PROTOCOL::kRESP)
+        {
+            if(aSuccess)
+            {
+                Resp::write_integer(aSink, ':', aVersion);
+                return;
+            }
+            aSink.copy("-ERR version mismatch, current ");
+            aSink.copy(std::to_string(aVersion));
+            aSink.copy("\r\n");
+            return;
+        }
+        write_answer(aSink, aRequest, std::make_pair(aSuccess ? "OK" : "ERROR", (aSuccess ? "" : "Version mismatch, current ") + std::to_string(aVersion)));
+    }
+
+    // the answer of a GETIF whose key changed: the value with its version
+    template<typename S, typename H>
+    void write_versioned(S& aSink, const request_t& aRequest, H&& aHandle) noexcept
+    {
+        const uint64_t lVersion = aHandle.seq();
+        if(aRequest.m_protocol == PROTOCOL::kBINARY)
+        {
+            Binary::write_header(aSink, aRequest, Binary::STATUS::kOK, Binary::VERSION_SIZE + aHandle.val().size());
+            Binary::write_version(aSink, lVersion);
+            aSink.ref(aHandle.val());
+            aSink.keep(std::forward<H>(aHandle));
+            return;
+        }
+        if(aRequest.m_protocol == PROTOCOL::kRESP)
+        {
+            aSink.copy("*2\r\n");
+            Resp::write_integer(aSink, ':', lVersion);
+            Resp::write_bulk(aSink, std::forward<H>(aHandle));
+            return;
+        }
+        aSink.copy("OK:<'");
+        aSink.ref(aHandle.key());
+        aSink.copy("', '");
+        aSink.ref(aHandle.val());
+        aSink.copy("'> @ ");
+        aSink.copy(std::to_string(lVersion));
+        aSink.copy("\n");
+        aSink.keep(std::forward<H>(aHandle));
+    }
+
+    template<typename S>
+    void write_not_modified(S& aSink, const request_t& aRequest) noexcept
+    {
+        if(aRequest.m_protocol == PROTOCOL::kBINARY)
+        {
+            Binary::write_header(aSink, aRequest, Binary::STATUS::kNOT_MODIFIED, 0);
+            return;
+        }
+        aSink.copy(aRequest.m_protocol == PROTOCOL::kRESP ? "+NOT MODIFIED\r\n" : "OK:Not modified\n");
+    }
+
+    // the second argument of CAS and GETIF (the version) and of PUTEX and EXPIRE (the time to live),
+    // binary requests carry it as a number, the others as text
+    inline bool request_number(const request_t& aRequest, uint64_t& aNumber) noexcept
+    {
+        const std::string_view lNumber = aRequest.arg(2);
+        if(aRequest.m_protocol == PROTOCOL::kBINARY)
+        {
+            aNumber = Binary::load_u64(lNumber.data());
+            return true;
+        }
+        const auto [lEnd, lErr] = std::from_chars(lNumber.data(), lNumber.data() + lNumber.size(), aNumber);
+        return lErr == std::errc() && lEnd == lNumber.data() + lNumber.size();
+    }
+
+    // longest time to live in seconds, the expiry index counts seconds in 32 bits
+    constexpr uint64_t MAX_TTL = uint64_t(1) << 30;
+
+    // the answer of an EXPIRE: RESP answers the number of keys it was set for
+    template<typename S>
+    void write_expire(S& aSink, const request_t& aRequest, bool aSet) noexcept
+    {
+        if(aRequest.m_protocol == PROTOCOL::kRESP)
+        {
+            aSink.copy(aSet ? ":1\r\n" : ":0\r\n");
+            return;
+        }
+        if(!aSet)
+        {
+            write_miss(aSink, aRequest, FIND::kABSENT);
+            return;
+        }
+        write_answer(aSink, aRequest, std::make_pair("OK", "Expiry set"));
+    }
+
+    template<typename S>
+    void write_invalid(S& aSink, const request_t& aRequest) noexcept
+    {
+        if(aRequest.m_protocol == PROTOCOL::kBINARY)
+        {
+            write_answer(aSink, aRequest, std::make_pair("ERROR", "INVALID REQUEST"));
+            return;
+        }
+        if(aRequest.m_protocol == PROTOCOL::kRESP)
+        {
+            write_answer(aSink, aRequest, std::make_pair("ERROR", aRequest.m_cmd == CMD::kINVALID ? "unknown command" : "wrong number of arguments"));
+            return;
+        }
+        //echo the trimmed request line, the arguments cover all of it
+        const std::string_view lFirst = aRequest.arg(0);
+        const std::string_view lLast = aRequest.m_args.back();
+        aSink.copy("ERROR:INVALID REQUEST: '");
+        aSink.copy(std::string_view(lFirst.data(), static_cast<size_t>(lLast.data() + lLast.size() - lFirst.data())));
+        aSink.copy("'\n");
+    }
+
+    // executes the request on aStore and writes its answer
+    template<typename S, typename K, typename V, typename M>
+    void execute(S& aSink, KeyValueStore<K,V,M>& aStore, const request_t& aRequest) noexcept
+    {
+        if(!valid_request(aRequest))
+        {
+            TRACE_ERROR("Invalid Request");
+            write_invalid(aSink, aRequest);
+            return;
+        }
+        if(!fits_page(aRequest))
+        {
+            TRACE_ERROR("Record too large");
+            write_answer(aSink, aRequest, std::make_pair("ERROR", "Record too large"));
+            return;
+        }
+        if(aRequest.m_protocol == PROTOCOL::kRESP && Resp::execute(aSink, aStore, aRequest))
+        {
+            return;
+        }
+        if(aRequest.m_cmd == CMD::kGET)
+        {
+            //GET answers are written straight from the record, without copying the value
+            auto handle = aStore.find(K(std::string(aRequest.arg(1))));
+            if(handle)
+            {
+                write_found(aSink, aRequest, std::move(handle));
+            }
+            else
+            {
+                write_miss(aSink, aRequest, handle.status());
+            }
+        }
+        else if(aRequest.m_cmd == CMD::kCAS || aRequest.m_cmd == CMD::kGETIF)
+        {
+            uint64_t lVersion;
+            if(!request_number(aRequest, lVersion))
+            {
+                write_answer(aSink, aRequest, std::make_pair("ERROR", "Version is not a number"));
+                return;
+            }
+            const K lKey(std::string(aRequest.arg(1)));
+            if(aRequest.m_cmd == CMD::kCAS)
+            {
+                uint64_t lResult;
+                const bool lSuccess = aStore.put_if(lKey, V(std::string(aRequest.arg(3))), lVersion, lResult);
+                write_cas(aSink, aRequest, lSuccess, lResult);
+                return;
+            }
+            auto handle = aStore.find(lKey);
+            if(!handle)
+            {
+                write_miss(aSink, aRequest, handle.status());
+            }
+            else if(handle.seq() == lVersion)
+            {
+                write_not_modified(aSink, aRequest);
+            }
+            else
+            {
+                write_versioned(aSink, aRequest, std::move(handle));
+            }
+        }
+        else if(aRequest.m_cmd == CMD::kPUTEX || aRequest.m_cmd == CMD::kEXPIRE)
+        {
+            uint64_t lSeconds;
+            if(!request_number(aRequest, lSeconds) || lSeconds == 0 || lSeconds > MAX_TTL)
+            {
+                write_answer(aSink, aRequest, std::make_pair("ERROR", "Invalid expire time"));
+                return;
+            }
+            const uint64_t lExpiry = now_ms() + lSeconds * 1000;
+            const K lKey(std::string(aRequest.arg(1)));
+            if(aRequest.m_cmd == CMD::kPUTEX)
+            {
+                aStore.put(lKey, V(std::string(aRequest.arg(3))), lExpiry);
+                write_answer(aSink, aRequest, std::make_pair("OK", "Successful Insert"));
+                return;
+            }
+            bool lFits;
+            const bool lSet = aStore.expire(lKey, lExpiry, lFits);
+            if(!lFits)
+            {
+                write_answer(aSink, aRequest, std::make_pair("ERROR", "Record too large"));
+                return;
+            }
+            write_expire(aSink, aRequest, lSet);
+        }
+        else if(aRequest.m_cmd == CMD::kBATCH)
+        {
+            //a malformed batch is rejected as a whole
+            write_batch_t<K,V> lBatch;
+            const bool lOk = for_each_operation(aRequest, [&](CMD aCmd, std::string_view aKey, std::string_view aVal)
+            {
+                if(aCmd == CMD::kPUT)
+                {
+                    lBatch.put(K(std::string(aKey)), V(std::string(aVal)));
+                }
+                else
+                {
+                    lBatch.del(K(std::string(aKey)));
+                }
+            });
+            if(!lOk)
+            {
+                write_invalid(aSink, aRequest);
+                return;
+            }
+            aStore.write(lBatch);
+            write_answer(aSink, aRequest, std::make_pair("OK", "Successful Batch"));
+        }
+        else if(aRequest.m_cmd == CMD::kMGET)
+        {
+            //one answer per key, like the answers of single GETs
+            for(auto& handle : aStore.multi_get(request_keys<K>(aRequest)))
+            {
+                if(handle)
+                {
+                    write_found(aSink, aRequest, std::move(handle));
+                }
+                else
+                {
+                    write_miss(aSink, aRequest, handle.status());
+                }
+            }
+        }
+        else
+        {
+            write_answer(aSink, aRequest, aStore.request_handler(aRequest));
+        }
+    }
+
+    // sink collecting a complete answer in a string
+    struct string_sink_t final
+    {
+        std::string& m_out;
+
+        void copy(std::string_view aData)   noexcept { m_out.append(aData); }
+        void ref(std::string_view aData)    noexcept { m_out.append(aData); }
+        template<typename H>
+        void keep(H&&)                      noexcept {}
+    };
+}
@@ -0,0 +1,335 @@
+/**
+ *  @file    row_cache.hh
+ *  @author  Nick Weber
+ *  @brief   Decoded disk records of hot keys, kept above the storage manager
+ *  @bugs    Currently no bugs known
+ *  @todos   -
+ *
+ *  @section DESCRIPTION
+ *      A hit on the row cache saves the storage manager the page read, the slot lookup and the
+ *      decoding of the record, the read handle shares the decoded entry. An entry is the newest
+ *      disk version of its key, a tombstone included, so it answers every snapshot that sees it.
+ *      The storage manager drops the entries of all keys a flush writes.
+ *      The entries are spread over segments by the hash of their key, every segment has its own
+ *      lock, LRU list and budget. A read only caches the record if TinyLFU admits it: a count-min
+ *      sketch estimates how often the keys were looked up lately, and a new key must be more
+ *      frequent than the least recently used entry it would evict. A scan over cold keys thus
+ *      leaves the cache alone. The counters are halved once the sketch saw ten lookups per counter.
+ */
+#pragma once
+
+#include "types.hh"
+#include "trace.hh"
+
+#include <array>
+#include <atomic>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+template<typename K, typename V>
+class RowCache final
+{
+    public:
+        using key_type = K;
+        using value_type = V;
+        using key_val_type = key_val_t<key_type, value_type>;
+
+    public:
+        RowCache()                                                        noexcept;
+        RowCache(const RowCache&)                                         noexcept = delete;
+        RowCache& operator=(const RowCache&)                              noexcept = delete;
+        RowCache(RowCache&&)                                              noexcept = delete;
+        RowCache& operator=(RowCache&&)                                   noexcept = delete;
+        ~RowCache()                                                       noexcept;
+
+    public:
+        // the budget of the entries in bytes, 0 disables the cache. Only called before the first lookup
+        void            init(size_t aCapacity)                            noexcept;
+        bool            enabled()                                   const noexcept { return m_capacity > 0; }
+        // the cached version of the key if the snapshot sees it, null otherwise. aHash is the hash of
+        // the key, every lookup counts for its admission
+        key_val_spt<K,V> find(uint64_t aHash, const key_type& aKey, const snapshot_t& aSnapshot) noexcept;
+        // caches the disk record of aSize bytes at aRecord, it must be the newest version of its key
+        void            insert(uint64_t aHash, const byte* aRecord, size_t aSize) noexcept;
+        // drops the entry of the key, its disk version changed
+        void            erase(uint64_t aHash)                             noexcept;
+        void            clear()                                           noexcept;
+        size_t          size()                                      const noexcept;
+        // the heap memory of the entries in bytes, without the sketch
+        size_t          used_memory()                               const noexcept;
+        uint64_t        hits()                                      const noexcept { return m_hits.load(std::memory_order_relaxed); }
+        uint64_t        misses()                                    const noexcept { return m_misses.load(std::memory_order_relaxed); }
+
+    private:
+        struct entry_t final
+        {
+            uint64_t            m_hash;
+            key_val_spt<K,V>    m_key_val;  // shared with the read handles
+            size_t              m_charge;   // the heap memory of the entry
+        };
+        using lru_type = std::list<entry_t>;
+
+        struct segment_t final
+        {
+            mutable std::mutex                                          m_mtx;
+            lru_type                                                    m_lru;      // most recently used first
+            std::unordered_map<uint64_t, typename lru_type::iterator>   m_index;
+            std::vector<uint8_t>                                        m_sketch;   // SKETCH_ROWS rows of saturating counters
+            size_t                                                      m_samples;  // the lookups since the counters were halved
+            size_t                                                      m_used;
+        };
+
+    private:
+        segment_t&      segment(uint64_t aHash)                           noexcept { return m_segments[aHash % SEGMENTS]; }
+        size_t          counter(uint64_t aHash, size_t aRow)        const noexcept;
+        void            count_no_lock(segment_t& aSegment, uint64_t aHash) noexcept;
+        uint8_t         frequency_no_lock(const segment_t& aSegment, uint64_t aHash) const noexcept;
+        // whether an entry of aCharge bytes for the key may evict the least recently used entries
+        bool            admit_no_lock(const segment_t& aSegment, uint64_t aHash, size_t aCharge) const noexcept;
+        void            erase_no_lock(segment_t& aSegment, typename lru_type::iterator aIt) noexcept;
+        // the memory of an entry with a key and a value of the given lengths
+        static size_t   charge(size_t aKeyLength, size_t aValLength)      noexcept;
+
+    private:
+        static constexpr size_t     SEGMENTS = 16;
+        static constexpr size_t     SKETCH_ROWS = 4;
+        static constexpr uint8_t    SKETCH_MAX = 15;
+        static constexpr size_t     SKETCH_AGE = 10;    // lookups per counter before they are halved
+
+    private:
+        size_t                              m_capacity;
+        size_t                              m_segment_capacity;
+        size_t                              m_width;    // the counters of a sketch row, a power of two
+        std::atomic<uint64_t>               m_hits;
+        std::atomic<uint64_t>               m_misses;
+        std::array<segment_t, SEGMENTS>     m_segments;
+
+};
+
+template<typename K, typename V>
+RowCache<K,V>::RowCache() noexcept
+    : m_capacity(0)
+    , m_segment_capacity(0)
+    , m_width(0)
+    , m_hits(0)
+    , m_misses(0)
+    , m_segments()
+{}
+
+template<typename K, typename V>
+RowCache<K,V>::~RowCache() noexcept = default;
+
+template<typename K, typename V>
+void RowCache<K,V>::init(size_t aCapacity) noexcept
+{
+    m_capacity = aCapacity;
+    m_segment_capacity = aCapacity / SEGMENTS;
+    //about one counter per hundred bytes of entries
+    m_width = 64;
+    while(m_width < m_segment_capacity / 128 && m_width < (size_t(1) << 16))
+    {
+        m_width <<= 1;
+    }
+    for(segment_t& lSegment : m_segments)
+    {
+        lSegment.m_sketch.assign(enabled() ? SKETCH_ROWS * m_width : 0, 0);
+        lSegment.m_samples = 0;
+        lSegment.m_used = 0;
+    }
+    TRACE_INFO("RowCache initialized with " + std::to_string(aCapacity) + " bytes");
+}
+
+template<typename K, typename V>
+key_val_spt<K,V> RowCache<K,V>::find(uint64_t aHash, const key_type& aKey, const snapshot_t& aSnapshot) noexcept
+{
+    if(!enabled())
+    {
+        return nullptr;
+    }
+    segment_t& lSegment = segment(aHash);
+    std::lock_guard lock(lSegment.m_mtx);
+    count_no_lock(lSegment, aHash);
+    const auto it = lSegment.m_index.find(aHash);
+    if(it == lSegment.m_index.end() || it->second->m_key_val->key() != aKey || !aSnapshot.sees(it->second->m_key_val->seq()))
+    {
+        m_misses.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+    lSegment.m_lru.splice(lSegment.m_lru.begin(), lSegment.m_lru, it->second);
+    m_hits.fetch_add(1, std::memory_order_relaxed);
+    return it->second->m_key_val;
+}
+
+template<typename K, typename V>
+void RowCache<K,V>::insert(uint64_t aHash, const byte* aRecord, size_t aSize) noexcept
+{
+    if(!enabled() || aSize > m_segment_capacity)
+    {
+        return;
+    }
+    //the charge follows from the lengths in the record, it is only decoded once it is admitted
+    const size_t lCharge = charge(key_type::view(aRecord).size(), value_type::view(key_type::skip(aRecord)).size());
+    if(lCharge > m_segment_capacity)
+    {
+        return;
+    }
+    segment_t& lSegment = segment(aHash);
+    {
+        std::lock_guard lock(lSegment.m_mtx);
+        const auto it = lSegment.m_index.find(aHash);
+        if(it != lSegment.m_index.end())
+        {
+            erase_no_lock(lSegment, it->second);
+        }
+        if(!admit_no_lock(lSegment, aHash, lCharge))
+        {
+            return;
+        }
+    }
+    //decoded without the lock, the caller keeps the disk version of the key as it is. Another reader
+    //may have cached it meanwhile
+    auto lEntry = std::make_shared<key_val_type>();
+    lEntry->to_memory(aRecord);
+    std::lock_guard lock(lSegment.m_mtx);
+    const auto it = lSegment.m_index.find(aHash);
+    if(it != lSegment.m_index.end())
+    {
+        erase_no_lock(lSegment, it->second);
+    }
+    while(lSegment.m_used + lCharge > m_segment_capacity)
+    {
+        erase_no_lock(lSegment, std::prev(lSegment.m_lru.end()));
+    }
+    lSegment.m_lru.push_front({aHash, std::move(lEntry), lCharge});
+    lSegment.m_index.emplace(aHash, lSegment.m_lru.begin());
+    lSegment.m_used += lCharge;
+}
+
+template<typename K, typename V>
+void RowCache<K,V>::erase(uint64_t aHash) noexcept
+{
+    if(!enabled())
+    {
+        return;
+    }
+    segment_t& lSegment = segment(aHash);
+    std::lock_guard lock(lSegment.m_mtx);
+    const auto it = lSegment.m_index.find(aHash);
+    if(it != lSegment.m_index.end())
+    {
+        erase_no_lock(lSegment, it->second);
+    }
+}
+
+template<typename K, typename V>
+void RowCache<K,V>::clear() noexcept
+{
+    for(segment_t& lSegment : m_segments)
+    {
+        std::lock_guard lock(lSegment.m_mtx);
+        lSegment.m_index.clear();
+        lSegment.m_lru.clear();
+        lSegment.m_used = 0;
+    }
+}
+
+template<typename K, typename V>
+size_t RowCache<K,V>::size() const noexcept
+{
+    size_t lSize = 0;
+    for(const segment_t& lSegment : m_segments)
+    {
+        std::lock_guard lock(lSegment.m_mtx);
+        lSize += lSegment.m_index.size();
+    }
+    return lSize;
+}
+
+template<typename K, typename V>
+size_t RowCache<K,V>::used_memory() const noexcept
+{
+    size_t lUsed = 0;
+    for(const segment_t& lSegment : m_segments)
+    {
+        std::lock_guard lock(lSegment.m_mtx);
+        lUsed += lSegment.m_used;
+    }
+    return lUsed;
+}
+
+template<typename K, typename V>
+size_t RowCache<K,V>::counter(uint64_t aHash, size_t aRow) const noexcept
+{
+    //the segment is chosen by the low bits, every row mixes the hash with its own odd multiplier
+    static constexpr uint64_t lSeeds[SKETCH_ROWS] = {0x9E3779B97F4A7C15ull, 0xC2B2AE3D27D4EB4Full, 0x165667B19E3779F9ull, 0xD6E8FEB86659FD93ull};
+    const uint64_t lMixed = (aHash ^ (aHash >> 31)) * lSeeds[aRow];
+    return aRow * m_width + static_cast<size_t>((lMixed >> 32) & (m_width - 1));
+}
+
+template<typename K, typename V>
+void RowCache<K,V>::count_no_lock(segment_t& aSegment, uint64_t aHash) noexcept
+{
+    //conservative update: only the smallest counters grow, the estimate overcounts less
+    const uint8_t lMin = frequency_no_lock(aSegment, aHash);
+    if(lMin < SKETCH_MAX)
+    {
+        for(size_t i = 0; i < SKETCH_ROWS; ++i)
+        {
+            uint8_t& lCounter = aSegment.m_sketch[counter(aHash, i)];
+            if(lCounter == lMin)
+            {
+                ++lCounter;
+            }
+        }
+    }
+    if(++aSegment.m_samples >= SKETCH_AGE * m_width)
+    {
+        for(uint8_t& lCounter : aSegment.m_sketch)
+        {
+            lCounter = static_cast<uint8_t>(lCounter >> 1);
+        }
+        aSegment.m_samples = 0;
+    }
+}
+
+template<typename K, typename V>
+uint8_t RowCache<K,V>::frequency_no_lock(const segment_t& aSegment, uint64_t aHash) const noexcept
+{
+    uint8_t lMin = SKETCH_MAX;
+    for(size_t i = 0; i < SKETCH_ROWS; ++i)
+    {
+        lMin = std::min(lMin, aSegment.m_sketch[counter(aHash, i)]);
+    }
+    return lMin;
+}
+
+template<typename K, typename V>
+bool RowCache<K,V>::admit_no_lock(const segment_t& aSegment, uint64_t aHash, size_t aCharge) const noexcept
+{
+    //the last entry is not replaced by a key looked up as seldom as it
+    if(aSegment.m_lru.empty() || aSegment.m_used + aCharge <= m_segment_capacity)
+    {
+        return true;
+    }
+    return frequency_no_lock(aSegment, aHash) > frequency_no_lock(aSegment, aSegment.m_lru.back().m_hash);
+}
+
+template<typename K, typename V>
+void RowCache<K,V>::erase_no_lock(segment_t& aSegment, typename lru_type::iterator aIt) noexcept
+{
+    aSegment.m_used -= aIt->m_charge;
+    aSegment.m_index.erase(aIt->m_hash);
+    aSegment.m_lru.erase(aIt);
+}
+
+template<typename K, typename V>
+size_t RowCache<K,V>::charge(size_t aKeyLength, size_t aValLength) noexcept
+{
+    //the list node, the index node, the block make_shared allocates for the entry and the heap
+    //buffers of the key and the value
+    const size_t lNodes = malloc_size(2 * sizeof(void*) + sizeof(entry_t)) + malloc_size(sizeof(void*) + sizeof(std::pair<const uint64_t, typename lru_type::iterator>));
+    const size_t lEntry = malloc_size(sizeof(void*) + 2 * sizeof(int) + sizeof(key_val_type)) + key_type::allocated(aKeyLength) + value_type::allocated(aValLength);
+    return lNodes + lEntry;
+}
@@ -0,0 +1,45 @@
+/**
+ *  @file    rw_mutex.hh
+ *  @author  Nick Weber
+ *  @brief   Shared mutex that prefers the exclusive lock over new shared locks
+ *  @bugs    Currently no bugs known
+ *  @todos   -
+ *
+ *  @section DESCRIPTION
+ *      std::shared_mutex prefers the readers on glibc: a new shared lock is granted while an
+ *      exclusive lock waits, so a steady stream of readers starves the writer. Once a thread waits
+ *      for the exclusive lock, new shared locks wait here as well. A thread must not take the shared
+ *      lock twice, the second one may wait for the writer waiting for the first. It is used like
+ *      std::shared_mutex with std::shared_lock, std::lock_guard and std::unique_lock.
+ */
+#pragma once
+
+#include <pthread.h>
+
+class rw_mutex_t final
+{
+    public:
+        rw_mutex_t()                                            noexcept
+        {
+            pthread_rwlockattr_t attr;
+            pthread_rwlockattr_init(&attr);
+            pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+            pthread_rwlock_init(&m_lock, &attr);
+            pthread_rwlockattr_destroy(&attr);
+        }
+        rw_mutex_t(const rw_mutex_t&)                           noexcept = delete;
+        rw_mutex_t& operator=(const rw_mutex_t&)                noexcept = delete;
+        rw_mutex_t(rw_mutex_t&&)                                noexcept = delete;
+        rw_mutex_t& operator=(rw_mutex_t&&)                     noexcept = delete;
+        ~rw_mutex_t()                                           noexcept { pthread_rwlock_destroy(&m_lock); }
+
+        void lock()                                             noexcept { pthread_rwlock_wrlock(&m_lock); }
+        bool try_lock()                                         noexcept { return pthread_rwlock_trywrlock(&m_lock) == 0; }
+        void unlock()                                           noexcept { pthread_rwlock_unlock(&m_lock); }
+        void lock_shared()                                      noexcept { pthread_rwlock_rdlock(&m_lock); }
+        bool try_lock_shared()                                  noexcept { return pthread_rwlock_tryrdlock(&m_lock) == 0; }
+        void unlock_shared()                                    noexcept { pthread_rwlock_unlock(&m_lock); }
+
+    private:
+        pthread_rwlock_t m_lock;
+};
@@ -5,10 +5,13 @@
 #include "database.hh"
 
 #include "tcp_server.hh"
+#include "shard_router.hh"
 #include <boost/asio.hpp>
 
 #include <chrono>
 #include <thread>
+#include <vector>
+#include <algorithm>
 #include <iostream>
 
 
@@ -35,22 +38,50 @@ int main(const int argc, const char* argv[])
         return -1;
     }
 
-    const CB lCB(lArgs.trace(), lArgs.trace_path(), lArgs.buffer_size(), lArgs.port());
+    const EVICTION lEviction = to_eviction(lArgs.eviction());
+    if(lEviction == EVICTION::kINVALID)
+    {
+        std::cerr << "The eviction policy is invalid." << std::endl;
+        return -1;
+    }
+
+    const CB lCB(lArgs.trace(), lArgs.trace_path(), lArgs.buffer_size(), lArgs.port(), lArgs.trace_level(), lArgs.threads(), lArgs.thread_per_core(),
+                 static_cast<size_t>(lArgs.maxmemory()) << 20, lEviction, static_cast<size_t>(lArgs.row_cache()) << 20);
 
 
     Trace::get_instance().init(lCB);
     auto& kv_store = KeyValueStore<str_key, str_val>::get_instance();
-    kv_store.init(lCB);
 
     try
     {
-        boost::asio::io_service io_service;
-        tcp_server server(io_service, lCB.port());
-        io_service.run();
+        const uint lThreads = lCB.threads() > 0 ? lCB.threads() : std::max(1u, std::thread::hardware_concurrency());
+        if(lCB.thread_per_core())
+        {
+            //shared nothing: every thread runs its own io_context and owns a shard of the keyspace
+            shard_router lRouter(lCB, std::min<size_t>(lThreads, MAX_SHARDS));
+            lRouter.run();
+            return 0;
+        }
+        //a fixed pool of threads runs the handlers of all connections
+        kv_store.init(lCB);
+        boost::asio::io_context io_context(static_cast<int>(lThreads));
+        tcp_server server(io_context, lCB.port());
+        std::vector<std::thread> lPool;
+        for(uint i = 1; i < lThreads; ++i)
+        {
+            lPool.emplace_back([&io_context](){ io_context.run(); });
+        }
+        io_context.run();
+        for(auto& thread : lPool)
+        {
+            thread.join();
+        }
     }
     catch (std::exception& e)
     {
+        //e.g. the port is in use
         std::cerr << e.what() << std::endl;
+        return -1;
     }
 
     return 0;
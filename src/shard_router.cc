@@ -0,0 +1,179 @@
+#include "shard_router.hh"
+#include "tcp_connection.hh"
+#include "database.hh"
+#include "protocol.hh"
+#include "trace.hh"
+
+#include <algorithm>
+#include <functional>
+#include <thread>
+
+#ifdef __linux__
+    #include <pthread.h>
+    #include <sched.h>
+#endif
+
+namespace
+{
+    constexpr size_t INBOX_SIZE = 256; // messages per pair of cores, needs to be a power of 2
+}
+
+shard_router::core_t::core_t(size_t aCores) noexcept
+    : m_io_context(1)
+    , m_inbox()
+    , m_overflow(std::make_unique<std::atomic<size_t>[]>(aCores))
+    , m_scheduled(false)
+    , m_parsed()
+    , m_server()
+{
+    for(size_t i = 0; i < aCores; ++i)
+    {
+        m_inbox.emplace_back(std::make_unique<spsc_queue_t<message_t>>(INBOX_SIZE));
+        m_overflow[i].store(0);
+    }
+}
+
+shard_router::shard_router(const CB& aCB, size_t aCores)
+    : m_cores()
+{
+    assert(aCores > 0 && aCores <= MAX_SHARDS);
+    for(size_t i = 0; i < aCores; ++i)
+    {
+        KeyValueStore<str_key, str_val>::get_instance(i).init(aCB, aCores);
+        m_cores.emplace_back(std::make_unique<core_t>(aCores));
+        m_cores.back()->m_server = std::make_unique<tcp_server>(m_cores.back()->m_io_context, aCB.port(), this, i);
+    }
+    TRACE_INFO("Shard router with " + std::to_string(aCores) + " cores constructed");
+}
+
+shard_router::~shard_router() noexcept = default;
+
+void shard_router::run() noexcept
+{
+    std::vector<std::thread> lThreads;
+    for(size_t i = 0; i < cores(); ++i)
+    {
+        lThreads.emplace_back([this, i]()
+        {
+            pin(i);
+            m_cores[i]->m_io_context.run();
+        });
+    }
+    for(auto& thread : lThreads)
+    {
+        thread.join();
+    }
+}
+
+size_t shard_router::shard_of(std::string_view aKey) const noexcept
+{
+    const size_t lOpen = aKey.find('{');
+    if(lOpen != std::string_view::npos)
+    {
+        const size_t lClose = aKey.find('}', lOpen + 1);
+        if(lClose != std::string_view::npos && lClose > lOpen + 1)
+        {
+            aKey = aKey.substr(lOpen + 1, lClose - lOpen - 1);
+        }
+    }
+    return std::hash<std::string_view>{}(aKey) % cores();
+}
+
+void shard_router::forward(size_t aFrom, size_t aTo, message_t&& aMessage) noexcept
+{
+    core_t& lCore = *m_cores[aTo];
+    if(lCore.m_overflow[aFrom].load(std::memory_order_acquire) == 0 && lCore.m_inbox[aFrom]->try_push(std::move(aMessage)))
+    {
+        notify(aTo);
+        return;
+    }
+    //the queue is full: post the message instead. Later messages follow the same path until the posted
+    //ones are handled, and every posted one first handles the older queued ones, so the order is kept
+    TRACE("Inbox of core " + std::to_string(aTo) + " is full, post the message");
+    lCore.m_overflow[aFrom].fetch_add(1, std::memory_order_relaxed);
+    boost::asio::post(lCore.m_io_context, [this, aTo, aFrom, lMessage = std::move(aMessage)]() mutable
+    {
+        drain(aTo, aFrom);
+        handle(aTo, lMessage);
+        m_cores[aTo]->m_overflow[aFrom].fetch_sub(1, std::memory_order_release);
+    });
+}
+
+void shard_router::flush_all() noexcept
+{
+    //a flush is rare, the locks of the stores make it safe to run it from any core
+    for(size_t i = 0; i < cores(); ++i)
+    {
+        KeyValueStore<str_key, str_val>::get_instance(i).flush();
+    }
+}
+
+void shard_router::clear_all() noexcept
+{
+    for(size_t i = 0; i < cores(); ++i)
+    {
+        KeyValueStore<str_key, str_val>::get_instance(i).clear();
+    }
+}
+
+void shard_router::notify(size_t aCore) noexcept
+{
+    //at most one drain is pending per core, no matter how many messages arrive meanwhile
+    core_t& lCore = *m_cores[aCore];
+    if(!lCore.m_scheduled.exchange(true, std::memory_order_acq_rel))
+    {
+        boost::asio::post(lCore.m_io_context, [this, aCore](){ drain(aCore); });
+    }
+}
+
+void shard_router::drain(size_t aCore) noexcept
+{
+    //reset before draining, a message pushed afterwards schedules the next drain
+    m_cores[aCore]->m_scheduled.exchange(false, std::memory_order_acq_rel);
+    for(size_t i = 0; i < cores(); ++i)
+    {
+        drain(aCore, i);
+    }
+}
+
+void shard_router::drain(size_t aCore, size_t aFrom) noexcept
+{
+    message_t lMessage;
+    while(m_cores[aCore]->m_inbox[aFrom]->try_pop(lMessage))
+    {
+        handle(aCore, lMessage);
+    }
+}
+
+void shard_router::handle(size_t aCore, message_t& aMessage) noexcept
+{
+    if(aMessage.m_reply)
+    {
+        aMessage.m_connection->complete(aMessage.m_slot, std::move(aMessage.m_answer));
+        return;
+    }
+    request_t& lRequest = m_cores[aCore]->m_parsed;
+    Protocol::parse_request(aMessage.m_protocol, aMessage.m_request, lRequest);
+    aMessage.m_answer.clear();
+    Protocol::string_sink_t lSink{aMessage.m_answer};
+    Protocol::execute(lSink, KeyValueStore<str_key, str_val>::get_instance(aCore), lRequest);
+    aMessage.m_request.clear();
+    aMessage.m_reply = true;
+    forward(aCore, aMessage.m_origin, std::move(aMessage));
+}
+
+void shard_router::pin(size_t aCore) noexcept
+{
+#ifdef __linux__
+    const size_t lCpus = std::max(1u, std::thread::hardware_concurrency());
+    cpu_set_t lSet;
+    CPU_ZERO(&lSet);
+    CPU_SET(aCore % lCpus, &lSet);
+    if(pthread_setaffinity_np(pthread_self(), sizeof(lSet), &lSet) != 0)
+    {
+        TRACE_ERROR("Could not pin the thread of core " + std::to_string(aCore));
+    }
+#else
+    static_cast<void>(aCore);
+#endif
+}
@@ -0,0 +1,95 @@
+/**
+ *  @file    shard_router.hh
+ *  @author  Nick Weber
+ *  @brief   Thread per core server mode, every core owns a shard of the keyspace
+ *  @bugs    Currently no bugs known
+ *  @todos   -
+ *
+ *  @section DESCRIPTION
+ *      Every core runs its own io_context on a pinned thread and accepts connections on its own
+ *      listening socket (SO_REUSEPORT, the kernel spreads the connections). A key belongs to the
+ *      shard hash(key) % cores and is only ever touched by the thread of that core, which uses its
+ *      own KeyValueStore instance. Requests for a key of another shard are forwarded to the owning
+ *      core over a lock-free single producer single consumer queue, the answer travels back the same
+ *      way and is handed to the connection on its own core.
+ */
+#pragma once
+
+#include "types.hh"
+#include "spsc_queue.hh"
+#include "tcp_server.hh"
+
+#include <boost/asio.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <atomic>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+class tcp_connection;
+
+class shard_router final
+{
+    public:
+        using connection_pointer = boost::shared_ptr<tcp_connection>;
+
+        // a request forwarded to the core owning the key, the answer is sent back in the same message
+        struct message_t final
+        {
+            // slot of an unordered request, its answer is appended to the connections output
+            static constexpr size_t UNORDERED = SIZE_MAX;
+
+            connection_pointer  m_connection;
+            size_t              m_origin;   // core of the connection
+            size_t              m_slot;     // position of the answer in the connections output
+            PROTOCOL            m_protocol;
+            std::string         m_request;  // the request line or frame
+            std::string         m_answer;
+            bool                m_reply;
+        };
+
+    public:
+        shard_router()                                                      noexcept = delete;
+        // throws like tcp_server if a core cannot listen on the port
+        shard_router(const CB& aCB, size_t aCores);
+        shard_router(const shard_router&)                                   noexcept = delete;
+        shard_router& operator=(const shard_router&)                        noexcept = delete;
+        shard_router(shard_router&&)                                        noexcept = delete;
+        shard_router& operator=(shard_router&&)                             noexcept = delete;
+        ~shard_router()                                                     noexcept;
+
+    public:
+        // runs every core on its own pinned thread, returns once all io_contexts stopped
+        void            run()                                               noexcept;
+        size_t          cores()                                       const noexcept { return m_cores.size(); }
+        // like Redis cluster, only a non-empty {hash tag} of the key is hashed
+        size_t          shard_of(std::string_view aKey)               const noexcept;
+        // must be called on the thread of core aFrom
+        void            forward(size_t aFrom, size_t aTo, message_t&& aMessage) noexcept;
+        void            flush_all()                                         noexcept;
+        void            clear_all()                                         noexcept;
+
+    private:
+        void            notify(size_t aCore)                                noexcept;
+        void            drain(size_t aCore)                                 noexcept;
+        void            drain(size_t aCore, size_t aFrom)                   noexcept;
+        void            handle(size_t aCore, message_t& aMessage)           noexcept;
+        static void     pin(size_t aCore)                                   noexcept;
+
+    private:
+        struct core_t final
+        {
+            explicit core_t(size_t aCores) noexcept;
+
+            boost::asio::io_context                                 m_io_context;
+            std::vector<std::unique_ptr<spsc_queue_t<message_t>>>   m_inbox;    // one queue per sending core
+            std::unique_ptr<std::atomic<size_t>[]>                  m_overflow; // messages per sending core posted since its queue was full
+            std::atomic_bool                                        m_scheduled;
+            request_t                                               m_parsed;   // reused for every forwarded request
+            std::unique_ptr<tcp_server>                             m_server;
+        };
+
+    private:
+        std::vector<std::unique_ptr<core_t>> m_cores;
+};
@@ -0,0 +1,73 @@
+/**
+ *  @file    spsc_queue.hh
+ *  @author  Nick Weber
+ *  @brief   Bounded lock-free queue for exactly one producer and one consumer thread
+ *  @bugs    Currently no bugs known
+ *  @todos   -
+ *
+ *  @section DESCRIPTION
+ *      The producer only writes the head, the consumer only writes the tail. Both live on their own
+ *      cache line, so the two threads never write to the same line. A full queue rejects the push,
+ *      the caller decides how to handle the overflow.
+ */
+#pragma once
+
+#include "types.hh"
+
+#include <atomic>
+#include <memory>
+#include <utility>
+
+template<typename T>
+class spsc_queue_t final
+{
+    public:
+        spsc_queue_t()                                          noexcept = delete;
+        // aCapacity needs to be a power of 2
+        explicit spsc_queue_t(size_t aCapacity)                 noexcept
+            : m_slots(std::make_unique<T[]>(aCapacity))
+            , m_mask(aCapacity - 1)
+            , m_head(0)
+            , m_tail(0)
+        {
+            assert(aCapacity > 0 && (aCapacity & (aCapacity - 1)) == 0);
+        }
+        spsc_queue_t(const spsc_queue_t&)                       noexcept = delete;
+        spsc_queue_t& operator=(const spsc_queue_t&)            noexcept = delete;
+        spsc_queue_t(spsc_queue_t&&)                            noexcept = delete;
+        spsc_queue_t& operator=(spsc_queue_t&&)                 noexcept = delete;
+        ~spsc_queue_t()                                         noexcept = default;
+
+    public:
+        // producer side, returns false if the queue is full
+        bool try_push(T&& aElement) noexcept
+        {
+            const uint64_t lHead = m_head.load(std::memory_order_relaxed);
+            if(lHead - m_tail.load(std::memory_order_acquire) > m_mask)
+            {
+                return false;
+            }
+            m_slots[lHead & m_mask] = std::move(aElement);
+            m_head.store(lHead + 1, std::memory_order_release);
+            return true;
+        }
+
+        // consumer side, returns false if the queue is empty
+        bool try_pop(T& aElement) noexcept
+        {
+            const uint64_t lTail = m_tail.load(std::memory_order_relaxed);
+            if(lTail == m_head.load(std::memory_order_acquire))
+            {
+                return false;
+            }
+            aElement = std::move(m_slots[lTail & m_mask]);
+            m_tail.store(lTail + 1, std::memory_order_release);
+            return true;
+        }
+
+    private:
+        std::unique_ptr<T[]>                m_slots;
+        const uint64_t                      m_mask;
+        alignas(64) std::atomic<uint64_t>   m_head;
+        alignas(64) std::atomic<uint64_t>   m_tail;
+};
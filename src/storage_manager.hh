@@ -6,6 +6,9 @@
 
 #include "partition_file.hh"
 #include "interpreter_sp.hh"
+#include "merge_operator.hh"
+#include "row_cache.hh"
+#include "rw_mutex.hh"
 
 #include <map>
 #include <unordered_map>
@@ -13,7 +16,10 @@
 #include <functional>
 #include <algorithm>
 #include <shared_mutex>
+#include <future>
+#include <atomic>
 #include <iostream>
+#include <vector>
 
 template<typename K, typename V>
 class StorageManager final
@@ -22,9 +28,11 @@ class StorageManager final
         using key_type = K;
         using value_type = V;
         using key_val_type = key_val_t<key_type, value_type>;
+        using read_handle_type = read_handle_t<key_type, value_type>;
 
     private:
-        StorageManager()                                                  noexcept;
+        StorageManager()                                                  noexcept = delete;
+        explicit StorageManager(size_t aShard)                            noexcept;
         StorageManager(const StorageManager&)                             noexcept = delete;
         StorageManager& operator=(const StorageManager&)                  noexcept = delete;
         StorageManager(StorageManager&&)                                  noexcept = delete;
@@ -32,79 +40,239 @@ class StorageManager final
 
     public:
         ~StorageManager()                                                 noexcept;
-        static StorageManager& get_instance()                             noexcept
+        static StorageManager& get_instance(size_t aShard = 0)            noexcept
         {
-            static StorageManager lInstance;
-            return lInstance;
+            //every shard of the keyspace has its own instance, shard 0 is the default one
+            assert(aShard < MAX_SHARDS);
+            static std::unique_ptr<StorageManager> lInstances[MAX_SHARDS];
+            static std::once_flag lCreated[MAX_SHARDS];
+            std::call_once(lCreated[aShard], [aShard](){ lInstances[aShard].reset(new StorageManager(aShard)); });
+            return *lInstances[aShard];
         }
-        void init(const CB& aCB)                                          noexcept;
+        // aShards share the budget of the row cache
+        void init(const CB& aCB, size_t aShards = 1)                      noexcept;
+        // folds the merge operands of a flush into the values written to disk
+        void merge_operator(merge_fn_t<V> aMerge)                         noexcept;
 
     public:
-        void write_to_disk(key_val_vt<K,V>& aKeyValueVec, sync_t& aSync)  noexcept;
+        // writes the buffer, aSnapshots are the sorted sequences of the live snapshots. A version
+        // replaced in the buffer is kept on disk if one of them sees it, a delete then leaves a
+        // tombstone. Flushes run one at a time
+        void write_to_disk(const key_val_spvt<K,V>& aKeyValueVec, const std::vector<uint64_t>& aSnapshots) noexcept;
 
     public:
         key_val_type    get(const key_type& aKey);
+        read_handle_type read(const key_type& aKey);
+        // like read, but reports a miss through the handles status instead of throwing. Returns the
+        // newest version the snapshot sees
+        read_handle_type find(const key_type& aKey, const snapshot_t& aSnapshot = snapshot_t());
+        // find for the keys aKeys[i] of all i in aPending, the results are stored in aHandles[i].
+        // The keys are grouped by page and every page is read once
+        void            multi_find(const std::vector<key_type>& aKeys, const std::vector<size_t>& aPending, std::vector<read_handle_type>& aHandles,
+                            const snapshot_t& aSnapshot = snapshot_t());
+        // takes up to aMax records that expired before aNow from the expiry index and appends the keys
+        // of those still stored to aKeys. The keys may have been written again meanwhile. Returns the
+        // number of records taken
+        size_t          expired(uint64_t aNow, size_t aMax, std::vector<key_type>& aKeys);
+        // removes the versions on disk that up to aMax newer records of their keys replaced. A tombstone
+        // goes with them, the key is not stored any more. The records a snapshot of aSnapshots is older
+        // than stay pending. The slots are invalidated page by page, the readers only wait while a page
+        // is rewritten and the flushes while the index is changed. Returns the number of records taken
+        size_t          purge(size_t aMax, const std::vector<uint64_t>& aSnapshots);
+        // the records purge has not taken yet
+        size_t          pending_purges()                                  noexcept;
+        // forgets all records, their pages are not reclaimed
+        void            clear()                                           noexcept;
         PartitionFile&  partition()                                       noexcept { return m_partition; }
+        const RowCache<K,V>& rows()                                 const noexcept { return m_rows; }
+        // the pages readers read from the partition, and the reads they joined instead
+        uint64_t        page_reads()                                const noexcept { return m_page_reads.load(std::memory_order_relaxed); }
+        uint64_t        joined_reads()                              const noexcept { return m_joined_reads.load(std::memory_order_relaxed); }
 
 
+    private:
+        // an entry of the expiry index, the expiry time is rounded up to full seconds
+        struct expiry_t final
+        {
+            uint32_t    m_seconds;
+            TID         m_tid;
+
+            bool operator>(const expiry_t& aOther) const noexcept { return m_seconds > aOther.m_seconds; }
+        };
+        // an entry of the disk index. Lookups skip the other keys with the same hash and the versions
+        // a snapshot does not see without reading their pages, the key is only compared for the rest
+        struct disk_entry_t final
+        {
+            TID         m_tid;
+            uint16_t    m_fingerprint;  // of the key, see fingerprint
+            uint16_t    m_size;         // of the record in bytes
+            uint64_t    m_seq;          // the version of the record
+        };
+        static_assert(sizeof(disk_entry_t) == 16, "four index entries share a cache line");
+        static_assert(PAGE_SIZE <= UINT16_MAX, "m_size holds the size of any record");
+        using index_type = std::multimap<uint64_t, disk_entry_t>;
+        // a record whose older versions are purged
+        struct purge_t final
+        {
+            uint64_t    m_hash;
+            TID         m_tid;
+            uint64_t    m_seq;
+        };
+
     private:
         auto&           mtx()                                       const noexcept { return m_mtx; }
         const CB&       cb()                                        const noexcept { return *m_cb; }
         const auto&     hasher()                                    const noexcept { return m_hasher; }
         auto&           disk_index()                                      noexcept { return m_index; }
         uint64_t        hash_v(const K& aKey)                       const noexcept { return hasher()(aKey);}
+        // a second hash of the key, independent of hash_v
+        static uint16_t fingerprint(const key_type& aKey)                 noexcept;
+        read_handle_type find_no_lock(const key_type& aKey, const snapshot_t& aSnapshot);
+        // reads a page of the index for readers under the shared lock. A read of the page already in
+        // flight is joined, the readers share its buffer and must not modify it
+        std::shared_ptr<byte[]> read_page(uint32_t aPage);
+        // the handle of a version from the row cache
+        static read_handle_type cached(key_val_spt<K,V>&& aKeyVal, uint64_t aNow) noexcept;
+        // whether a snapshot sees the version aFrom, but not the newer version aTo
+        static bool     seen(const std::vector<uint64_t>& aSnapshots, uint64_t aFrom, uint64_t aTo) noexcept;
+        static bool     expired(const byte* aRecord, uint64_t aNow) noexcept;
 
     private:
-        mutable std::shared_mutex       m_mtx;
+        mutable rw_mutex_t              m_mtx;      // guards the index and the pages it references
+        std::mutex                      m_flush_mtx;    // held by a flush, and while a purge changes the index
+        std::mutex                      m_purge_mtx;    // one purge at a time, it reads and rewrites pages without the flush mutex
         const CB*                       m_cb;
         std::function<uint64_t(K)>      m_hasher;
-        std::multimap<uint64_t,TID>     m_index;
+        merge_fn_t<V>                   m_merge;
+        index_type                      m_index;
+        std::vector<purge_t>            m_purges;   // under the flush mutex
+        std::mutex                      m_expiry_mtx;
+        std::vector<expiry_t>           m_expiries; // min heap of the records with an expiry time
         PartitionFile                   m_partition;
+        RowCache<K,V>                   m_rows;     // filled by readers under the shared lock, a flush drops its keys under the exclusive one
+        std::mutex                      m_flight_mtx;
+        std::unordered_map<uint32_t, std::shared_future<std::shared_ptr<byte[]>>> m_flights;   // the page reads in progress
+        std::atomic<uint64_t>           m_page_reads;
+        std::atomic<uint64_t>           m_joined_reads;
 
 };
 
 template<typename K, typename V>
-StorageManager<K,V>::StorageManager() noexcept
+StorageManager<K,V>::StorageManager(size_t aShard) noexcept
     : m_mtx()
+    , m_flush_mtx()
+    , m_purge_mtx()
     , m_cb(nullptr)
     , m_hasher(std::hash<K>{})
+    , m_merge(merge_operator_t<V>{})
     , m_index()
-    , m_partition("./part.dat", "Key-Value-Persistency", 32u)
+    , m_purges()
+    , m_expiry_mtx()
+    , m_expiries()
+    , m_partition(aShard == 0 ? "./part.dat" : "./part_" + std::to_string(aShard) + ".dat", "Key-Value-Persistency", 32u)
+    , m_rows()
+    , m_flight_mtx()
+    , m_flights()
+    , m_page_reads(0)
+    , m_joined_reads(0)
 {
-    TRACE("StorageManager constructed");
+    TRACE_INFO("StorageManager constructed");
 }
 
 template<typename K, typename V>
 StorageManager<K,V>::~StorageManager() noexcept = default;
 
 template<typename K, typename V>
-void StorageManager<K,V>::init(const CB& aCB) noexcept
+void StorageManager<K,V>::init(const CB& aCB, size_t aShards) noexcept
 {
     if(!m_cb)
     {
-        TRACE("StorageManager initialized");
+        TRACE_INFO("StorageManager initialized");
         m_cb = &aCB;
+        m_rows.init(aCB.row_cache() / std::max<size_t>(aShards, 1));
     }
 }
 
 template<typename K, typename V>
-void StorageManager<K,V>::write_to_disk(key_val_vt<K,V>& aKeyValueVec, sync_t& aSync) noexcept
+void StorageManager<K,V>::merge_operator(merge_fn_t<V> aMerge) noexcept
 {
-    TRACE("Flushing write managers data to disk...");
-
     std::lock_guard lock(mtx());
-    std::unordered_map<K,key_val_t<K,V>> distinct_writes;
+    m_merge = std::move(aMerge);
+}
 
-    TRACE("Move buffer elements to hash table in order to only write unique items to disk");
-    for(auto& kv : aKeyValueVec)
+template<typename K, typename V>
+bool StorageManager<K,V>::seen(const std::vector<uint64_t>& aSnapshots, uint64_t aFrom, uint64_t aTo) noexcept
+{
+    const auto it = std::lower_bound(aSnapshots.begin(), aSnapshots.end(), aFrom);
+    return it != aSnapshots.end() && *it < aTo;
+}
+
+template<typename K, typename V>
+uint16_t StorageManager<K,V>::fingerprint(const key_type& aKey) noexcept
+{
+    //FNV-1a folded to 16 bits, keys that share the std::hash value rarely share it too
+    uint32_t lHash = 2166136261u;
+    for(const char c : aKey.view())
     {
-        distinct_writes.insert_or_assign(kv.key(), std::move(kv));
+        lHash = (lHash ^ static_cast<uint8_t>(c)) * 16777619u;
     }
+    return static_cast<uint16_t>(lHash ^ (lHash >> 16));
+}
 
-    TRACE("Clear flush buffer, set flag, unlock and notify.");
-    aKeyValueVec.clear();
-    aSync.set();
-    aSync.cv().notify_one();
+template<typename K, typename V>
+bool StorageManager<K,V>::expired(const byte* aRecord, uint64_t aNow) noexcept
+{
+    const uint64_t lExpiry = key_val_type::expiry_of(aRecord);
+    return lExpiry != 0 && lExpiry <= aNow;
+}
+
+template<typename K, typename V>
+void StorageManager<K,V>::write_to_disk(const key_val_spvt<K,V>& aKeyValueVec, const std::vector<uint64_t>& aSnapshots) noexcept
+{
+    TRACE_INFO("Flushing write managers data to disk...");
+
+    std::lock_guard flush_lock(m_flush_mtx);
+
+    TRACE("Group buffer elements by key in order to only write the versions still needed to disk");
+    std::unordered_map<K,key_val_spvt<K,V>> versions;
+    {
+        //only flushes change the disk, the value a merge operand applies to stays the same
+        std::shared_lock lock(mtx());
+        const uint64_t now = now_ms();
+        for(const auto& kv : aKeyValueVec)
+        {
+            auto& chain = versions[kv->key()];
+            key_val_spt<K,V> entry = kv;
+            if(kv->ins() && kv->expired(now))
+            {
+                //an expired value is written as a delete, so it is not even stored
+                entry = std::make_shared<const key_val_type>(kv->key(), V(), MOD::kDELETE, kv->seq());
+            }
+            else if(kv->merge())
+            {
+                //fold the operand into the newest value: an earlier one of this flush or the one on disk
+                read_handle_type stored;
+                if(chain.empty())
+                {
+                    stored = find_no_lock(kv->key(), snapshot_t());
+                }
+                const bool has_base = !chain.empty() ? chain.back()->ins() : stored.found();
+                const V base = !has_base ? V() : (!chain.empty() ? chain.back()->val() : V(std::string(stored.val())));
+                //the merged value expires with the one it is based on
+                const uint64_t expiry = !has_base ? 0 : (!chain.empty() ? chain.back()->expiry() : stored.expiry());
+                entry = std::make_shared<const key_val_type>(kv->key(), merge_value(m_merge, kv->key(), has_base ? &base : nullptr, kv->val(), expiry != 0), MOD::kINSERT, kv->seq(), expiry);
+            }
+            //the previous version is replaced unless a snapshot sees it but not this one
+            if(!chain.empty() && !seen(aSnapshots, chain.back()->seq(), entry->seq()))
+            {
+                chain.back() = std::move(entry);
+            }
+            else
+            {
+                chain.push_back(std::move(entry));
+            }
+        }
+    }
 
     partition().open();
     TRACE("Allocating new page...");
@@ -119,15 +287,38 @@ void StorageManager<K,V>::write_to_disk(key_val_vt<K,V>& aKeyValueVec, sync_t& a
     sp.init_new_page(uptr.get(), index);
     TRACE("Successful");
 
-    auto kv_iter = distinct_writes.cbegin();
+    //the new pages are not referenced by the index yet, readers are not blocked while they are written
+    std::vector<std::pair<uint64_t,disk_entry_t>> added;
+    std::vector<expiry_t> expiring;
+    std::vector<purge_t> purges;
     size_t kv_no = 1;
-    while(kv_iter != distinct_writes.cend())
+    for(const auto& [key, chain] : versions)
     {
-        const auto& kv = kv_iter->second;
-        TRACE("Processing record " + std::to_string(kv_no) + "/" + std::to_string(distinct_writes.size()) + ": '" + kv.to_string() + "'");
-        //insert type
-        if(kv.ins())
+        //only flushes and purges change the index, both hold the flush mutex
+        const bool stored = disk_index().count(hash_v(key)) != 0;
+        for(size_t i = 0; i < chain.size();)
         {
+            const key_val_type& kv = *chain[i];
+            TRACE("Processing record " + std::to_string(kv_no) + ": '" + kv.to_string() + "'");
+            //the newest version purges the older ones once no snapshot is older than it, the key keeps
+            //one record: the new value, or nothing if it is deleted. A delete of a key that is not on
+            //disk is not even written
+            const bool purge = i + 1 == chain.size() && (stored || chain.size() > 1);
+            if(!stored && kv.del() && chain.size() == 1)
+            {
+                TRACE("Delete '" + kv.to_string() + "' is not on disk");
+                ++i;
+                ++kv_no;
+                continue;
+            }
+            if(!kv.fits_page())
+            {
+                //the writes and merges are checked before, not even an empty page would take it
+                TRACE_ERROR("Record of '" + key.to_string() + "' is larger than a page, it is not written");
+                ++i;
+                ++kv_no;
+                continue;
+            }
             TRACE("Add '" + kv.to_string() + "' to slotted page");
             auto [rec_ptr, offset] = sp.add_new_record(kv.diskB());
             //if valid ptr -> record can be inserted
@@ -135,17 +326,24 @@ void StorageManager<K,V>::write_to_disk(key_val_vt<K,V>& aKeyValueVec, sync_t& a
             {
                 const TID tid(index, offset);
                 TRACE("New record: " + tid.to_string());
-                const uint64_t hash = hash_v(kv.key());
                 kv.to_disk(rec_ptr);
-
-                disk_index().emplace(hash, tid);
+                assert(kv.diskB() <= PAGE_SIZE);
+                added.emplace_back(hash_v(key), disk_entry_t{tid, fingerprint(key), static_cast<uint16_t>(kv.diskB()), kv.seq()});
+                if(purge)
+                {
+                    purges.push_back({hash_v(key), tid, kv.seq()});
+                }
+                if(kv.expiry())
+                {
+                    expiring.push_back({static_cast<uint32_t>((kv.expiry() + 999) / 1000), tid});
+                }
                 TRACE("Successful");
 
                 assert(index == tid.page());
                 assert(offset == tid.offset());
                 assert(offset == sp.no_records() - 1);
-
-
+                ++i;
+                ++kv_no;
             }
             //allocate a new page
             else
@@ -163,107 +361,106 @@ void StorageManager<K,V>::write_to_disk(key_val_vt<K,V>& aKeyValueVec, sync_t& a
                 sp.init_new_page(uptr.get(), index);
                 TRACE("Successful");
                 TRACE("Retry insert...");
-                continue;
-            }
-        }
-        //delete type
-        else if(kv.del())
-        {
-            TRACE("Delete '" + kv.to_string() + "'");
-            auto range = disk_index().equal_range(hash_v(kv.key()));
-            if(std::distance(range.first, range.second) != 0)
-            {
-                auto uptr_tmp = alloc_buffer_page();
-                TRACE("Search for item in index...");
-                for(auto it = range.first; it != range.second;)
-                {
-                    auto current = it;
-                    ++it;
-                    //get TID stored for this key in the index
-                    TID tid = current->second;
-                    TRACE("Node with same hash as searched item found. " + tid.to_string());
-                    
-                    TRACE("Read page in...");
-                    //read page at TID position
-                    partition().readPage(uptr_tmp.get(), tid.page());
-                    TRACE("Successful");
-
-                    InterpreterSP sp_tmp;
-                    sp_tmp.attach(uptr_tmp.get());
-
-                    TRACE("Get record...");
-                    //get record on loaded page
-                    byte* rec_ptr = sp_tmp.get_record(tid.offset());
-                    if(rec_ptr)
-                    {
-                        TRACE("Successful");
-                        TRACE("Transform disk record to memory representation...");
-                        //transform disk representation to in-memory representation
-                        key_val_type kv_tmp;
-                        kv_tmp.to_memory(rec_ptr);
-                        TRACE("Successful");
-
-                        TRACE("Transformed: '" + kv_tmp.to_string() + "'");
-
-                        TRACE("Check whether retrieved record equals the one to delete...");
-                        if(kv_tmp.key() == kv.key())
-                        {
-                            TRACE("Retrieved record matches");
-                            TRACE("Soft delete of record...");
-                            sp_tmp.soft_delete(tid.offset());
-                            TRACE("Write back page...");
-                            partition().writePage(uptr_tmp.get(), tid.page());
-                            TRACE("Remove key from index...");
-                            disk_index().erase(current);
-                            TRACE("Successful");
-                        }
-                        else
-                        {
-                            TRACE("Retrieved record does not match. Continue search...");
-                        }
-                    }
-                    else
-                    {
-                        TRACE("ERROR: Could not retrieve record from page (record was deleted or is invalid)");
-                    }
-                }
             }
         }
-        ++kv_iter;
-        ++kv_no;
     }
 
     TRACE("Write page back to disk...");
     partition().writePage(uptr.get(), index);
-    partition().close();
 
+    TRACE("Publish the written records...");
+    {
+        std::lock_guard lock(mtx());
+        //the cached rows of the keys are outdated now, readers fill them again after the lock
+        for(const auto& entry : versions)
+        {
+            m_rows.erase(hash_v(entry.first));
+        }
+        for(const auto& [hash, entry] : added)
+        {
+            disk_index().emplace(hash, entry);
+        }
+    }
+    {
+        std::lock_guard lock(m_expiry_mtx);
+        for(const expiry_t& entry : expiring)
+        {
+            m_expiries.push_back(entry);
+            std::push_heap(m_expiries.begin(), m_expiries.end(), std::greater<expiry_t>());
+        }
+    }
+    m_purges.insert(m_purges.end(), purges.begin(), purges.end());
+    partition().close();
 }
 
 template<typename K, typename V>
 typename StorageManager<K,V>::key_val_type StorageManager<K,V>::get(const key_type& aKey)
+{
+    return read(aKey).to_key_val();
+}
+
+template<typename K, typename V>
+typename StorageManager<K,V>::read_handle_type StorageManager<K,V>::read(const key_type& aKey)
+{
+    read_handle_type handle = find(aKey);
+    if(!handle)
+    {
+        throw KeyNotInStorageManagerException(FLF);
+    }
+    return handle;
+}
+
+template<typename K, typename V>
+typename StorageManager<K,V>::read_handle_type StorageManager<K,V>::find(const key_type& aKey, const snapshot_t& aSnapshot)
 {
     std::shared_lock lock(mtx());
+    return find_no_lock(aKey, aSnapshot);
+}
+
+template<typename K, typename V>
+typename StorageManager<K,V>::read_handle_type StorageManager<K,V>::find_no_lock(const key_type& aKey, const snapshot_t& aSnapshot)
+{
     TRACE("Search for item with key: '" + aKey.to_string() + "' in StorageManager");
-    auto range = disk_index().equal_range(hash_v(aKey));
+    const uint64_t hash = hash_v(aKey);
+    if(auto row = m_rows.find(hash, aKey, aSnapshot))
+    {
+        TRACE("Key found in the row cache");
+        return cached(std::move(row), now_ms());
+    }
+    auto range = disk_index().equal_range(hash);
     int count = std::distance(range.first, range.second);
     if(count != 0)
     {
+        //only the newest version of the key is cached, it answers the later snapshots too
+        bool newest = true;
+        const uint16_t fp = fingerprint(aKey);
         partition().open();
-        auto uptr = alloc_buffer_page();
         TRACE("Reversely iterate all found nodes with same hash as key");
-        for(auto it = std::make_reverse_iterator(range.second); it != std::make_reverse_iterator(range.first); --it)
+        for(auto it = std::make_reverse_iterator(range.second); it != std::make_reverse_iterator(range.first); ++it)
         {
             //get TID stored for this key in the index
-            TID tid = it->second;
+            const disk_entry_t& entry = it->second;
+            TID tid = entry.m_tid;
             TRACE("Item found: '" + tid.to_string() + "'");
-            
+            if(entry.m_fingerprint != fp)
+            {
+                TRACE("Other key, continue");
+                continue;
+            }
+            if(!aSnapshot.sees(entry.m_seq))
+            {
+                TRACE("Version is newer than the snapshot, continue");
+                newest = false;
+                continue;
+            }
+
             TRACE("Read page to main memory...");
-            //read page at TID position
-            partition().readPage(uptr.get(), tid.page());
+            //read page at TID position, or wait for the reader that already does
+            std::shared_ptr<byte[]> page = read_page(tid.page());
             TRACE("Successful");
 
             InterpreterSP sp;
-            sp.attach(uptr.get());
+            sp.attach(page.get());
 
             TRACE("Retrieve record from page...");
             //get record on loaded page
@@ -271,30 +468,399 @@ typename StorageManager<K,V>::key_val_type StorageManager<K,V>::get(const key_ty
             if(rec_ptr)
             {
                 TRACE("Successful");
-                TRACE("Transform record from disk representation to in-memory item");
-                //transform disk representation to in-memory representation
-                key_val_type kv;
-                kv.to_memory(rec_ptr);
-                TRACE("Successful");
-
-                TRACE("Transformed item: '" + kv.to_string() + "'");
-
-                if(kv.key() == aKey)
+                //compare the length prefixed key in place before decoding the value
+                if(key_val_type::key_matches(rec_ptr, aKey))
                 {
-                    TRACE("Key found. Return item.");
                     partition().close();
-                    return kv;
+                    if(newest)
+                    {
+                        m_rows.insert(hash, rec_ptr, entry.m_size);
+                    }
+                    if(key_val_type::tombstone(rec_ptr))
+                    {
+                        TRACE("Key found deleted.");
+                        return read_handle_type(FIND::kDELETED);
+                    }
+                    if(expired(rec_ptr, now_ms()))
+                    {
+                        TRACE("Key found expired.");
+                        return read_handle_type(FIND::kEXPIRED);
+                    }
+                    TRACE("Key found. Return handle pinning the page.");
+                    return read_handle_type(std::move(page), rec_ptr);
                 }
                 TRACE("Wrong Key, continue");
             }
             else
             {
-                TRACE("ERROR: Could not retrieve record from page");
+                TRACE_ERROR("ERROR: Could not retrieve record from page");
             }
         }
         partition().close();
         //error
     }
     TRACE("Key not found in storage manager");
-    throw KeyNotInStorageManagerException(FLF);
+    return read_handle_type(FIND::kABSENT);
+}
+
+template<typename K, typename V>
+std::shared_ptr<byte[]> StorageManager<K,V>::read_page(uint32_t aPage)
+{
+    //a page read under the shared lock stays valid for all readers: flushes only write new pages, and a
+    //purge rewrites a page under the exclusive lock, it only invalidates the slots of the records it
+    //removed from the index before. The bytes the readers look at are written unchanged
+    std::promise<std::shared_ptr<byte[]>> promise;
+    std::shared_future<std::shared_ptr<byte[]>> flight;
+    {
+        std::lock_guard lock(m_flight_mtx);
+        const auto [it, first] = m_flights.try_emplace(aPage);
+        if(first)
+        {
+            it->second = promise.get_future().share();
+        }
+        else
+        {
+            flight = it->second;
+        }
+    }
+    if(flight.valid())
+    {
+        TRACE("Joined the read of page " + std::to_string(aPage) + " in flight");
+        m_joined_reads.fetch_add(1, std::memory_order_relaxed);
+        return flight.get();
+    }
+    std::shared_ptr<byte[]> page;
+    try
+    {
+        page = alloc_buffer_page();
+        partition().readPage(page.get(), aPage);
+    }
+    catch(...)
+    {
+        {
+            std::lock_guard lock(m_flight_mtx);
+            m_flights.erase(aPage);
+        }
+        promise.set_exception(std::current_exception());
+        throw;
+    }
+    m_page_reads.fetch_add(1, std::memory_order_relaxed);
+    {
+        std::lock_guard lock(m_flight_mtx);
+        m_flights.erase(aPage);
+    }
+    promise.set_value(page);
+    return page;
 }
+
+template<typename K, typename V>
+typename StorageManager<K,V>::read_handle_type StorageManager<K,V>::cached(key_val_spt<K,V>&& aKeyVal, uint64_t aNow) noexcept
+{
+    if(aKeyVal->del())
+    {
+        return read_handle_type(FIND::kDELETED);
+    }
+    if(aKeyVal->expired(aNow))
+    {
+        return read_handle_type(FIND::kEXPIRED);
+    }
+    return read_handle_type(std::move(aKeyVal));
+}
+
+template<typename K, typename V>
+void StorageManager<K,V>::multi_find(const std::vector<key_type>& aKeys, const std::vector<size_t>& aPending, std::vector<read_handle_type>& aHandles,
+                            const snapshot_t& aSnapshot)
+{
+    using index_iterator = std::reverse_iterator<typename index_type::iterator>;
+    struct probe_t
+    {
+        size_t          m_key;  // index into aKeys
+        index_iterator  m_it;   // the next candidate, newest first like in find
+        index_iterator  m_end;
+        uint16_t        m_fingerprint;
+        bool            m_newest;   // no version of the key was skipped yet
+    };
+    //moves the probe to the next entry that may be the version the snapshot sees, false if there is none
+    const auto next_candidate = [&aSnapshot](probe_t& aProbe)
+    {
+        for(; aProbe.m_it != aProbe.m_end; ++aProbe.m_it)
+        {
+            const disk_entry_t& entry = aProbe.m_it->second;
+            if(entry.m_fingerprint == aProbe.m_fingerprint)
+            {
+                if(aSnapshot.sees(entry.m_seq))
+                {
+                    return true;
+                }
+                aProbe.m_newest = false;
+            }
+        }
+        return false;
+    };
+
+    std::shared_lock lock(mtx());
+    TRACE("Search for " + std::to_string(aPending.size()) + " items in StorageManager");
+    const uint64_t now = now_ms();
+    std::vector<probe_t> probes;
+    for(const size_t key : aPending)
+    {
+        const uint64_t hash = hash_v(aKeys[key]);
+        if(auto row = m_rows.find(hash, aKeys[key], aSnapshot))
+        {
+            aHandles[key] = cached(std::move(row), now);
+            continue;
+        }
+        auto range = disk_index().equal_range(hash);
+        probe_t probe{key, std::make_reverse_iterator(range.second), std::make_reverse_iterator(range.first), fingerprint(aKeys[key]), true};
+        if(next_candidate(probe))
+        {
+            probes.push_back(probe);
+        }
+    }
+    if(probes.empty())
+    {
+        return;
+    }
+    partition().open();
+    //every round checks the newest remaining candidate of every key, only hash collisions need another round
+    while(!probes.empty())
+    {
+        std::sort(probes.begin(), probes.end(), [](const probe_t& a, const probe_t& b){ return a.m_it->second.m_tid.page() < b.m_it->second.m_tid.page(); });
+        if(probes.front().m_it->second.m_tid.page() != probes.back().m_it->second.m_tid.page())
+        {
+            for(size_t i = 0; i < probes.size(); ++i)
+            {
+                if(i == 0 || probes[i].m_it->second.m_tid.page() != probes[i - 1].m_it->second.m_tid.page())
+                {
+                    partition().prefetchPage(probes[i].m_it->second.m_tid.page());
+                }
+            }
+        }
+        std::shared_ptr<byte[]> page;
+        uint32_t page_no = 0;
+        size_t lKept = 0;
+        for(size_t i = 0; i < probes.size(); ++i)
+        {
+            //the probes kept for the next round are moved to the front and point to their next candidate,
+            //so the page in memory is remembered instead of looking at the previous probe
+            probe_t& probe = probes[i];
+            const TID tid = probe.m_it->second.m_tid;
+            if(!page || tid.page() != page_no)
+            {
+                TRACE("Read page " + std::to_string(static_cast<uint32_t>(tid.page())) + " to main memory...");
+                page = read_page(tid.page());
+                page_no = tid.page();
+            }
+            InterpreterSP sp;
+            sp.attach(page.get());
+            byte* rec_ptr = sp.get_record(tid.offset());
+            if(rec_ptr && key_val_type::key_matches(rec_ptr, aKeys[probe.m_key]))
+            {
+                if(probe.m_newest)
+                {
+                    m_rows.insert(probe.m_it->first, rec_ptr, probe.m_it->second.m_size);
+                }
+                //the handles of all records on the page share it
+                if(key_val_type::tombstone(rec_ptr) || expired(rec_ptr, now))
+                {
+                    aHandles[probe.m_key] = read_handle_type(key_val_type::tombstone(rec_ptr) ? FIND::kDELETED : FIND::kEXPIRED);
+                }
+                else
+                {
+                    aHandles[probe.m_key] = read_handle_type(page, rec_ptr);
+                }
+                continue;
+            }
+            ++probe.m_it;
+            if(next_candidate(probe))
+            {
+                probes[lKept++] = probe;
+            }
+        }
+        probes.resize(lKept);
+    }
+    partition().close();
+}
+
+template<typename K, typename V>
+void StorageManager<K,V>::clear() noexcept
+{
+    //a running flush or purge is completed before
+    std::lock_guard purge_lock(m_purge_mtx);
+    std::lock_guard flush_lock(m_flush_mtx);
+    std::lock_guard lock(mtx());
+    TRACE_INFO("Clear the index of the storage manager");
+    disk_index().clear();
+    m_rows.clear();
+    m_purges.clear();
+    std::lock_guard expiry_lock(m_expiry_mtx);
+    m_expiries.clear();
+}
+
+template<typename K, typename V>
+size_t StorageManager<K,V>::expired(uint64_t aNow, size_t aMax, std::vector<key_type>& aKeys)
+{
+    std::vector<TID> due;
+    {
+        std::lock_guard lock(m_expiry_mtx);
+        while(!m_expiries.empty() && due.size() < aMax && uint64_t(m_expiries.front().m_seconds) * 1000 <= aNow)
+        {
+            due.push_back(m_expiries.front().m_tid);
+            std::pop_heap(m_expiries.begin(), m_expiries.end(), std::greater<expiry_t>());
+            m_expiries.pop_back();
+        }
+    }
+    if(due.empty())
+    {
+        return 0;
+    }
+    TRACE("Read the keys of " + std::to_string(due.size()) + " expired records");
+    //records are soft deleted in place, a TID never refers to another record
+    std::shared_lock lock(mtx());
+    partition().open();
+    auto uptr = alloc_buffer_page();
+    for(const TID& tid : due)
+    {
+        partition().readPage(uptr.get(), tid.page());
+        InterpreterSP sp;
+        sp.attach(uptr.get());
+        const byte* rec_ptr = sp.get_record(tid.offset());
+        if(rec_ptr && expired(rec_ptr, aNow))
+        {
+            key_type key;
+            key.to_memory(rec_ptr);
+            aKeys.push_back(std::move(key));
+        }
+    }
+    partition().close();
+    return due.size();
+}
+
+template<typename K, typename V>
+size_t StorageManager<K,V>::purge(size_t aMax, const std::vector<uint64_t>& aSnapshots)
+{
+    std::lock_guard purge_lock(m_purge_mtx);
+    std::vector<purge_t> latest;
+    {
+        //a snapshot older than the record may still read a version it replaced
+        std::lock_guard flush_lock(m_flush_mtx);
+        auto kept = m_purges.begin();
+        for(auto it = m_purges.begin(); it != m_purges.end(); ++it)
+        {
+            if(latest.size() < aMax && !seen(aSnapshots, 0, it->m_seq))
+            {
+                latest.push_back(*it);
+            }
+            else
+            {
+                *kept++ = *it;
+            }
+        }
+        m_purges.erase(kept, m_purges.end());
+    }
+    const size_t taken = latest.size();
+    if(taken == 0)
+    {
+        return 0;
+    }
+
+    //a flush meanwhile only adds newer versions, the ones found stay dead
+    TRACE("Look for the versions " + std::to_string(taken) + " records replaced");
+    std::vector<std::pair<uint64_t,TID>> dead;
+    {
+        std::shared_lock lock(mtx());
+        partition().open();
+        std::unordered_map<uint32_t, std::shared_ptr<byte[]>> pages;
+        auto record = [&](const TID& aTid) -> const byte*
+        {
+            auto& page = pages[aTid.page()];
+            if(!page)
+            {
+                page = read_page(aTid.page());
+            }
+            InterpreterSP sp;
+            sp.attach(page.get());
+            return sp.get_record(aTid.offset());
+        };
+        for(const auto& [hash, tid, seq] : latest)
+        {
+            const byte* rec_ptr = record(tid);
+            if(!rec_ptr)
+            {
+                continue;
+            }
+            key_type key;
+            key.to_memory(rec_ptr);
+            //the key may have been written again since, the newer versions stay. A tombstone goes itself.
+            //Only the pages of the versions in question are read to compare the key
+            const bool tombstone = key_val_type::tombstone(rec_ptr);
+            const uint16_t fp = fingerprint(key);
+            const auto range = disk_index().equal_range(hash);
+            for(auto it = range.first; it != range.second; ++it)
+            {
+                const disk_entry_t& entry = it->second;
+                if(entry.m_fingerprint != fp || !(entry.m_seq < seq || (tombstone && entry.m_seq == seq)))
+                {
+                    continue;
+                }
+                const byte* candidate = record(entry.m_tid);
+                if(candidate && key_val_type::key_matches(candidate, key))
+                {
+                    dead.emplace_back(hash, entry.m_tid);
+                }
+            }
+        }
+        partition().close();
+    }
+    if(dead.empty())
+    {
+        return taken;
+    }
+
+    TRACE("Remove " + std::to_string(dead.size()) + " records from the index");
+    {
+        //a flush reads the index without the lock to tell whether a key is stored
+        std::lock_guard flush_lock(m_flush_mtx);
+        std::lock_guard lock(mtx());
+        for(const auto& [hash, tid] : dead)
+        {
+            const auto range = disk_index().equal_range(hash);
+            const auto it = std::find_if(range.first, range.second, [&tid = tid](const auto& entry){ return entry.second.m_tid.page() == tid.page() && entry.second.m_tid.offset() == tid.offset(); });
+            if(it != range.second)
+            {
+                disk_index().erase(it);
+            }
+            m_rows.erase(hash);
+        }
+    }
+
+    //no reader finds the slots any more, every page is rewritten once for all of its dead records
+    TRACE("Invalidate the slots page by page");
+    std::sort(dead.begin(), dead.end(), [](const auto& a, const auto& b){ return a.second.page() < b.second.page(); });
+    partition().open();
+    auto uptr = alloc_buffer_page();
+    InterpreterSP sp;
+    for(size_t i = 0; i < dead.size();)
+    {
+        //the readers read pages under the shared lock, none reads a page while it is rewritten
+        const uint32_t page_no = dead[i].second.page();
+        std::lock_guard lock(mtx());
+        partition().readPage(uptr.get(), page_no);
+        sp.attach(uptr.get());
+        for(; i < dead.size() && dead[i].second.page() == page_no; ++i)
+        {
+            sp.soft_delete(dead[i].second.offset());
+        }
+        sp.detach();
+        partition().writePage(uptr.get(), page_no);
+    }
+    partition().close();
+    return taken;
+}
+
+template<typename K, typename V>
+size_t StorageManager<K,V>::pending_purges() noexcept
+{
+    std::lock_guard flush_lock(m_flush_mtx);
+    return m_purges.size();
+}
\ No newline at end of file
@@ -1,65 +1,407 @@
 #include "tcp_connection.hh"
-#include "string_helper.hh"
 #include "database.hh"
+#include "protocol.hh"
 
-#include <boost/bind.hpp>
+#include <cstring>
+#include <algorithm>
 
-#include <thread>
-#include <chrono>
+tcp_connection::~tcp_connection() noexcept = default;
 
-using namespace std::chrono_literals;
+namespace
+{
+    // placeholder of a forwarded requests answer, never merged with other pieces
+    constexpr const char* PENDING_ANSWER = "";
+    constexpr size_t READ_SIZE = 4096;
+    // unordered disk reads of a connection before it stops reading further requests
+    constexpr size_t MAX_INFLIGHT = 64;
+    // threads issuing the disk reads of unordered requests, keeps the device queue busy
+    constexpr size_t DISK_THREADS = 16;
 
-tcp_connection::~tcp_connection() noexcept = default;
+    boost::asio::thread_pool& disk_pool() noexcept
+    {
+        static boost::asio::thread_pool lPool(DISK_THREADS);
+        return lPool;
+    }
+}
 
-tcp_connection::pointer tcp_connection::create(boost::asio::io_service& io_service) noexcept
+tcp_connection::pointer tcp_connection::create(boost::asio::io_context& io_context, shard_router* aRouter, size_t aCore) noexcept
 {
-    return pointer(new tcp_connection(io_service));
+    return pointer(new tcp_connection(io_context, aRouter, aCore));
 }
 
 void tcp_connection::start() noexcept
 {
-    TRACE("CONNECTION: Started connection");
-    std::cout << "CONNECTION: Started connection" << std::endl;
+    TRACE_INFO("CONNECTION: Started connection");
+    //the connection stays open and serves requests until the client closes it or an error occurs
     read();
 }
 
-tcp_connection::tcp_connection(boost::asio::io_service& io_service) noexcept
-    : m_socket(io_service)
+tcp_connection::tcp_connection(boost::asio::io_context& io_context, shard_router* aRouter, size_t aCore) noexcept
+    : m_socket(io_context)
+    , m_strand(boost::asio::make_strand(io_context))
+    , m_buffer()
+    , m_queued()
+    , m_sending()
+    , m_buffers()
+    , m_router(aRouter)
+    , m_core(aCore)
+    , m_pending(0)
+    , m_inflight(0)
+    , m_request()
+    , m_protocol(PROTOCOL::kUNKNOWN)
+    , m_missing(0)
+    , m_reading(false)
+    , m_writing(false)
+    , m_eof(false)
+    , m_closed(false)
 {
 }
 
+void tcp_connection::complete(size_t aSlot, std::string&& aAnswer) noexcept
+{
+    //runs on the thread of the connections core, the only thread of its io_context
+    m_queued.m_remote.push_back(std::move(aAnswer));
+    const std::string& lAnswer = m_queued.m_remote.back();
+    if(aSlot == shard_router::message_t::UNORDERED)
+    {
+        queue(lAnswer.data(), lAnswer.size());
+        --m_inflight;
+    }
+    else
+    {
+        m_queued.m_pieces.at(aSlot) = {lAnswer.data(), 0, lAnswer.size()};
+        --m_pending;
+    }
+    resume();
+}
+
 void tcp_connection::read() noexcept
 {
-    boost::asio::streambuf buf;
-    boost::asio::read_until
-    ( 
-        socket(), 
-        buf, 
-        '\n'
+    //the rest of a started binary frame is read at once into a buffer of its size
+    m_reading = true;
+    socket().async_read_some
+    (
+        m_buffer.prepare(std::max(READ_SIZE, m_missing)),
+        boost::asio::bind_executor(m_strand, [self = shared_from_this()](const boost::system::error_code& ec, size_t aBytes)
+        {
+            self->on_read(ec, aBytes);
+        })
     );
-    const std::string msg = boost::asio::buffer_cast<const char*>(buf.data());
-    TRACE("Process Msg: " + msg);
-    std::cout << "Process Msg: " << msg << std::endl;
-    const string_vt args = StringUtil::splitString(StringUtil::trim_copy(msg), ' ');
-    answer_t ans;
-    if(valid_request(args))
+}
+
+void tcp_connection::on_read(const boost::system::error_code& ec, size_t aBytes) noexcept
+{
+    m_reading = false;
+    if(ec == boost::asio::error::eof)
+    {
+        //the answers of requests still in flight are written before closing
+        m_eof = true;
+        resume();
+        return;
+    }
+    if(ec)
+    {
+        TRACE_ERROR("CONNECTION: Read failed: " + ec.message());
+        close();
+        return;
+    }
+    m_buffer.commit(aBytes);
+    const char* const data = static_cast<const char*>(m_buffer.data().data());
+    const size_t size = m_buffer.size();
+    if(m_protocol == PROTOCOL::kUNKNOWN)
+    {
+        m_protocol = static_cast<uint8_t>(data[0]) == Binary::REQUEST_MAGIC ? PROTOCOL::kBINARY : (data[0] == '*' ? PROTOCOL::kRESP : PROTOCOL::kTEXT);
+        TRACE_INFO("CONNECTION: Uses the " + to_string_protocol(m_protocol) + " protocol");
+    }
+    //execute every complete request received so far in order, an incomplete one stays in the buffer
+    size_t used = 0;
+    bool ok = true;
+    switch(m_protocol)
+    {
+        case PROTOCOL::kBINARY: ok = process_binary(data, size, used); break;
+        case PROTOCOL::kRESP: ok = process_resp(data, size, used); break;
+        case PROTOCOL::kTEXT:
+        case PROTOCOL::kUNKNOWN:
+        default: ok = process_text(data, size, used);
+    }
+    m_buffer.consume(used);
+    if(!ok)
     {
-        ans = KeyValueStore<str_key, str_val>::get_instance().request_handler(args);
+        close();
+        return;
+    }
+    resume();
+}
+
+void tcp_connection::resume() noexcept
+{
+    if(m_closed)
+    {
+        return;
+    }
+    flush();
+    if(m_writing || m_pending > 0)
+    {
+        //reading goes on once the answers are written, the last forwarded answer triggers the write
+        return;
+    }
+    if(m_eof)
+    {
+        if(m_inflight == 0)
+        {
+            close();
+        }
+        return;
+    }
+    if(!m_reading && m_inflight < MAX_INFLIGHT)
+    {
+        read();
+    }
+}
+
+bool tcp_connection::process_text(const char* aData, size_t aSize, size_t& aUsed) noexcept
+{
+    const void* eol;
+    while((eol = std::memchr(aData + aUsed, '\n', aSize - aUsed)))
+    {
+        const size_t end = static_cast<size_t>(static_cast<const char*>(eol) - aData) + 1;
+        const std::string_view line(aData + aUsed, end - aUsed);
+        TRACE("Process Msg: " + std::string(line));
+        parse_request(line, m_request);
+        process(line);
+        aUsed = end;
+    }
+    return true;
+}
+
+bool tcp_connection::process_binary(const char* aData, size_t aSize, size_t& aUsed) noexcept
+{
+    m_missing = 0;
+    while(true)
+    {
+        bool error;
+        const size_t length = Binary::frame_size(std::string_view(aData + aUsed, aSize - aUsed), error);
+        if(error)
+        {
+            TRACE_ERROR("CONNECTION: Invalid binary frame");
+            return false;
+        }
+        if(length == 0)
+        {
+            return true;
+        }
+        if(aSize - aUsed < length)
+        {
+            m_missing = length - (aSize - aUsed);
+            return true;
+        }
+        const std::string_view frame(aData + aUsed, length);
+        Binary::parse_request(frame, m_request);
+        process(frame);
+        aUsed += length;
+    }
+}
+
+bool tcp_connection::process_resp(const char* aData, size_t aSize, size_t& aUsed) noexcept
+{
+    while(aUsed < aSize)
+    {
+        bool error;
+        const size_t length = Resp::parse_request(std::string_view(aData + aUsed, aSize - aUsed), m_request, error);
+        if(error)
+        {
+            TRACE_ERROR("CONNECTION: Invalid RESP request");
+            return false;
+        }
+        if(length == 0)
+        {
+            break;
+        }
+        process(std::string_view(aData + aUsed, length));
+        aUsed += length;
+    }
+    return true;
+}
+
+void tcp_connection::process(std::string_view aRaw) noexcept
+{
+    //the request refers to the receive buffer, which is consumed after all requests are processed
+    sink_t sink{*this};
+    if(m_router && valid_request(m_request))
+    {
+        switch(m_request.m_cmd)
+        {
+            case CMD::kFLUSH:
+                m_router->flush_all();
+                Protocol::write_answer(sink, m_request, std::make_pair("OK", "Successful Flush"));
+                return;
+            case CMD::kCLEAR:
+                m_router->clear_all();
+                Protocol::write_answer(sink, m_request, std::make_pair("OK", "Successful Clear"));
+                return;
+            case CMD::kPING:
+                break;
+            default:
+            {
+                //a request is executed by the core owning its keys
+                size_t shard = m_core;
+                bool first = true;
+                bool cross = false;
+                Protocol::for_each_key(m_request, [&](std::string_view aKey)
+                {
+                    const size_t lShard = m_router->shard_of(aKey);
+                    cross |= !first && lShard != shard;
+                    shard = first ? lShard : shard;
+                    first = false;
+                });
+                if(cross)
+                {
+                    Protocol::write_answer(sink, m_request, std::make_pair("ERROR", "CROSSSLOT Keys in request don't hash to the same shard"));
+                    return;
+                }
+                if(shard != m_core)
+                {
+                    queue_remote(shard, aRaw);
+                    return;
+                }
+            }
+        }
+    }
+    if(m_request.m_unordered && m_request.m_cmd == CMD::kGET && valid_request(m_request))
+    {
+        get_unordered();
+        return;
+    }
+    Protocol::execute(sink, KeyValueStore<str_key, str_val>::get_instance(m_core), m_request);
+}
+
+void tcp_connection::get_unordered() noexcept
+{
+    auto& store = KeyValueStore<str_key, str_val>::get_instance(m_core);
+    str_key key(std::string(m_request.arg(1)));
+    auto handle = store.find_in_memory(key);
+    if(!handle.absent() || store.cache_mode())
+    {
+        write_get(m_request, std::move(handle));
+        return;
+    }
+    //the answer only needs the protocol fields of the request, not its arguments
+    request_t lRequest;
+    lRequest.m_cmd = m_request.m_cmd;
+    lRequest.m_protocol = m_request.m_protocol;
+    lRequest.m_id = m_request.m_id;
+    lRequest.m_unordered = true;
+    ++m_inflight;
+    boost::asio::post(disk_pool(), [self = shared_from_this(), &store, lKey = std::move(key), lRequest = std::move(lRequest)]() mutable
+    {
+        //a full find, merge operands in the memtable need the value on disk
+        auto lHandle = store.find(lKey);
+        boost::asio::post(self->m_strand, [self, lRequest = std::move(lRequest), lHandle = std::move(lHandle)]() mutable
+        {
+            --self->m_inflight;
+            if(!self->m_closed)
+            {
+                self->write_get(lRequest, std::move(lHandle));
+            }
+            self->resume();
+        });
+    });
+}
+
+void tcp_connection::write_get(const request_t& aRequest, read_handle_type&& aHandle) noexcept
+{
+    sink_t sink{*this};
+    if(aHandle)
+    {
+        Protocol::write_found(sink, aRequest, std::move(aHandle));
+    }
+    else
+    {
+        Protocol::write_miss(sink, aRequest, aHandle.status());
+    }
+}
+
+void tcp_connection::close() noexcept
+{
+    boost::system::error_code ec;
+    m_closed = true;
+    TRACE_INFO("CONNECTION: Closed connection");
+    socket().shutdown(tcp::socket::shutdown_both, ec);
+    socket().close(ec);
+}
+
+void tcp_connection::queue(const char* aData, size_t aSize) noexcept
+{
+    m_queued.m_pieces.push_back({aData, 0, aSize});
+}
+
+void tcp_connection::queue_out(std::string_view aData) noexcept
+{
+    //consecutive formatted parts are merged into one buffer
+    auto& pieces = m_queued.m_pieces;
+    if(!pieces.empty() && !pieces.back().m_data && pieces.back().m_offset + pieces.back().m_size == m_queued.m_out.size())
+    {
+        pieces.back().m_size += aData.size();
     }
     else
     {
-        TRACE("Invalid Request");
-        std::cerr << "Invalid Request" << std::endl;
-        ans = std::make_pair("ERROR", "INVALID REQUEST: '" + msg + "'");
+        pieces.push_back({nullptr, m_queued.m_out.size(), aData.size()});
     }
-    send(ans);
+    m_queued.m_out.append(aData);
 }
 
-void tcp_connection::send(const answer_t& ans) noexcept
+void tcp_connection::queue_remote(size_t aShard, std::string_view aRaw) noexcept
 {
-    boost::asio::write
+    //the answer keeps its position among the answers of the batch, unless the request is unordered
+    size_t lSlot = shard_router::message_t::UNORDERED;
+    if(m_request.m_unordered)
+    {
+        ++m_inflight;
+    }
+    else
+    {
+        lSlot = m_queued.m_pieces.size();
+        m_queued.m_pieces.push_back({PENDING_ANSWER, 0, 0});
+        ++m_pending;
+    }
+    m_router->forward(m_core, aShard, {shared_from_this(), m_core, lSlot, m_protocol, std::string(aRaw), std::string(), false});
+}
+
+void tcp_connection::flush() noexcept
+{
+    //at most one write is pending, answers completing meanwhile are collected for the next one
+    if(m_writing || m_pending > 0 || m_queued.m_pieces.empty())
+    {
+        return;
+    }
+    std::swap(m_queued, m_sending);
+    for(const auto& piece : m_sending.m_pieces)
+    {
+        m_buffers.emplace_back(piece.m_data ? piece.m_data : m_sending.m_out.data() + piece.m_offset, piece.m_size);
+    }
+    m_writing = true;
+    boost::asio::async_write
     (
-        socket(), 
-        boost::asio::buffer(ans.first + ":" + ans.second + "\n")
+        socket(),
+        m_buffers,
+        boost::asio::bind_executor(m_strand, [self = shared_from_this()](const boost::system::error_code& ec, size_t)
+        {
+            self->on_write(ec);
+        })
     );
 }
+
+void tcp_connection::on_write(const boost::system::error_code& ec) noexcept
+{
+    //the containers keep their capacity for the next batch
+    m_writing = false;
+    m_buffers.clear();
+    m_sending.clear();
+    if(ec)
+    {
+        TRACE_ERROR("CONNECTION: Write failed: " + ec.message());
+        close();
+        return;
+    }
+    resume();
+}
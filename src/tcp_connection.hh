@@ -1,10 +1,12 @@
 #pragma once
 #include "types.hh"
+#include "shard_router.hh"
 
 #include <boost/shared_ptr.hpp>
 #include <boost/enable_shared_from_this.hpp>
 #include <boost/asio.hpp>
 
+#include <deque>
 #include <iostream>
 #include <string>
 
@@ -14,16 +16,22 @@ class tcp_connection : public boost::enable_shared_from_this<tcp_connection>
 {
     public:
         using pointer = boost::shared_ptr<tcp_connection>;
+        using read_handle_type = read_handle_t<str_key, str_val>;
         ~tcp_connection()                                           noexcept;
 
     public:
-        static pointer  create(boost::asio::io_service& io_service) noexcept;
+        static pointer  create(boost::asio::io_context& io_context,
+                shard_router* aRouter = nullptr, size_t aCore = 0)  noexcept;
         tcp::socket&    socket()                                    noexcept { return m_socket; }
+        // starts the asynchronous read-execute-write cycle, the handlers keep the connection alive
         void            start()                                     noexcept;
+        // sets the answer of a request that was forwarded to another core
+        void            complete(size_t aSlot, std::string&& aAnswer) noexcept;
 
     private:
         tcp_connection()                                            noexcept = delete;
-        tcp_connection(boost::asio::io_service& io_service)         noexcept;
+        tcp_connection(boost::asio::io_context& io_context,
+                shard_router* aRouter, size_t aCore)                noexcept;
         tcp_connection(const tcp_connection&)                       noexcept = delete;
         tcp_connection& operator=(const tcp_connection&)            noexcept = delete;
         tcp_connection(tcp_connection&&)                            noexcept = delete;
@@ -31,8 +39,74 @@ class tcp_connection : public boost::enable_shared_from_this<tcp_connection>
 
     private:
         void            read()                                      noexcept;
-        void            send(const answer_t& ans)                   noexcept;
+        // executes all requests received so far and writes their answers
+        void            on_read(const boost::system::error_code& ec, size_t aBytes) noexcept;
+        void            on_write(const boost::system::error_code& ec) noexcept;
+        // writes the collected answers if possible, otherwise reads the next requests if possible
+        void            resume()                                    noexcept;
+        // set the number of consumed bytes, return false on a protocol error
+        bool            process_text(const char* aData, size_t aSize, size_t& aUsed) noexcept;
+        bool            process_binary(const char* aData, size_t aSize, size_t& aUsed) noexcept;
+        bool            process_resp(const char* aData, size_t aSize, size_t& aUsed) noexcept;
+        // aRaw is the complete line or frame of the parsed m_request
+        void            process(std::string_view aRaw)              noexcept;
+        // GET with FLAG_UNORDERED: a memtable miss reads the disk without holding up later requests
+        void            get_unordered()                             noexcept;
+        void            write_get(const request_t& aRequest, read_handle_type&& aHandle) noexcept;
+        // answers are collected and written by flush() with a single gather write
+        void            queue(const char* aData, size_t aSize)      noexcept;
+        void            queue_out(std::string_view aData)           noexcept;
+        void            queue_remote(size_t aShard, std::string_view aRaw) noexcept;
+        void            flush()                                     noexcept;
+        void            close()                                     noexcept;
 
     private:
-        tcp::socket m_socket;
+        // a part of the batched answer. Without data it refers to m_out, which may still grow
+        struct out_piece_t final
+        {
+            const char* m_data;
+            size_t      m_offset;
+            size_t      m_size;
+        };
+
+        // answers collected for one gather write
+        struct out_batch_t final
+        {
+            std::string                     m_out;      // storage for formatted answers
+            std::vector<out_piece_t>        m_pieces;
+            std::vector<read_handle_type>   m_handles;  // keeps the records of queued GET answers alive
+            std::deque<std::string>         m_remote;   // answers of forwarded requests
+
+            void clear() noexcept { m_out.clear(); m_pieces.clear(); m_handles.clear(); m_remote.clear(); }
+        };
+
+        // answer sink of the protocol writers (see protocol.hh)
+        struct sink_t final
+        {
+            tcp_connection& m_connection;
+
+            void copy(std::string_view aData)       noexcept { m_connection.queue_out(aData); }
+            void ref(std::string_view aData)        noexcept { m_connection.queue(aData.data(), aData.size()); }
+            void keep(read_handle_type&& aHandle)   noexcept { m_connection.m_queued.m_handles.emplace_back(std::move(aHandle)); }
+        };
+
+    private:
+        tcp::socket                         m_socket;
+        // every handler runs on the strand, disk reads of unordered requests complete concurrently
+        boost::asio::strand<boost::asio::io_context::executor_type> m_strand;
+        boost::asio::streambuf              m_buffer;
+        out_batch_t                         m_queued;   // answers of the requests executed since the last write
+        out_batch_t                         m_sending;  // answers of the pending write
+        std::vector<boost::asio::const_buffer> m_buffers;
+        shard_router*                       m_router;   // only set in the thread per core mode
+        size_t                              m_core;
+        size_t                              m_pending;  // forwarded requests without answer
+        size_t                              m_inflight; // unordered requests without answer
+        request_t                           m_request;  // reused for every request, views into m_buffer
+        PROTOCOL                            m_protocol; // decided by the first byte received
+        size_t                              m_missing;  // bytes missing of a started binary frame
+        bool                                m_reading;
+        bool                                m_writing;
+        bool                                m_eof;      // the client finished sending, answer the rest and close
+        bool                                m_closed;
 };
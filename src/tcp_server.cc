@@ -1,22 +1,64 @@
 #include "tcp_server.hh"
 #include "tcp_connection.hh"
-
-#include <thread>
+#include "database.hh"
+#include "trace.hh"
 
 #include <iostream>
 
-tcp_server::tcp_server(boost::asio::io_service& io_service, unsigned aPort) noexcept
-    : m_acceptor(io_service, tcp::endpoint(tcp::v4(), aPort))
+using reuse_port = boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
+
+namespace
+{
+    constexpr auto SWEEP_INTERVAL = std::chrono::seconds(1);
+}
+
+tcp_server::tcp_server(boost::asio::io_context& io_context, unsigned aPort, shard_router* aRouter, size_t aCore)
+    : m_io_context(io_context)
+    , m_acceptor(io_context)
+    , m_sweep_timer(io_context)
+    , m_router(aRouter)
+    , m_core(aCore)
 {
+    const tcp::endpoint lEndpoint(tcp::v4(), static_cast<unsigned short>(aPort));
+    m_acceptor.open(lEndpoint.protocol());
+    m_acceptor.set_option(tcp::acceptor::reuse_address(true));
+    if(m_router)
+    {
+        //every core listens on the same port, the kernel distributes the connections
+        m_acceptor.set_option(reuse_port(true));
+    }
+    m_acceptor.bind(lEndpoint);
+    m_acceptor.listen();
+    std::cout << "SERVER: Start Async Accept" << std::endl;
     start_accept();
+    start_sweep(true);
 }
 
 tcp_server::~tcp_server() noexcept = default;
 
+void tcp_server::start_sweep(bool aWait) noexcept
+{
+    //the keys of the shard are deleted on the thread of its core, in pool mode on any thread
+    m_sweep_timer.expires_after(aWait ? SWEEP_INTERVAL : std::chrono::seconds(0));
+    m_sweep_timer.async_wait([this](const boost::system::error_code& ec)
+    {
+        if(ec)
+        {
+            return;
+        }
+        using store_t = KeyValueStore<str_key, str_val>;
+        const size_t lSwept = store_t::get_instance(m_core).sweep();
+        if(lSwept > 0)
+        {
+            TRACE_INFO("SERVER: Swept " + std::to_string(lSwept) + " expired records");
+        }
+        start_sweep(lSwept < store_t::SWEEP_BATCH);
+    });
+}
+
 void tcp_server::start_accept() noexcept
 {
-    std::cout << "SERVER: Start Async Accept" << std::endl;
-    tcp_connection::pointer new_connection = tcp_connection::create(acceptor().get_io_service());
+    tcp_connection::pointer new_connection = tcp_connection::create(io_context(), m_router, m_core);
     acceptor().async_accept
     (
         new_connection->socket(),
@@ -24,8 +66,12 @@ void tcp_server::start_accept() noexcept
         {
             if(!ec)
             {
-                std::cout << "SERVER: Spawn Thread to handle new connection" << std::endl;
-                std::thread(&tcp_connection::start, new_connection).detach();
+                TRACE_INFO("SERVER: Start handling new connection");
+                new_connection->start();
+            }
+            else
+            {
+                TRACE_ERROR("SERVER: Accept failed: " + ec.message());
             }
             start_accept();
         }
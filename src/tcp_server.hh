@@ -4,11 +4,20 @@
 
 using boost::asio::ip::tcp;
 
+class shard_router;
+
+/* Accepts connections asynchronously. The connections run their handlers on the io_context the
+ * server was created with, any number of threads may call run() on it.
+ * With a router, the server belongs to one core of the thread per core mode and shares the port
+ * with the servers of the other cores.
+ * The server also sweeps the expired keys of its shard in the background. */
 class tcp_server final
 {
     public:
         tcp_server()                                                    noexcept = delete;
-        tcp_server(boost::asio::io_service& io_service, unsigned aPort) noexcept;
+        // throws boost::system::system_error if the port cannot be bound or listened on
+        tcp_server(boost::asio::io_context& io_context, unsigned aPort,
+                shard_router* aRouter = nullptr, size_t aCore = 0);
         tcp_server(const tcp_server&)                                   noexcept = delete;
         tcp_server& operator=(const tcp_server&)                        noexcept = delete;
         tcp_server(tcp_server&&)                                        noexcept = delete;
@@ -17,9 +26,16 @@ class tcp_server final
 
     private:
         void start_accept()                                             noexcept;
+        // deletes expired keys in batches, waits a while once there are no more
+        void start_sweep(bool aWait)                                    noexcept;
         auto& acceptor()                                                noexcept { return m_acceptor; }
+        auto& io_context()                                              noexcept { return m_io_context; }
 
     private:
-        tcp::acceptor m_acceptor;
+        boost::asio::io_context&    m_io_context;
+        tcp::acceptor               m_acceptor;
+        boost::asio::steady_timer   m_sweep_timer;
+        shard_router*               m_router;
+        size_t                      m_core;
 };
 
@@ -1,22 +1,75 @@
 #include "trace.hh"
+#include "trace_ring.hh"
 
 #include <ctime>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
 #include <filesystem>
 
 namespace fs = std::filesystem;
+using namespace std::chrono_literals;
+
+namespace
+{
+    // gives the ring back once its thread terminates
+    struct ring_owner_t final
+    {
+        ~ring_owner_t()
+        {
+            if(m_ring)
+            {
+                m_ring->release();
+            }
+        }
+        trace_ring_t* m_ring = nullptr;
+    };
+
+    thread_local ring_owner_t tl_ring_owner;
+}
 
 Trace::Trace() noexcept :
     _logPath(),
     _logStream(),
-    _cb(nullptr)
+    _cb(nullptr),
+    _ringMtx(),
+    _rings(),
+    _writerMtx(),
+    _writerCv(),
+    _stop(false),
+    _writer(),
+    _steadyStart(std::chrono::steady_clock::now()),
+    _systemStart(std::chrono::system_clock::now())
 {}
 
+std::string to_string_level(LEVEL aLevel) noexcept
+{
+    std::string result;
+    switch(aLevel)
+    {
+        case LEVEL::kOFF: result = "OFF"; break;
+        case LEVEL::kERROR: result = "ERROR"; break;
+        case LEVEL::kINFO: result = "INFO"; break;
+        case LEVEL::kDEBUG: result = "DEBUG"; break;
+        default: result = "DEFAULT/ERROR";
+    }
+    return result;
+}
+
 Trace::~Trace() noexcept
 {
-    if(_cb->trace())
+    //the control block may already be gone at exit, the writer thread tells whether tracing was on
+    if(_writer.joinable())
     {
-        TRACE("Closing the log file...");
-        TRACE("'Trace' destructed");
+        TRACE_INFO("Closing the log file...");
+        TRACE_INFO("'Trace' destructed");
+        _level.store(underlying_type(LEVEL::kOFF));
+        {
+            std::lock_guard lock(_writerMtx);
+            _stop = true;
+        }
+        _writerCv.notify_one();
+        _writer.join();
         _logStream.close();
     }
 }
@@ -35,26 +88,115 @@ void Trace::init(const CB& aControlBlock) noexcept
         if(_cb->trace())
         {
             _logStream.open(_logPath.c_str(), std::ofstream::out | std::ofstream::app);
-            TRACE("'Trace' constructed"); // just for consistency with the other singletons
-            TRACE("Log file created and opened");
+            _writer = std::thread(&Trace::run_writer, this);
+            _level.store(static_cast<int8_t>(std::min(_cb->trace_level(), static_cast<uint>(underlying_type(LEVEL::kDEBUG)))));
+            TRACE_INFO("'Trace' constructed"); // just for consistency with the other singletons
+            TRACE_INFO("Log file created and opened");
         }
-        TRACE("'Trace' initialized");
+        TRACE_INFO("'Trace' initialized");
     }
 }
 
-void Trace::log(const char* aFileName, uint aLineNumber, const char* aFunctionName, const std::string& aMessage) noexcept
+void Trace::log(const char* aFileName, uint aLineNumber, const char* aFunctionName, LEVEL aLevel, const std::string& aMessage) noexcept
 {
-    if(_cb->trace())
+    const int64_t lTicks = std::chrono::steady_clock::now().time_since_epoch().count();
+    if(thread_ring().push(aFileName, aLineNumber, aFunctionName, aLevel, aMessage, lTicks))
     {
-        std::time_t lCurrTime = std::time(nullptr);
-        std::string lTime = std::ctime(&lCurrTime);
-        lTime = lTime.substr(0, lTime.size() - 1);
-        _logStream << lTime 
-            << ": " << aFileName 
-            << ", line " << aLineNumber
-            << ", " << aFunctionName
-            << ":\n'" << aMessage << "'"
-            << std::endl;
+        _writerCv.notify_one();
+    }
+}
+
+trace_ring_t& Trace::thread_ring() noexcept
+{
+    if(!tl_ring_owner.m_ring)
+    {
+        std::lock_guard lock(_ringMtx);
+        for(auto& ring : _rings)
+        {
+            if(ring->acquire())
+            {
+                tl_ring_owner.m_ring = ring.get();
+                break;
+            }
+        }
+        if(!tl_ring_owner.m_ring)
+        {
+            _rings.emplace_back(std::make_unique<trace_ring_t>());
+            tl_ring_owner.m_ring = _rings.back().get();
+        }
     }
+    return *tl_ring_owner.m_ring;
 }
 
+void Trace::run_writer() noexcept
+{
+    std::unique_lock lock(_writerMtx);
+    while(!_stop)
+    {
+        lock.unlock();
+        const bool lWritten = write_pending();
+        lock.lock();
+        if(!lWritten)
+        {
+            _writerCv.wait_for(lock, 10ms, [this](){ return _stop; });
+        }
+    }
+    lock.unlock();
+    write_pending();
+}
+
+bool Trace::write_pending() noexcept
+{
+    std::vector<trace_ring_t*> lRings;
+    {
+        std::lock_guard lock(_ringMtx);
+        for(auto& ring : _rings)
+        {
+            lRings.push_back(ring.get());
+        }
+    }
+
+    std::vector<trace_record_t> lBatch;
+    uint64_t lDropped = 0;
+    for(trace_ring_t* ring : lRings)
+    {
+        ring->drain([&lBatch](const trace_record_t& aRecord){ lBatch.push_back(aRecord); });
+        lDropped += ring->take_dropped();
+    }
+    if(lBatch.empty() && lDropped == 0)
+    {
+        return false;
+    }
+    // records of different threads are only ordered within their ring
+    std::stable_sort(lBatch.begin(), lBatch.end(), [](const trace_record_t& lhs, const trace_record_t& rhs){ return lhs.m_ticks < rhs.m_ticks; });
+
+    std::string lOut;
+    lOut.reserve(lBatch.size() * 256);
+    char lTimeBuf[64];
+    for(const auto& lRecord : lBatch)
+    {
+        const auto lSteady = std::chrono::steady_clock::time_point(std::chrono::steady_clock::duration(lRecord.m_ticks));
+        const auto lSystem = _systemStart + std::chrono::duration_cast<std::chrono::system_clock::duration>(lSteady - _steadyStart);
+        const std::time_t lTime = std::chrono::system_clock::to_time_t(lSystem);
+        const auto lMicros = std::chrono::duration_cast<std::chrono::microseconds>(lSystem.time_since_epoch()).count() % 1000000;
+        std::tm lTm;
+        localtime_r(&lTime, &lTm);
+        const size_t lLength = std::strftime(lTimeBuf, sizeof(lTimeBuf), "%a %b %e %H:%M:%S", &lTm);
+        lOut.append(lTimeBuf, lLength);
+        std::snprintf(lTimeBuf, sizeof(lTimeBuf), ".%06ld", static_cast<long>(lMicros));
+        lOut.append(lTimeBuf)
+            .append(" [").append(to_string_level(lRecord.m_level)).append("]")
+            .append(": ").append(lRecord.m_file)
+            .append(", line ").append(std::to_string(lRecord.m_line))
+            .append(", ").append(lRecord.m_func)
+            .append(":\n'").append(lRecord.m_msg, lRecord.m_length)
+            .append(lRecord.m_truncated ? "...'\n" : "'\n");
+    }
+    if(lDropped > 0)
+    {
+        lOut.append("[ERROR]: ").append(std::to_string(lDropped)).append(" trace messages dropped (trace ring buffer full)\n");
+    }
+    _logStream.write(lOut.data(), static_cast<std::streamsize>(lOut.size()));
+    _logStream.flush();
+    return true;
+}
@@ -4,7 +4,11 @@
  *  @bugs   -
  *
  *  @section DESCRIPTION
- *      TODO
+ *      Trace statements have a level (error, info, debug). Messages above the level configured in
+ *      the control block are neither built nor written.
+ *      Logging threads only copy the message together with a steady clock time stamp into their own
+ *      ring buffer. A single writer thread drains all rings, formats the lines and writes them in
+ *      batches, so no lock, time conversion or flush happens on the calling thread.
  */
 
 #pragma once
@@ -12,8 +16,41 @@
 #include "types.hh"
 #include <string>
 #include <fstream>
+#include <thread>
+#include <chrono>
 
-#define TRACE(msg) Trace::get_instance().log(__FILE__, __LINE__, __PRETTY_FUNCTION__, msg)
+// trace levels, a message is logged if its level is at most the configured one
+enum class LEVEL : int8_t
+{
+    kOFF = 0,
+    kERROR = 1,
+    kINFO = 2,
+    kDEBUG = 3
+};
+
+std::string to_string_level(LEVEL aLevel) noexcept;
+
+/* The message argument is only evaluated if its level is enabled. Compiling with KEYDB_NO_TRACE
+ * (cmake -DKEYDB_TRACE=OFF) removes all trace statements including their arguments. */
+#ifdef KEYDB_NO_TRACE
+    #define TRACE_LEVEL(level, msg) static_cast<void>(0)
+#else
+    #define TRACE_LEVEL(level, msg) \
+        do \
+        { \
+            if(Trace::enabled(level)) \
+            { \
+                Trace::get_instance().log(__FILE__, __LINE__, __PRETTY_FUNCTION__, level, msg); \
+            } \
+        } \
+        while(false)
+#endif
+
+#define TRACE_ERROR(msg) TRACE_LEVEL(LEVEL::kERROR, msg)
+#define TRACE_INFO(msg) TRACE_LEVEL(LEVEL::kINFO, msg)
+#define TRACE(msg) TRACE_LEVEL(LEVEL::kDEBUG, msg)
+
+class trace_ring_t;
 
 class Trace final
 {
@@ -35,15 +72,40 @@ class Trace final
         void    init(const CB& aControlBlock)           noexcept;
 
     public:
-        void    log(const char* aFileName, uint aLineNumber, const char* aFunctionName, const std::string& aMessage) noexcept;
+        // cheap check guarding the evaluation of trace messages
+        static bool enabled(LEVEL aLevel)               noexcept 
+        { 
+            return underlying_type(aLevel) <= _level.load(std::memory_order_relaxed); 
+        }
+        // the level of the messages logged from now on, init sets it from the control block
+        static void level(LEVEL aLevel)                 noexcept { _level.store(underlying_type(aLevel), std::memory_order_relaxed); }
+        void    log(const char* aFileName, uint aLineNumber, const char* aFunctionName, LEVEL aLevel, const std::string& aMessage) noexcept;
 
     public:
         inline const std::string&       getLogPath()    noexcept { return _logPath; }
         inline const std::ofstream&     getLogStream()  noexcept { return _logStream; }
 
+    private:
+        trace_ring_t&   thread_ring()                   noexcept;
+        void            run_writer()                    noexcept;
+        bool            write_pending()                 noexcept;
+
     private:
         std::string   _logPath;
         std::ofstream _logStream;
         const CB*     _cb;
+
+        std::mutex                                  _ringMtx;       // guards registration of rings only
+        std::vector<std::unique_ptr<trace_ring_t>>  _rings;
+        std::mutex                                  _writerMtx;
+        std::condition_variable                     _writerCv;
+        bool                                        _stop;
+        std::thread                                 _writer;
+        std::chrono::steady_clock::time_point       _steadyStart;   // to convert the time stamps of the records
+        std::chrono::system_clock::time_point       _systemStart;
+
+    private:
+        // traces are disabled until init() was called
+        inline static std::atomic<int8_t> _level{underlying_type(LEVEL::kOFF)};
 };
 
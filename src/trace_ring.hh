@@ -0,0 +1,100 @@
+/**
+ *  @author Nick Weber
+ *  @brief  The per-thread ring buffer of trace records
+ *  @bugs   -
+ *
+ *  @section DESCRIPTION
+ *      A logging thread owns one ring and copies its records into it, the trace writer thread
+ *      drains all rings. See trace.hh
+ */
+
+#pragma once
+
+#include "trace.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <memory>
+#include <string>
+
+constexpr size_t TRACE_RING_SIZE = 2048; // records per thread, needs to be a power of 2
+constexpr size_t TRACE_MSG_SIZE = 216;  // longer messages are truncated
+
+struct trace_record_t final
+{
+    int64_t     m_ticks;    // steady clock ticks, formatted by the writer
+    const char* m_file;
+    const char* m_func;
+    uint32_t    m_line;
+    LEVEL       m_level;
+    bool        m_truncated;
+    uint16_t    m_length;
+    char        m_msg[TRACE_MSG_SIZE];
+};
+
+/* Single producer (the owning thread), single consumer (the writer thread) ring of trace records.
+ * When the owning thread terminates, the ring is released and handed to the next new thread. */
+class trace_ring_t final
+{
+    public:
+        trace_ring_t() noexcept
+            : m_records(std::make_unique<trace_record_t[]>(TRACE_RING_SIZE))
+            , m_head(0)
+            , m_tail(0)
+            , m_dropped(0)
+            , m_owned(true)
+        {}
+
+    public:
+        // producer side. Never blocks, if the ring is full the record is dropped and counted.
+        // Returns true if the ring got half full and the writer should be woken up
+        bool push(const char* aFile, uint aLine, const char* aFunc, LEVEL aLevel, const std::string& aMsg, int64_t aTicks) noexcept
+        {
+            const uint64_t lHead = m_head.load(std::memory_order_relaxed);
+            if(lHead - m_tail.load(std::memory_order_acquire) == TRACE_RING_SIZE)
+            {
+                m_dropped.fetch_add(1, std::memory_order_relaxed);
+                return true;
+            }
+            trace_record_t& lRecord = m_records[lHead & (TRACE_RING_SIZE - 1)];
+            lRecord.m_ticks = aTicks;
+            lRecord.m_file = aFile;
+            lRecord.m_func = aFunc;
+            lRecord.m_line = aLine;
+            lRecord.m_level = aLevel;
+            lRecord.m_truncated = aMsg.size() > TRACE_MSG_SIZE;
+            lRecord.m_length = static_cast<uint16_t>(std::min(aMsg.size(), TRACE_MSG_SIZE));
+            std::memcpy(lRecord.m_msg, aMsg.data(), lRecord.m_length);
+            m_head.store(lHead + 1, std::memory_order_release);
+            return (lHead + 1 - m_tail.load(std::memory_order_relaxed)) == TRACE_RING_SIZE / 2;
+        }
+
+        // consumer side
+        template<typename F>
+        void drain(F&& aFunction) noexcept
+        {
+            const uint64_t lTail = m_tail.load(std::memory_order_relaxed);
+            const uint64_t lHead = m_head.load(std::memory_order_acquire);
+            for(uint64_t i = lTail; i != lHead; ++i)
+            {
+                aFunction(m_records[i & (TRACE_RING_SIZE - 1)]);
+            }
+            m_tail.store(lHead, std::memory_order_release);
+        }
+        uint64_t take_dropped()     noexcept { return m_dropped.exchange(0, std::memory_order_relaxed); }
+
+        bool acquire() noexcept
+        {
+            bool lOwned = false;
+            return m_owned.compare_exchange_strong(lOwned, true, std::memory_order_acq_rel);
+        }
+        void release()              noexcept { m_owned.store(false, std::memory_order_release); }
+
+    private:
+        std::unique_ptr<trace_record_t[]>   m_records;
+        alignas(64) std::atomic<uint64_t>   m_head;
+        alignas(64) std::atomic<uint64_t>   m_tail;
+        std::atomic<uint64_t>               m_dropped;
+        std::atomic_bool                    m_owned;
+};
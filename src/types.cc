@@ -1,17 +1,25 @@
 #include "types.hh"
 #include <iostream>
 #include <sstream>
+#include <cstring>
 
 std::string to_string(bool aBool) noexcept
 {
     return aBool ? "true" : "false";
 }
 
-control_block_t::control_block_t(bool aTrace, const std::string& aTracePath, uint aBufferSize, uint aPort) noexcept
+control_block_t::control_block_t(bool aTrace, const std::string& aTracePath, uint aBufferSize, uint aPort, uint aTraceLevel, uint aThreads, bool aThreadPerCore,
+                                 size_t aMaxMemory, EVICTION aEviction, size_t aRowCache) noexcept
     : m_trace(aTrace)
     , m_trace_path(aTracePath)
     , m_buffer_size(aBufferSize)
     , m_port(aPort)
+    , m_trace_level(aTraceLevel)
+    , m_threads(aThreads)
+    , m_thread_per_core(aThreadPerCore)
+    , m_max_memory(aMaxMemory)
+    , m_eviction(aEviction)
+    , m_row_cache(aRowCache)
 {
     std::cout << *this << std::endl;
 }
@@ -28,6 +36,11 @@ const std::string& control_block_t::trace_path() const noexcept
     return m_trace_path;
 }
 
+uint control_block_t::trace_level() const noexcept
+{  
+    return m_trace_level;
+}
+
 uint control_block_t::buffer_size() const noexcept
 {
     return m_buffer_size;
@@ -38,14 +51,45 @@ uint control_block_t::port() const noexcept
     return m_port;
 }
 
+uint control_block_t::threads() const noexcept
+{
+    return m_threads;
+}
+
+bool control_block_t::thread_per_core() const noexcept
+{
+    return m_thread_per_core;
+}
+
+size_t control_block_t::max_memory() const noexcept
+{
+    return m_max_memory;
+}
+
+EVICTION control_block_t::eviction() const noexcept
+{
+    return m_eviction;
+}
+
+size_t control_block_t::row_cache() const noexcept
+{
+    return m_row_cache;
+}
+
 std::ostream& control_block_t::print(std::ostream& os) const noexcept
 {
     os << "Control Block Settings:\n"
         << "\t* Trace: \t'" << to_string(trace()) << "'"
         << "\n\t* Trace Path: \t'" << trace_path() << "'"
+        << "\n\t* Trace Level: \t'" << trace_level() << "'"
         << "\n\t* Page Size: \t'" << PAGE_SIZE << "'"
         << "\n\t* Buffer Size: \t'" << buffer_size() << "'"
         << "\n\t* Port: \t'" << port() << "'"
+        << "\n\t* Threads: \t'" << threads() << "'"
+        << "\n\t* Thread per Core: \t'" << to_string(thread_per_core()) << "'"
+        << "\n\t* Max Memory: \t'" << max_memory() << "'"
+        << "\n\t* Eviction: \t'" << to_string_eviction(eviction()) << "'"
+        << "\n\t* Row Cache: \t'" << row_cache() << "'"
         << std::endl;
     return os;
 }
@@ -60,6 +104,12 @@ string_t::string_t(const std::string& aData) noexcept
     m_data.shrink_to_fit(); 
 }
 
+string_t::string_t(std::string&& aData) noexcept
+    : m_data(std::move(aData))
+{
+    m_data.shrink_to_fit();
+}
+
 string_t::string_t(const string_t&) = default;
 string_t& string_t::operator=(const string_t&) = default;
 string_t::string_t(string_t&&) noexcept = default;
@@ -106,17 +156,29 @@ size_t string_t::bytes() const noexcept
     return sizeof(m_data) + m_data.capacity(); 
 }
 
+size_t string_t::allocated() const noexcept
+{
+    //the characters and their terminator are stored in the string up to its initial capacity
+    static const size_t lLocal = std::string().capacity();
+    return m_data.capacity() > lLocal ? malloc_size(m_data.capacity() + 1) : 0;
+}
+
+size_t string_t::allocated(size_t aLength) noexcept
+{
+    static const size_t lLocal = std::string().capacity();
+    return aLength > lLocal ? malloc_size(aLength + 1) : 0;
+}
+
 size_t string_t::size() const noexcept
 {
-    return data().size() + 1;
+    return VarInt::size(data().size()) + data().size();
 }
 
 byte* string_t::to_disk(byte* aMem) const noexcept
 {
-    char* char_ptr = reinterpret_cast<char*>(aMem);
-    size_t index = m_data.copy(char_ptr, m_data.size());
-    char_ptr[index++] = '\0';
-    return aMem + index;
+    byte* lMem = VarInt::encode(aMem, m_data.size());
+    std::memcpy(lMem, m_data.data(), m_data.size());
+    return lMem + m_data.size();
 }
 
 byte* string_t::to_disk(byte* aMem) noexcept
@@ -124,11 +186,30 @@ byte* string_t::to_disk(byte* aMem) noexcept
     return static_cast<const string_t&>(*this).to_disk(aMem);
 }
 
-byte* string_t::to_memory(byte* aMem) noexcept
+const byte* string_t::to_memory(const byte* aMem) noexcept
+{
+    const std::string_view lView = view(aMem);
+    m_data.assign(lView.data(), lView.size());
+    return reinterpret_cast<const byte*>(lView.data() + lView.size());
+}
+
+bool string_t::matches(const byte* aMem) const noexcept
+{
+    return view(aMem) == std::string_view(m_data);
+}
+
+std::string_view string_t::view(const byte* aMem) noexcept
+{
+    uint64_t lLength;
+    const byte* lMem = VarInt::decode(aMem, lLength);
+    return std::string_view(reinterpret_cast<const char*>(lMem), lLength);
+}
+
+const byte* string_t::skip(const byte* aMem) noexcept
 {
-    m_data = std::string(reinterpret_cast<char*>(aMem));
-    size_t index = m_data.size() + 1;
-    return aMem + index;
+    uint64_t lLength;
+    const byte* lMem = VarInt::decode(aMem, lLength);
+    return lMem + lLength;
 }
 
 std::string string_t::to_string() const noexcept
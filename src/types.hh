@@ -1,8 +1,13 @@
 #pragma once
 
+#include "varint.hh"
+
 #include <cstdint>
 #include <cstdlib>
+#include <cctype>
+#include <cstring>
 #include <string>
+#include <string_view>
 #include <cassert>
 #include <limits>
 #include <type_traits>
@@ -11,6 +16,8 @@
 #include <condition_variable>
 #include <mutex>
 #include <atomic>
+#include <chrono>
+#include <algorithm>
 
 using int8_t = std::int8_t;
 using uint8_t = std::uint8_t;
@@ -26,14 +33,57 @@ using uint = unsigned int;
 using string_vt = std::vector<std::string>;
 
 constexpr uint16_t PAGE_SIZE = 16384;
+// the largest record a page holds: a slotted page has an 8 byte header, every record a 2 byte slot
+// and records are 8 byte aligned (see InterpreterSP::add_new_record)
+constexpr size_t MAX_RECORD_SIZE = (PAGE_SIZE - 8 - 2) & ~size_t(7);
+constexpr size_t MAX_SHARDS = 256; // upper bound for the shards of the thread per core server
 
 inline std::unique_ptr<byte[]> alloc_buffer_page() noexcept
 {
     return std::make_unique<byte[]>(PAGE_SIZE);
 }
 
+// the clock of expiry times: milliseconds since the epoch, they are persisted with the records
+inline uint64_t now_ms() noexcept
+{
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count());
+}
+
+// the size of the heap block malloc hands out for aBytes: glibc adds a size field and rounds up to
+// 16 bytes, the smallest chunk holds 32 bytes
+inline size_t malloc_size(size_t aBytes) noexcept
+{
+    return aBytes == 0 ? 0 : std::max<size_t>(4 * sizeof(void*), (aBytes + sizeof(void*) + 15) & ~size_t(15));
+}
+
 std::string to_string(bool aBool) noexcept;
 
+// the keys a cache evicts first once it exceeds its memory budget
+enum class EVICTION : int8_t
+{
+    kINVALID = -1,
+    kLRU = 0,   // least recently used
+    kLFU = 1    // least frequently used
+};
+
+inline std::string to_string_eviction(EVICTION aEviction) noexcept
+{
+    std::string result;
+    switch(aEviction)
+    {
+        case EVICTION::kLRU: result = "lru"; break;
+        case EVICTION::kLFU: result = "lfu"; break;
+        case EVICTION::kINVALID: result = "INVALID"; break;
+        default: result = "DEFAULT/ERROR";
+    }
+    return result;
+}
+
+inline EVICTION to_eviction(const std::string& aName) noexcept
+{
+    return aName == "lru" ? EVICTION::kLRU : (aName == "lfu" ? EVICTION::kLFU : EVICTION::kINVALID);
+}
+
 class control_block_t final
 {
     public:
@@ -46,14 +96,29 @@ class control_block_t final
                 bool aTrace, 
                 const std::string& aTracePath,
                 uint aBufferSize,
-                uint aPort)                                   noexcept;
+                uint aPort,
+                uint aTraceLevel = 3,
+                uint aThreads = 0,
+                bool aThreadPerCore = false,
+                size_t aMaxMemory = 0,
+                EVICTION aEviction = EVICTION::kLRU,
+                size_t aRowCache = 0)                         noexcept;
         ~control_block_t()                                    noexcept;
 
     public:
         bool                trace()                     const noexcept;
         const std::string&  trace_path()                const noexcept;
+        uint                trace_level()               const noexcept;
         uint                buffer_size()               const noexcept;
         uint                port()                      const noexcept;
+        uint                threads()                   const noexcept;
+        bool                thread_per_core()           const noexcept;
+        // the memory budget of the cache in bytes, 0 if the keys are stored on disk
+        size_t              max_memory()                const noexcept;
+        bool                cache_mode()                const noexcept { return max_memory() > 0; }
+        EVICTION            eviction()                  const noexcept;
+        // the budget of the decoded records cached above the disk in bytes, 0 disables them
+        size_t              row_cache()                 const noexcept;
         std::ostream&       print(std::ostream& os)     const noexcept;
 
     public:
@@ -67,6 +132,12 @@ class control_block_t final
         std::string         m_trace_path;
         uint                m_buffer_size;
         uint                m_port;
+        uint                m_trace_level;
+        uint                m_threads;
+        bool                m_thread_per_core;
+        size_t              m_max_memory;
+        EVICTION            m_eviction;
+        size_t              m_row_cache;
 };
 using CB = control_block_t;
 
@@ -75,6 +146,7 @@ class string_t final
     public:
         string_t()                                                noexcept;
         string_t(const std::string& aData)                        noexcept;
+        string_t(std::string&& aData)                             noexcept;
         string_t(const string_t&);
         string_t& operator=(const string_t&);
         string_t(string_t&&)                                      noexcept;
@@ -91,12 +163,27 @@ class string_t final
 
     public:
         const std::string&  data()                          const noexcept;
+        std::string_view    view()                          const noexcept { return m_data; }
         size_t              bytes()                         const noexcept ;
+        // the heap memory holding the characters, 0 while they fit into the string itself
+        size_t              allocated()                     const noexcept;
         size_t              size()                          const noexcept;
+        // the size of the disk representation of a string of aLength characters
+        static size_t       disk_size(size_t aLength)             noexcept { return VarInt::size(aLength) + aLength; }
         byte*               to_disk(byte* aMem)             const noexcept;
         byte*               to_disk(byte* aMem)                   noexcept;
-        byte*               to_memory(byte* aMem)                 noexcept;
+        const byte*         to_memory(const byte* aMem)           noexcept;
+        // compares the disk representation at aMem with this string without decoding it
+        bool                matches(const byte* aMem)       const noexcept;
         std::string         to_string()                     const noexcept;
+
+    public:
+        // view on the payload of a disk representation
+        static std::string_view view(const byte* aMem)            noexcept;
+        // returns the pointer behind a disk representation
+        static const byte*  skip(const byte* aMem)                noexcept;
+        // the heap memory to_memory allocates for aLength characters, see allocated
+        static size_t       allocated(size_t aLength)             noexcept;
         friend std::ostream& operator<<(std::ostream& os, const string_t& t) noexcept
         {
             return os << t.to_string();
@@ -130,7 +217,8 @@ enum class MOD : int8_t
     kINSERT = 0,
     kUPDATE = 1,
     kDELETE = 2,
-    kNoTypes = 3
+    kMERGE = 3,     // the value is an operand of the merge operator (see merge_operator.hh)
+    kNoTypes = 4
 };
 
 inline std::string to_string_mod(MOD aMod) noexcept
@@ -142,6 +230,31 @@ inline std::string to_string_mod(MOD aMod) noexcept
         case MOD::kINSERT: result = "INSERT"; break;
         case MOD::kUPDATE: result = "UPDATE"; break;
         case MOD::kDELETE: result = "DELETE"; break;
+        case MOD::kMERGE: result = "MERGE"; break;
+        default: result = "DEFAULT/ERROR";
+    }
+    return result;
+}
+
+// result of a lookup: found, deleted (a tombstone shadows older versions) or not present at all.
+// An expired value shadows older versions like a tombstone
+enum class FIND : int8_t
+{
+    kABSENT = 0,
+    kFOUND = 1,
+    kDELETED = 2,
+    kEXPIRED = 3
+};
+
+inline std::string to_string_find(FIND aFind) noexcept
+{
+    std::string result;
+    switch(aFind)
+    {
+        case FIND::kABSENT: result = "ABSENT"; break;
+        case FIND::kFOUND: result = "FOUND"; break;
+        case FIND::kDELETED: result = "DELETED"; break;
+        case FIND::kEXPIRED: result = "EXPIRED"; break;
         default: result = "DEFAULT/ERROR";
     }
     return result;
@@ -151,9 +264,9 @@ template<typename K, typename V>
 class key_val_t final
 {
     public:
-        key_val_t()                             noexcept : m_key_val(), m_mod_type(MOD::kINVALID){};
-        key_val_t(const K& aKey, const V& aVal, MOD aModType = MOD::kINVALID) noexcept
-            : m_key_val(aKey, aVal), m_mod_type(aModType)
+        key_val_t()                             noexcept : m_key_val(), m_mod_type(MOD::kINVALID), m_seq(0), m_expiry(0){};
+        key_val_t(const K& aKey, const V& aVal, MOD aModType = MOD::kINVALID, uint64_t aSeq = 0, uint64_t aExpiry = 0) noexcept
+            : m_key_val(aKey, aVal), m_mod_type(aModType), m_seq(aSeq), m_expiry(aExpiry)
         {}
         key_val_t(const key_val_t&)            = default;
         key_val_t& operator=(const key_val_t&) = default;
@@ -174,9 +287,26 @@ class key_val_t final
         MOD         type()  const noexcept { return m_mod_type; }
         bool        ins()   const noexcept { return type() == MOD::kINSERT; }
         bool        del()   const noexcept { return type() == MOD::kDELETE; }
+        bool        merge() const noexcept { return type() == MOD::kMERGE; }
         bool        valid() const noexcept { return !del() && type() != MOD::kINVALID;}
-        size_t      bytes() const noexcept { return key().bytes() + val().bytes() + sizeof(m_mod_type); }
-        size_t      diskB() const noexcept { return key().bytes() + val().bytes(); }
+        // a disk record of a delete, kept while a snapshot still sees the versions before it
+        static constexpr uint64_t TOMBSTONE = uint64_t(1) << 63;
+        // the sequence number of the record is followed by its expiry time
+        static constexpr uint64_t EXPIRES = uint64_t(1) << 62;
+        static constexpr uint64_t FLAGS = TOMBSTONE | EXPIRES;
+
+        // the sequence number of the write, the version of the key it leaves behind
+        uint64_t    seq()   const noexcept { return m_seq; }
+        void        seq(uint64_t aSeq) noexcept { m_seq = aSeq; }
+        // the time the value expires at (see now_ms), 0 if it never does
+        uint64_t    expiry() const noexcept { return m_expiry; }
+        bool        expired(uint64_t aNow) const noexcept { return m_expiry != 0 && m_expiry <= aNow; }
+        size_t      bytes() const noexcept { return key().bytes() + val().bytes() + sizeof(m_mod_type) + sizeof(m_seq) + sizeof(m_expiry); }
+        size_t      diskB() const noexcept { return disk_size(key(), val(), m_expiry != 0); }
+        // whether the record fits into a page, larger ones cannot be stored
+        bool        fits_page() const noexcept { return diskB() <= MAX_RECORD_SIZE; }
+        // the diskB of a record of aKey and aVal, it needs no copy of them
+        static size_t disk_size(const K& aKey, const V& aVal, bool aExpires) noexcept { return aKey.size() + aVal.size() + sizeof(uint64_t) * (aExpires ? 2 : 1); }
 
     public:
         void        to_disk(byte* aMem) const noexcept
@@ -185,15 +315,56 @@ class key_val_t final
             assert((aMem + key().size()) == lMem);
             lMem = val().to_disk(lMem);
             assert((aMem + key().size() + val().size()) == lMem);
+            const uint64_t lSeq = m_seq | (del() ? TOMBSTONE : 0) | (m_expiry ? EXPIRES : 0);
+            std::memcpy(lMem, &lSeq, sizeof(lSeq));
+            if(m_expiry)
+            {
+                std::memcpy(lMem + sizeof(lSeq), &m_expiry, sizeof(m_expiry));
+            }
         }
         void        to_disk(byte* aMem) noexcept
         {
             static_cast<const key_val_t&>(*this).to_disk(aMem);
         }
-        void        to_memory(byte* aMem) noexcept
+        void        to_memory(const byte* aMem) noexcept
         {
-            byte* lMem = key_val().first.to_memory(aMem);
+            const byte* lMem = key_val().first.to_memory(aMem);
             lMem = key_val().second.to_memory(lMem);
+            std::memcpy(&m_seq, lMem, sizeof(m_seq));
+            m_mod_type = (m_seq & TOMBSTONE) ? MOD::kDELETE : MOD::kINSERT;
+            m_expiry = 0;
+            if(m_seq & EXPIRES)
+            {
+                std::memcpy(&m_expiry, lMem + sizeof(m_seq), sizeof(m_expiry));
+            }
+            m_seq &= ~FLAGS;
+        }
+        // checks the key of a disk record before anything gets decoded
+        static bool key_matches(const byte* aMem, const K& aKey) noexcept { return aKey.matches(aMem); }
+        // the sequence number stored behind the key and the value of a disk record
+        static uint64_t seq_of(const byte* aMem) noexcept
+        {
+            uint64_t lSeq;
+            std::memcpy(&lSeq, V::skip(K::skip(aMem)), sizeof(lSeq));
+            return lSeq & ~FLAGS;
+        }
+        static bool tombstone(const byte* aMem) noexcept
+        {
+            uint64_t lSeq;
+            std::memcpy(&lSeq, V::skip(K::skip(aMem)), sizeof(lSeq));
+            return lSeq & TOMBSTONE;
+        }
+        static uint64_t expiry_of(const byte* aMem) noexcept
+        {
+            const byte* lMem = V::skip(K::skip(aMem));
+            uint64_t lSeq;
+            std::memcpy(&lSeq, lMem, sizeof(lSeq));
+            uint64_t lExpiry = 0;
+            if(lSeq & EXPIRES)
+            {
+                std::memcpy(&lExpiry, lMem + sizeof(lSeq), sizeof(lExpiry));
+            }
+            return lExpiry;
         }
         std::string to_string() const noexcept { return key().to_string() + " @ " + val().to_string() + " @ " + to_string_mod(type()); }
         std::string to_string_f() const noexcept { return "<'" + key().to_string() + "', '" + val().to_string() + "'>"; }
@@ -205,11 +376,156 @@ class key_val_t final
     public:
         key_val_pt<K,V>     m_key_val;
         MOD                 m_mod_type;
+        uint64_t            m_seq;
+        uint64_t            m_expiry;
 };
 
 template<typename K, typename V>
 using key_val_vt = std::vector<key_val_t<K,V>>;
 
+// immutable, reference counted buffer entry. Readers keep it alive while the buffer moves on
+template<typename K, typename V>
+using key_val_spt = std::shared_ptr<const key_val_t<K,V>>;
+
+template<typename K, typename V>
+using key_val_spvt = std::vector<key_val_spt<K,V>>;
+
+/* A group of puts and deletes applied by KeyValueStore::write under a single lock, readers see
+ * either none or all of them. The records are built when they are added, applying the batch only
+ * numbers them and moves them into the input buffer. */
+template<typename K, typename V>
+class write_batch_t final
+{
+    public:
+        write_batch_t()                                 noexcept = default;
+        write_batch_t(const write_batch_t&)             = delete;
+        write_batch_t& operator=(const write_batch_t&)  = delete;
+        write_batch_t(write_batch_t&&)                  noexcept = default;
+        write_batch_t& operator=(write_batch_t&&)       noexcept = default;
+        ~write_batch_t()                                noexcept = default;
+
+    public:
+        void                put(const K& aKey, const V& aVal)                { add(std::make_shared<key_val_t<K,V>>(aKey, aVal, MOD::kINSERT)); }
+        void                del(const K& aKey)                               { add(std::make_shared<key_val_t<K,V>>(aKey, V(), MOD::kDELETE)); }
+        void                clear()                                 noexcept { m_entries.clear(); m_bytes = 0; m_fits_page = true; }
+        size_t              size()                            const noexcept { return m_entries.size(); }
+        bool                empty()                           const noexcept { return m_entries.empty(); }
+        // the space the records take in the input buffer
+        size_t              bytes()                           const noexcept { return m_bytes; }
+        // whether every record fits into a page, see key_val_t::fits_page
+        bool                fits_page()                       const noexcept { return m_fits_page; }
+        auto&               entries()                               noexcept { return m_entries; }
+
+    private:
+        void    add(std::shared_ptr<key_val_t<K,V>>&& aEntry)
+        {
+            m_bytes += aEntry->bytes();
+            m_fits_page = m_fits_page && aEntry->fits_page();
+            m_entries.emplace_back(std::move(aEntry));
+        }
+
+    private:
+        std::vector<std::shared_ptr<key_val_t<K,V>>>    m_entries;  // still writable, the sequence numbers are set last
+        size_t                                          m_bytes = 0;
+        bool                                            m_fits_page = true;
+};
+
+/* A consistent view of a shard: reads through it only see the writes numbered up to seq(). As long
+ * as a copy of it lives, flushes keep every version it sees. The default snapshot is the latest
+ * state and pins nothing, see WriteManager::snapshot for taking one. */
+class snapshot_t final
+{
+    public:
+        static constexpr uint64_t LATEST = std::numeric_limits<uint64_t>::max();
+
+    public:
+        snapshot_t()                                            noexcept : m_seq(LATEST), m_pin() {}
+        snapshot_t(uint64_t aSeq, std::shared_ptr<const void> aPin) noexcept : m_seq(aSeq), m_pin(std::move(aPin)) {}
+        snapshot_t(const snapshot_t&)                           noexcept = default;
+        snapshot_t& operator=(const snapshot_t&)                noexcept = default;
+        snapshot_t(snapshot_t&&)                                noexcept = default;
+        snapshot_t& operator=(snapshot_t&&)                     noexcept = default;
+        ~snapshot_t()                                           noexcept = default;
+
+    public:
+        uint64_t    seq()                               const noexcept { return m_seq; }
+        bool        sees(uint64_t aSeq)                 const noexcept { return aSeq <= m_seq; }
+
+    private:
+        uint64_t                    m_seq;
+        std::shared_ptr<const void> m_pin;  // unregisters the snapshot once the last copy is gone
+};
+
+/**
+ * @brief A read result that references the found record instead of copying it. Either keeps a
+ *        buffer entry alive or owns the page the record was read from (the page stays pinned
+ *        as long as the handle lives). key() and val() are views into that memory.
+ *        Empty handles tell apart deleted and absent keys through status().
+ */
+template<typename K, typename V>
+class read_handle_t final
+{
+    public:
+        using key_val_type = key_val_t<K,V>;
+
+    public:
+        read_handle_t()                                 noexcept
+            : m_status(FIND::kABSENT), m_entry(), m_page(), m_record(nullptr), m_key(), m_val()
+        {}
+        explicit read_handle_t(FIND aStatus)            noexcept
+            : m_status(aStatus), m_entry(), m_page(), m_record(nullptr), m_key(), m_val()
+        {
+            assert(aStatus != FIND::kFOUND);
+        }
+        explicit read_handle_t(key_val_spt<K,V> aEntry) noexcept
+            : m_status(FIND::kFOUND), m_entry(std::move(aEntry)), m_page(), m_record(nullptr)
+            , m_key(m_entry->key().view()), m_val(m_entry->val().view())
+        {}
+        // the page may be shared by the handles of several records on it (see multi_get)
+        read_handle_t(std::shared_ptr<byte[]> aPage, const byte* aRecord) noexcept
+            : m_status(FIND::kFOUND), m_entry(), m_page(std::move(aPage)), m_record(aRecord)
+            , m_key(K::view(aRecord)), m_val(V::view(K::skip(aRecord)))
+        {}
+        read_handle_t(const read_handle_t&)             = delete;
+        read_handle_t& operator=(const read_handle_t&)  = delete;
+        read_handle_t(read_handle_t&&)                  noexcept = default;
+        read_handle_t& operator=(read_handle_t&&)       noexcept = default;
+        ~read_handle_t()                                noexcept = default;
+
+    public:
+        explicit operator bool()  const noexcept { return found(); }
+        FIND            status()  const noexcept { return m_status; }
+        bool            found()   const noexcept { return status() == FIND::kFOUND; }
+        bool            deleted() const noexcept { return status() == FIND::kDELETED; }
+        bool            absent()  const noexcept { return status() == FIND::kABSENT; }
+        bool            expired() const noexcept { return status() == FIND::kEXPIRED; }
+        std::string_view key()    const noexcept { return m_key; }
+        std::string_view val()    const noexcept { return m_val; }
+        // the version of a found key
+        uint64_t        seq()     const noexcept { return m_entry ? m_entry->seq() : key_val_type::seq_of(m_record); }
+        // the expiry time of a found key, 0 if it does not expire
+        uint64_t        expiry()  const noexcept { return m_entry ? m_entry->expiry() : key_val_type::expiry_of(m_record); }
+        // materializes the record, only needed by callers that want an owning copy
+        key_val_type    to_key_val() const noexcept
+        {
+            if(m_entry)
+            {
+                return *m_entry;
+            }
+            key_val_type kv;
+            kv.to_memory(m_record);
+            return kv;
+        }
+
+    private:
+        FIND                    m_status;
+        key_val_spt<K,V>        m_entry;
+        std::shared_ptr<byte[]> m_page;
+        const byte*             m_record;
+        std::string_view        m_key;
+        std::string_view        m_val;
+};
+
 class TID final
 {
     public:
@@ -240,44 +556,196 @@ constexpr auto underlying_type(E enumerator) noexcept
     return static_cast<std::underlying_type_t<E>>(enumerator);
 }
 
-inline bool valid_request(const string_vt& args) noexcept
+// commands of the text protocol
+enum class CMD : int8_t
 {
-    bool valid = false;
-    if(args.at(0) == "GET" || args.at(0) == "DEL")
+    kINVALID = -1,
+    kGET = 0,
+    kPUT = 1,
+    kDEL = 2,
+    kFLUSH = 3,
+    kMGET = 4,
+    kMSET = 5,
+    kPING = 6,
+    kCLEAR = 7, // removes all keys
+    kBATCH = 8, // applies several PUT and DEL at once
+    kINCRBY = 9,
+    kAPPEND = 10,
+    kCAS = 11,  // PUT if the key is still at the given version
+    kGETIF = 12, // GET unless the key is still at the given version
+    kPUTEX = 13, // PUT with a time to live in seconds
+    kEXPIRE = 14 // sets the time to live of an existing key
+};
+
+inline std::string to_string_cmd(CMD aCmd) noexcept
+{
+    std::string result;
+    switch(aCmd)
     {
-        valid = args.size() >= 2;
+        case CMD::kINVALID: result = "INVALID"; break;
+        case CMD::kGET: result = "GET"; break;
+        case CMD::kPUT: result = "PUT"; break;
+        case CMD::kDEL: result = "DEL"; break;
+        case CMD::kFLUSH: result = "FLUSH"; break;
+        case CMD::kMGET: result = "MGET"; break;
+        case CMD::kMSET: result = "MSET"; break;
+        case CMD::kPING: result = "PING"; break;
+        case CMD::kCLEAR: result = "CLEAR"; break;
+        case CMD::kBATCH: result = "BATCH"; break;
+        case CMD::kINCRBY: result = "INCRBY"; break;
+        case CMD::kAPPEND: result = "APPEND"; break;
+        case CMD::kCAS: result = "CAS"; break;
+        case CMD::kGETIF: result = "GETIF"; break;
+        case CMD::kPUTEX: result = "PUTEX"; break;
+        case CMD::kEXPIRE: result = "EXPIRE"; break;
+        default: result = "DEFAULT/ERROR";
     }
-    else if(args.at(0) == "PUT")
+    return result;
+}
+
+// maps a command token to its command, the length and first letter select the only candidate
+inline CMD to_cmd(std::string_view aToken) noexcept
+{
+    CMD result = CMD::kINVALID;
+    switch(aToken.size())
     {
-        valid = args.size() >= 3;
+        case 3:
+            switch(aToken[0])
+            {
+                case 'G': result = aToken == "GET" ? CMD::kGET : CMD::kINVALID; break;
+                case 'P': result = aToken == "PUT" ? CMD::kPUT : CMD::kINVALID; break;
+                case 'D': result = aToken == "DEL" ? CMD::kDEL : CMD::kINVALID; break;
+                case 'C': result = aToken == "CAS" ? CMD::kCAS : CMD::kINVALID; break;
+                default: result = CMD::kINVALID;
+            }
+            break;
+        case 4: result = aToken == "MGET" ? CMD::kMGET : CMD::kINVALID; break;
+        case 5:
+            switch(aToken[0])
+            {
+                case 'F': result = aToken == "FLUSH" ? CMD::kFLUSH : CMD::kINVALID; break;
+                case 'B': result = aToken == "BATCH" ? CMD::kBATCH : CMD::kINVALID; break;
+                case 'G': result = aToken == "GETIF" ? CMD::kGETIF : CMD::kINVALID; break;
+                case 'P': result = aToken == "PUTEX" ? CMD::kPUTEX : CMD::kINVALID; break;
+                default: result = CMD::kINVALID;
+            }
+            break;
+        case 6:
+            switch(aToken[0])
+            {
+                case 'I': result = aToken == "INCRBY" ? CMD::kINCRBY : CMD::kINVALID; break;
+                case 'A': result = aToken == "APPEND" ? CMD::kAPPEND : CMD::kINVALID; break;
+                case 'E': result = aToken == "EXPIRE" ? CMD::kEXPIRE : CMD::kINVALID; break;
+                default: result = CMD::kINVALID;
+            }
+            break;
+        default: result = CMD::kINVALID;
     }
-    else if(args.at(0) == "FLUSH")
+    return result;
+}
+
+// wire protocols, chosen per connection by its first byte
+enum class PROTOCOL : int8_t
+{
+    kUNKNOWN = -1,
+    kTEXT = 0,
+    kBINARY = 1,
+    kRESP = 2   // Redis serialization protocol (version 2)
+};
+
+inline std::string to_string_protocol(PROTOCOL aProtocol) noexcept
+{
+    std::string result;
+    switch(aProtocol)
     {
-        valid = true;
+        case PROTOCOL::kUNKNOWN: result = "UNKNOWN"; break;
+        case PROTOCOL::kTEXT: result = "TEXT"; break;
+        case PROTOCOL::kBINARY: result = "BINARY"; break;
+        case PROTOCOL::kRESP: result = "RESP"; break;
+        default: result = "DEFAULT/ERROR";
     }
-    return valid;
+    return result;
 }
 
-using answer_t = std::pair<std::string, std::string>;
+/* A parsed request. The arguments (including the command) are views into the parsed line or
+ * frame, which needs to outlive the request. Reusing the request object for every request keeps
+ * the capacity of the argument vector, so parsing does not allocate once it has grown. */
+struct request_t final
+{
+    CMD                             m_cmd = CMD::kINVALID;
+    PROTOCOL                        m_protocol = PROTOCOL::kTEXT;
+    uint32_t                        m_id = 0;   // echoed in the answer (binary protocol)
+    bool                            m_unordered = false; // the answer may overtake earlier ones (binary protocol)
+    std::vector<std::string_view>   m_args;
+
+    std::string_view    arg(size_t aIndex)  const noexcept { return m_args[aIndex]; }
+    size_t              size()              const noexcept { return m_args.size(); }
+};
 
-class sync_t final
+// trims the line and splits it at every single space
+inline void parse_request(std::string_view aLine, request_t& aRequest) noexcept
 {
-    public:
-        sync_t()                            noexcept = default;
-        sync_t(const sync_t&)               noexcept = delete;
-        sync_t& operator==(const sync_t&)   noexcept = delete;
-        sync_t(sync_t&&)                    noexcept = delete;
-        sync_t& operator==(sync_t&&)        noexcept = delete;
-        ~sync_t()                           noexcept = default;
+    const auto lSpace = [](char c){ return std::isspace(static_cast<unsigned char>(c)) != 0; };
+    while(!aLine.empty() && lSpace(aLine.front()))
+    {
+        aLine.remove_prefix(1);
+    }
+    while(!aLine.empty() && lSpace(aLine.back()))
+    {
+        aLine.remove_suffix(1);
+    }
+    aRequest.m_args.clear();
+    size_t lPos = 0;
+    size_t lEnd;
+    while((lEnd = aLine.find(' ', lPos)) != std::string_view::npos)
+    {
+        aRequest.m_args.push_back(aLine.substr(lPos, lEnd - lPos));
+        lPos = lEnd + 1;
+    }
+    aRequest.m_args.push_back(aLine.substr(lPos));
+    aRequest.m_cmd = to_cmd(aRequest.arg(0));
+    aRequest.m_protocol = PROTOCOL::kTEXT;
+    aRequest.m_id = 0;
+    aRequest.m_unordered = false;
+}
 
-    public:
-        auto& cv()                noexcept { return m_cv; }
-        void  set()               noexcept { return m_flag.store(true); }
-        void  clear()             noexcept { return m_flag.store(false); }
-        bool  operator()()  const noexcept { return m_flag.load(); }
+inline bool valid_request(const request_t& aRequest) noexcept
+{
+    bool valid = false;
+    switch(aRequest.m_cmd)
+    {
+        case CMD::kGET:
+        case CMD::kDEL: valid = aRequest.size() >= 2; break;
+        case CMD::kPUT: valid = aRequest.size() >= 3; break;
+        case CMD::kFLUSH: valid = true; break;
+        case CMD::kMGET: valid = aRequest.size() >= 2; break;
+        case CMD::kMSET: valid = aRequest.size() >= 3 && aRequest.size() % 2 == 1; break;
+        case CMD::kPING: valid = aRequest.size() <= 2; break;
+        case CMD::kCLEAR: valid = true; break;
+        case CMD::kBATCH: valid = aRequest.size() >= 3; break;
+        case CMD::kINCRBY:
+        case CMD::kAPPEND:
+        case CMD::kGETIF:
+        case CMD::kEXPIRE: valid = aRequest.size() == 3; break;
+        case CMD::kCAS:
+        case CMD::kPUTEX: valid = aRequest.size() == 4; break;
+        case CMD::kINVALID:
+        default: valid = false;
+    }
+    return valid;
+}
 
-    private:
-        std::condition_variable m_cv{};
-        std::atomic_bool        m_flag{true};
-};
+using answer_t = std::pair<std::string, std::string>;
 
+// answer for an unsuccessful lookup, built without going through an exception
+inline answer_t miss_answer(FIND aStatus) noexcept
+{
+    switch(aStatus)
+    {
+        case FIND::kDELETED: return std::make_pair("ERROR", "Requested key is deleted.");
+        case FIND::kEXPIRED: return std::make_pair("ERROR", "Requested key has expired.");
+        case FIND::kABSENT:
+        case FIND::kFOUND:
+        default: return std::make_pair("ERROR", "Requested key was not found.");
+    }
+}
@@ -0,0 +1,70 @@
+/**
+ *  @file    varint.hh
+ *  @author  Nick Weber
+ *  @brief   LEB128 style variable length encoding of unsigned integers
+ *  @bugs    Currently no bugs known
+ *  @todos   -
+ *
+ *  @section DESCRIPTION
+ *      Every byte carries 7 bits of payload, the most significant bit signals that another byte follows.
+ *      Used as length prefix of the on-disk record format (see string_t::to_disk).
+ */
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+namespace VarInt
+{
+    // the maximal number of bytes needed to encode a 64 bit value
+    constexpr std::size_t MAX_BYTES = 10;
+
+    /**
+     * @brief  Number of bytes needed to encode aValue
+     */
+    inline std::size_t size(std::uint64_t aValue) noexcept
+    {
+        std::size_t lBytes = 1;
+        while(aValue >= 0x80)
+        {
+            aValue >>= 7;
+            ++lBytes;
+        }
+        return lBytes;
+    }
+
+    /**
+     * @brief  Encode aValue at aMem
+     * @return pointer behind the last written byte
+     */
+    inline std::byte* encode(std::byte* aMem, std::uint64_t aValue) noexcept
+    {
+        while(aValue >= 0x80)
+        {
+            *aMem++ = static_cast<std::byte>((aValue & 0x7F) | 0x80);
+            aValue >>= 7;
+        }
+        *aMem++ = static_cast<std::byte>(aValue);
+        return aMem;
+    }
+
+    /**
+     * @brief  Decode the value stored at aMem into aValue
+     * @return pointer behind the last read byte
+     */
+    inline const std::byte* decode(const std::byte* aMem, std::uint64_t& aValue) noexcept
+    {
+        std::uint64_t lResult = 0;
+        unsigned lShift = 0;
+        std::uint64_t lByte;
+        do
+        {
+            lByte = std::to_integer<std::uint64_t>(*aMem++);
+            lResult |= (lByte & 0x7F) << lShift;
+            lShift += 7;
+        }
+        while((lByte & 0x80) && lShift < 7 * MAX_BYTES);
+        aValue = lResult;
+        return aMem;
+    }
+}
@@ -3,12 +3,16 @@
 #include "types.hh"
 #include "exception.hh"
 #include "storage_manager.hh"
+#include "rw_mutex.hh"
 
 #include <vector>
 #include <utility>
 #include <algorithm>
+#include <iterator>
 #include <shared_mutex>
+#include <set>
 #include <thread>
+#include <chrono>
 #include <iostream>
 
 template<typename K, typename V>
@@ -18,9 +22,11 @@ class WriteManager final
         using key_type = K;
         using value_type = V;
         using key_val_type = key_val_t<key_type, value_type>;
+        using read_handle_type = read_handle_t<key_type, value_type>;
 
     private:
-        WriteManager()                                                                    noexcept;
+        WriteManager()                                                                    noexcept = delete;
+        explicit WriteManager(size_t aShard)                                              noexcept;
         WriteManager(const WriteManager&)                                                 noexcept = delete;
         WriteManager& operator=(const WriteManager&)                                      noexcept = delete;
         WriteManager(WriteManager&&)                                                      noexcept = delete;
@@ -28,96 +34,323 @@ class WriteManager final
 
     public:
         ~WriteManager()                                                                   noexcept;
-        static WriteManager& get_instance()                                               noexcept
+        static WriteManager& get_instance(size_t aShard = 0)                              noexcept
         {
-            static WriteManager lInstance;
-            return lInstance;
+            //every shard of the keyspace has its own instance, shard 0 is the default one
+            assert(aShard < MAX_SHARDS);
+            //the storage managers are created before, so they are destroyed after the flushers writing to them
+            StorageManager<K,V>::get_instance(aShard);
+            static std::unique_ptr<WriteManager> lInstances[MAX_SHARDS];
+            static std::once_flag lCreated[MAX_SHARDS];
+            std::call_once(lCreated[aShard], [aShard](){ lInstances[aShard].reset(new WriteManager(aShard)); });
+            return *lInstances[aShard];
         }
         void init(const CB& aCB)                                                          noexcept;
 
     public:
+        // a view on the writes made so far, it does not block anything
+        snapshot_t      snapshot()                                                        noexcept;
         key_val_type    get(const key_type& aKey);
+        read_handle_type read(const key_type& aKey);
+        // a key with merge operands on top of its newest value is reported absent, see below
+        read_handle_type find(const key_type& aKey)                                      noexcept;
+        // collects the merge operands on top of the newest value in aOperands, newest first, and
+        // returns that value. Absent means that the value they apply to needs to come from disk
+        read_handle_type find(const key_type& aKey, key_val_spvt<K,V>& aOperands)        noexcept;
+        // find on the writes the snapshot sees, the buffers being flushed included. aOnDisk receives
+        // the view for the following read of the disk: it leaves out the writes that were in the
+        // buffers, as they may reach the disk meanwhile. If the disk is to be read, the view is
+        // registered like a snapshot, so the versions it sees are not purged before
+        read_handle_type find(const key_type& aKey, key_val_spvt<K,V>& aOperands,
+                            const snapshot_t& aSnapshot, snapshot_t& aOnDisk)              noexcept;
+        // find for all keys under one lock, the results are appended to aHandles and aOperands
+        void            find(const std::vector<key_type>& aKeys, std::vector<read_handle_type>& aHandles,
+                            std::vector<key_val_spvt<K,V>>& aOperands, const snapshot_t& aSnapshot,
+                            snapshot_t& aOnDisk)                                           noexcept;
         void            put(const key_val_pt<K,V>& aKeyValue, MOD aModType)               noexcept;
-        void            put(const key_type& aKey, const value_type& aVal, MOD aModType)   noexcept;
-        void            del(const key_type& aKey, const value_type& aVal)                 noexcept;
-        void            flush()                                                           noexcept;
+        // aExpiry is the time the value expires at (see now_ms), 0 if it never does
+        void            put(const key_type& aKey, const value_type& aVal, MOD aModType, uint64_t aExpiry = 0) noexcept;
+        // writes a tombstone, returns whether the key had a live value before
+        bool            del(const key_type& aKey);
+        // moves the records of the batch into the input buffer under a single lock
+        void            write(write_batch_t<K,V>& aBatch)                                 noexcept;
+        // stores the value only if the current version of the key is aVersion, 0 stands for a key
+        // without value. aResult receives the new version on success, the current one otherwise
+        bool            put_if(const key_type& aKey, const value_type& aVal, uint64_t aVersion, uint64_t& aResult, uint64_t aExpiry = 0);
+        // deletes those of the keys whose value has expired, returns how many were deleted
+        size_t          del_expired(const std::vector<key_type>& aKeys);
+        // hands the input buffer to the flusher thread, its records are found in the flush buffers
+        // until they are on disk. With aWait it returns once they are on disk and a purge of the
+        // versions they replaced ran
+        void            flush(bool aWait = false)                                         noexcept;
+        // drops the buffered records and clears the storage manager
+        void            clear()                                                           noexcept;
 
     private:
-        void            flush_no_lock()                                                   noexcept;
+        using input_lock_type = std::unique_lock<rw_mutex_t>;
+        // aLock holds the input lock, it is released while the flusher is MAX_FLUSH_BUFFERS behind
+        void            flush_no_lock(input_lock_type& aLock)                             noexcept;
+        // the flusher thread, it writes the flush buffers oldest first and purges the storage manager
+        // once none is waiting
+        void            flusher()                                                         noexcept;
+        // wakes the flusher, the first call starts it
+        void            notify_flusher_no_lock()                                          noexcept;
+        read_handle_type find_no_lock(const key_type& aKey, key_val_spvt<K,V>& aOperands, const snapshot_t& aSnapshot) noexcept;
+        // the part of aSnapshot older than the first record in the buffers
+        snapshot_t      on_disk_no_lock(const snapshot_t& aSnapshot)                const noexcept;
+        // a snapshot of aSeq that is live until its last copy is gone
+        snapshot_t      registered(uint64_t aSeq)                                         noexcept;
+        // numbers the entry and appends it, new snapshots see it once m_visible is updated
+        void            append_no_lock(std::shared_ptr<key_val_type>&& aEntry)            noexcept;
         auto&           input_mtx()                                                 const noexcept { return m_input_mtx; }
-        auto&           flush_mtx()                                                       noexcept { return m_flush_mtx; }
-        sync_t&         sync()                                                            noexcept { return m_sync; }
         const CB&       cb()                                                        const noexcept { return *m_cb; }
         size_t&         get_buf_size()                                                    noexcept { return m_buffer_size; }
         auto&           get_ibuf()                                                        noexcept { return m_input_buffer; }
-        auto&           get_fbuf()                                                        noexcept { return m_flush_buffer; }
+        auto&           get_fbufs()                                                       noexcept { return m_flush_buffers; }
+        auto&           get_storage_mngr()                                                noexcept { return m_storage_mngr; }
 
     private:
-        mutable std::shared_mutex m_input_mtx;
-        std::mutex      m_flush_mtx;
-        sync_t          m_sync;
+        static constexpr size_t MAX_FLUSH_BUFFERS = 2;  // the writers wait for the disk beyond it
+        static constexpr size_t PURGE_BATCH = 1024;     // records a purge takes before the flusher looks at the buffers again
+        static constexpr auto   PURGE_RETRY = std::chrono::seconds(1);  // the pending purges are retried after it, the snapshots they wait for may be gone
+
+    private:
+        mutable rw_mutex_t m_input_mtx;  // the writers are not starved by a steady stream of readers
         const CB*       m_cb;
         size_t          m_buffer_size;
-        key_val_vt<K,V> m_input_buffer;
-        key_val_vt<K,V> m_flush_buffer;
+        uint64_t        m_sequence;     // of the last write, only changed under the input lock
+        std::atomic<uint64_t> m_visible; // of the last write in the input buffer, the sequence of new snapshots
+        uint64_t        m_flushes;      // moves of records from memory to disk, only changed under the input lock
+        std::thread     m_flusher;      // started by the first flush
+        bool            m_stop;         // the flusher exits once the flush buffers are written, under the input lock
+        bool            m_purge_due;    // the flusher purges once the flush buffers are written, under the input lock
+        bool            m_purging;      // under the input lock
+        uint64_t        m_purges;       // the purges the flusher completed, under the input lock
+        std::condition_variable_any m_queued;   // a flush buffer was added, a purge is due or the flusher is to stop
+        std::condition_variable_any m_flushed;  // a flush buffer was written or a purge completed
+        std::mutex      m_snapshot_mtx;
+        std::multiset<uint64_t> m_snapshots; // the sequences of the live snapshots
+        key_val_spvt<K,V> m_input_buffer;
+        // immutable buffers being written to disk, oldest first. Readers search them after the input buffer
+        std::vector<std::shared_ptr<const key_val_spvt<K,V>>> m_flush_buffers;
+        StorageManager<K,V>& m_storage_mngr;   // of the same shard
 
 };
 
 template<typename K, typename V>
-WriteManager<K,V>::WriteManager() noexcept
+WriteManager<K,V>::WriteManager(size_t aShard) noexcept
     : m_input_mtx()
-    , m_flush_mtx()
-    , m_sync()
     , m_cb(nullptr)
     , m_buffer_size(0)
+    , m_sequence(0)
+    , m_visible(0)
+    , m_flushes(0)
+    , m_flusher()
+    , m_stop(false)
+    , m_purge_due(false)
+    , m_purging(false)
+    , m_purges(0)
+    , m_queued()
+    , m_flushed()
+    , m_snapshot_mtx()
+    , m_snapshots()
     , m_input_buffer()
-    , m_flush_buffer()
+    , m_flush_buffers()
+    , m_storage_mngr(StorageManager<K,V>::get_instance(aShard))
 {
-    TRACE("WriteManager constructed");
+    TRACE_INFO("WriteManager constructed");
 }
 
 template<typename K, typename V>
-WriteManager<K,V>::~WriteManager() noexcept = default;
+WriteManager<K,V>::~WriteManager() noexcept
+{
+    //the flusher writes the buffers it was handed before it exits
+    {
+        std::lock_guard lock(input_mtx());
+        m_stop = true;
+    }
+    m_queued.notify_all();
+    if(m_flusher.joinable())
+    {
+        m_flusher.join();
+    }
+}
 
 template<typename K, typename V>
 void WriteManager<K,V>::init(const CB& aCB) noexcept
 {
     if(!m_cb)
     {
-        TRACE("WriteManager initialized");
+        TRACE_INFO("WriteManager initialized");
         m_cb = &aCB;
     }
 }
 
+template<typename K, typename V>
+snapshot_t WriteManager<K,V>::snapshot() noexcept
+{
+    return registered(m_visible.load(std::memory_order_acquire));
+}
+
+template<typename K, typename V>
+snapshot_t WriteManager<K,V>::registered(uint64_t aSeq) noexcept
+{
+    //registered under the same lock the flushes and purges read the live snapshots with. A snapshot
+    //taken after a flush started sees every record of the flushed buffer
+    std::lock_guard lock(m_snapshot_mtx);
+    const auto it = m_snapshots.insert(aSeq);
+    return snapshot_t(*it, std::shared_ptr<const void>(nullptr, [this, it](const void*)
+    {
+        std::lock_guard lLock(m_snapshot_mtx);
+        m_snapshots.erase(it);
+    }));
+}
+
 template<typename K, typename V>
 typename WriteManager<K,V>::key_val_type WriteManager<K,V>::get(const key_type& aKey)
+{
+    return read(aKey).to_key_val();
+}
+
+template<typename K, typename V>
+typename WriteManager<K,V>::read_handle_type WriteManager<K,V>::read(const key_type& aKey)
+{
+    read_handle_type handle = find(aKey);
+    if(handle.deleted())
+    {
+        throw KeyIsDeletedInWriteManagerException(FLF);
+    }
+    else if(!handle)
+    {
+        throw KeyNotInWriteManagerException(FLF);
+    }
+    return handle;
+}
+
+template<typename K, typename V>
+typename WriteManager<K,V>::read_handle_type WriteManager<K,V>::find(const key_type& aKey) noexcept
+{
+    key_val_spvt<K,V> operands;
+    read_handle_type handle = find(aKey, operands);
+    return operands.empty() ? std::move(handle) : read_handle_type(FIND::kABSENT);
+}
+
+template<typename K, typename V>
+typename WriteManager<K,V>::read_handle_type WriteManager<K,V>::find(const key_type& aKey, key_val_spvt<K,V>& aOperands) noexcept
+{
+    std::shared_lock lock(input_mtx());
+    return find_no_lock(aKey, aOperands, snapshot_t());
+}
+
+template<typename K, typename V>
+typename WriteManager<K,V>::read_handle_type WriteManager<K,V>::find(const key_type& aKey, key_val_spvt<K,V>& aOperands,
+                            const snapshot_t& aSnapshot, snapshot_t& aOnDisk) noexcept
 {
     std::shared_lock lock(input_mtx());
+    read_handle_type handle = find_no_lock(aKey, aOperands, aSnapshot);
+    aOnDisk = on_disk_no_lock(aSnapshot);
+    if(handle.absent())
+    {
+        //the flusher reads the live snapshots under the exclusive input lock before it purges
+        aOnDisk = registered(aOnDisk.seq());
+    }
+    return handle;
+}
+
+template<typename K, typename V>
+void WriteManager<K,V>::find(const std::vector<key_type>& aKeys, std::vector<read_handle_type>& aHandles,
+                            std::vector<key_val_spvt<K,V>>& aOperands, const snapshot_t& aSnapshot,
+                            snapshot_t& aOnDisk) noexcept
+{
+    //a single lock shows the keys in the same state, a batch is seen completely or not at all
+    std::shared_lock lock(input_mtx());
+    bool disk = false;
+    for(const auto& key : aKeys)
+    {
+        aOperands.emplace_back();
+        aHandles.push_back(find_no_lock(key, aOperands.back(), aSnapshot));
+        disk = disk || aHandles.back().absent();
+    }
+    aOnDisk = on_disk_no_lock(aSnapshot);
+    if(disk)
+    {
+        aOnDisk = registered(aOnDisk.seq());
+    }
+}
+
+template<typename K, typename V>
+typename WriteManager<K,V>::read_handle_type WriteManager<K,V>::find_no_lock(const key_type& aKey, key_val_spvt<K,V>& aOperands, const snapshot_t& aSnapshot) noexcept
+{
     TRACE("Search for key: '" + aKey.to_string() + "' in WriteManager");
-    for(auto it = get_ibuf().rbegin(); it != get_ibuf().rend(); ++it) 
+    for(size_t i = 0; i <= get_fbufs().size(); ++i)
     {
-        //TRACE("Current: '" + it->to_string() + "'");
-        if(it->key() == aKey)
+        //the input buffer holds the newest records, then come the buffers being flushed
+        const key_val_spvt<K,V>& buffer = i == 0 ? get_ibuf() : *get_fbufs()[get_fbufs().size() - i];
+        for(auto it = buffer.rbegin(); it != buffer.rend(); ++it)
         {
-            TRACE("Current has same key as searched one.");
-            if(it->ins())
-            {
-                TRACE("Found Valid Key.");
-                return *it;
-            }
-            else if(it->del())
-            {
-                throw KeyIsDeletedInWriteManagerException(FLF);
-            }
-            else if(!it->valid())
+            const key_val_type& kv = **it;
+            if(kv.key() == aKey && aSnapshot.sees(kv.seq()))
             {
-                TRACE("Found Invalid Key.");
-                break;
+                TRACE("Current has same key as searched one.");
+                if(kv.ins() && kv.expired(now_ms()))
+                {
+                    TRACE("Found Expired Key.");
+                    return read_handle_type(FIND::kEXPIRED);
+                }
+                else if(kv.ins())
+                {
+                    TRACE("Found Valid Key.");
+                    //shares the entry, the value is not copied
+                    return read_handle_type(*it);
+                }
+                else if(kv.del())
+                {
+                    TRACE("Found Deleted Key.");
+                    return read_handle_type(FIND::kDELETED);
+                }
+                else if(kv.merge())
+                {
+                    TRACE("Found Merge Operand.");
+                    aOperands.push_back(*it);
+                }
+                else if(!kv.valid())
+                {
+                    TRACE("Found Invalid Key.");
+                    return read_handle_type(FIND::kABSENT);
+                }
             }
         }
     }
     TRACE("Key not found in WriteManager");
-    throw KeyNotInWriteManagerException(FLF);
+    return read_handle_type(FIND::kABSENT);
+}
+
+template<typename K, typename V>
+snapshot_t WriteManager<K,V>::on_disk_no_lock(const snapshot_t& aSnapshot) const noexcept
+{
+    //the buffers hold every write from their first record on, the disk only older ones or copies
+    uint64_t first = m_sequence + 1;
+    for(const auto& buffer : m_flush_buffers)
+    {
+        if(!buffer->empty())
+        {
+            first = buffer->front()->seq();
+            break;
+        }
+    }
+    if(first > m_sequence && !m_input_buffer.empty())
+    {
+        first = m_input_buffer.front()->seq();
+    }
+    return snapshot_t(std::min(aSnapshot.seq(), first - 1), nullptr);
+}
+
+template<typename K, typename V>
+void WriteManager<K,V>::append_no_lock(std::shared_ptr<key_val_type>&& aEntry) noexcept
+{
+    aEntry->seq(++m_sequence);
+    get_buf_size() += aEntry->bytes();
+    get_ibuf().emplace_back(std::move(aEntry));
 }
         
 template<typename K, typename V>
@@ -127,53 +360,305 @@ void WriteManager<K,V>::put(const key_val_pt<K,V>& aKeyValue, MOD aModType) noex
 }
 
 template<typename K, typename V>
-void WriteManager<K,V>::put(const key_type& aKey, const value_type& aVal, MOD aModType) noexcept
+void WriteManager<K,V>::put(const key_type& aKey, const value_type& aVal, MOD aModType, uint64_t aExpiry) noexcept
 {
-    key_val_type data(aKey, aVal, aModType);
-    std::lock_guard lock(input_mtx());
-    TRACE("Add KV-pair to the input buffer: '" + data.to_string() + "'");
-    TRACE("Curr buffer size=" + std::to_string(get_buf_size()) + ", KV-pair size=" + std::to_string(data.bytes()) + " @@ Allowed size=" + std::to_string(cb().buffer_size()));
-    if(get_buf_size() + data.bytes()  >= cb().buffer_size())
+    std::shared_ptr<key_val_type> data = std::make_shared<key_val_type>(aKey, aVal, aModType, 0, aExpiry);
+    input_lock_type lock(input_mtx());
+    TRACE("Add KV-pair to the input buffer: '" + data->to_string() + "'");
+    TRACE("Curr buffer size=" + std::to_string(get_buf_size()) + ", KV-pair size=" + std::to_string(data->bytes()) + " @@ Allowed size=" + std::to_string(cb().buffer_size()));
+    if(get_buf_size() + data->bytes()  >= cb().buffer_size())
     {
         //need to write to disk before inserting to buffer
-        TRACE("Input buffer full. Need to flush data to disk.");
-        flush_no_lock();
-        TRACE("Flusher thread started working. Continue adding KV-pair...");
+        TRACE_INFO("Input buffer full. Need to flush data to disk.");
+        flush_no_lock(lock);
+        TRACE("Flusher thread took the buffer. Continue adding KV-pair...");
+    }
+    append_no_lock(std::move(data));
+    m_visible.store(m_sequence, std::memory_order_release);
+    TRACE("Add successful");
+}
+
+template<typename K, typename V>
+bool WriteManager<K,V>::del(const key_type& aKey)
+{
+    std::shared_ptr<key_val_type> data = std::make_shared<key_val_type>(aKey, V(), MOD::kDELETE);
+    while(true)
+    {
+        //like put_if: the disk is read without blocking the writers, a flush meanwhile forces a retry
+        uint64_t flushes;
+        {
+            std::shared_lock lock(input_mtx());
+            flushes = m_flushes;
+        }
+        const read_handle_type stored = get_storage_mngr().find(aKey);
+
+        input_lock_type lock(input_mtx());
+        if(flushes != m_flushes)
+        {
+            TRACE("Records were flushed while reading the key, retry");
+            continue;
+        }
+        if(!get_ibuf().empty() && get_buf_size() + data->bytes() >= cb().buffer_size())
+        {
+            //the flush may release the lock, the key is read again afterwards
+            flush_no_lock(lock);
+            continue;
+        }
+        //operands give a key without value one
+        key_val_spvt<K,V> operands;
+        const read_handle_type handle = find_no_lock(aKey, operands, snapshot_t());
+        const read_handle_type& newest = handle.absent() ? stored : handle;
+        const bool live = !operands.empty() || newest.found();
+        append_no_lock(std::move(data));
+        m_visible.store(m_sequence, std::memory_order_release);
+        return live;
+    }
+}
+
+template<typename K, typename V>
+void WriteManager<K,V>::write(write_batch_t<K,V>& aBatch) noexcept
+{
+    input_lock_type lock(input_mtx());
+    TRACE("Add batch of " + std::to_string(aBatch.size()) + " KV-pairs to the input buffer");
+    if(get_buf_size() + aBatch.bytes() >= cb().buffer_size())
+    {
+        //the whole batch goes into one buffer, so it is flushed together as well
+        TRACE_INFO("Input buffer full. Need to flush data to disk.");
+        flush_no_lock(lock);
     }
-    get_buf_size() += data.bytes();
-    get_ibuf().emplace_back(std::move(data));
+    for(auto& entry : aBatch.entries())
+    {
+        append_no_lock(std::move(entry));
+    }
+    //a snapshot sees the whole batch or nothing of it
+    m_visible.store(m_sequence, std::memory_order_release);
+    aBatch.clear();
     TRACE("Add successful");
 }
 
 template<typename K, typename V>
-void WriteManager<K,V>::del(const key_type& aKey, const value_type& aVal) noexcept
+void WriteManager<K,V>::flush(bool aWait) noexcept
 {
-    put(aKey, aVal, MOD::kDELETE);
+    input_lock_type lock(input_mtx());
+    flush_no_lock(lock);
+    if(aWait)
+    {
+        //the flusher writes all flush buffers before it purges, so the next purge it starts follows
+        //the buffer. One running now may have started before
+        const uint64_t purges = m_purges + (m_purging ? 2 : 1);
+        m_purge_due = true;
+        notify_flusher_no_lock();
+        m_flushed.wait(lock, [this, purges](){ return m_purges >= purges; });
+    }
 }
 
 template<typename K, typename V>
-void WriteManager<K,V>::flush() noexcept
+void WriteManager<K,V>::flush_no_lock(input_lock_type& aLock) noexcept
 {
-    std::lock_guard lock(input_mtx());
-    flush_no_lock();
+    //readers find the records in the flush buffers until they are on disk. The writers only wait
+    //for the disk if the flusher falls behind, the input lock is released meanwhile
+    if(get_fbufs().size() >= MAX_FLUSH_BUFFERS)
+    {
+        TRACE("Wait until the flusher wrote a buffer...");
+        m_flushed.wait(aLock, [this](){ return get_fbufs().size() < MAX_FLUSH_BUFFERS; });
+    }
+    if(get_ibuf().empty())
+    {
+        return;
+    }
+    ++m_flushes;
+    TRACE("Move the input buffer to the flush buffers and set buffer size back to 0");
+    get_fbufs().push_back(std::make_shared<const key_val_spvt<K,V>>(std::move(get_ibuf())));
+    get_ibuf().clear();
+    get_buf_size() = 0;
+    notify_flusher_no_lock();
 }
 
 template<typename K, typename V>
-void WriteManager<K,V>::flush_no_lock() noexcept
+void WriteManager<K,V>::notify_flusher_no_lock() noexcept
 {
-    TRACE("Acquire flush mutex...");
-    std::unique_lock flush_lock(flush_mtx());
-    if(!sync()())
+    if(!m_flusher.joinable())
     {
-        TRACE("Need to wait until flush copy finishes...");
-        sync().cv().wait(flush_lock, [this](){ return sync()(); });
-        TRACE("Notified: Continue flushing...");
+        TRACE("Start the flusher thread...");
+        m_flusher = std::thread(&WriteManager::flusher, this);
+    }
+    m_queued.notify_one();
+}
+
+template<typename K, typename V>
+void WriteManager<K,V>::flusher() noexcept
+{
+    //flushes are written in the order they were made, so a record on disk is never older than one
+    //of its key in the buffers
+    input_lock_type lock(input_mtx());
+    bool pending = false;
+    while(true)
+    {
+        const auto due = [this](){ return m_stop || m_purge_due || !get_fbufs().empty(); };
+        if(!pending)
+        {
+            m_queued.wait(lock, due);
+        }
+        else if(!m_queued.wait_for(lock, PURGE_RETRY, due))
+        {
+            m_purge_due = true;
+        }
+        if(get_fbufs().empty())
+        {
+            if(m_stop)
+            {
+                return;
+            }
+            //the purge runs in batches between the flushes, without blocking the readers and writers
+            m_purge_due = false;
+            m_purging = true;
+            std::vector<uint64_t> snapshots;
+            {
+                //the views of the reads in progress are among them, a later read does not see the
+                //versions the written buffers replaced
+                std::lock_guard snapshot_lock(m_snapshot_mtx);
+                snapshots.assign(m_snapshots.begin(), m_snapshots.end());
+            }
+            lock.unlock();
+            const bool more = get_storage_mngr().purge(PURGE_BATCH, snapshots) == PURGE_BATCH;
+            pending = get_storage_mngr().pending_purges() != 0;
+            lock.lock();
+            m_purge_due = m_purge_due || more;
+            m_purging = false;
+            ++m_purges;
+            m_flushed.notify_all();
+            continue;
+        }
+        const auto buffer = get_fbufs().front();
+        std::vector<uint64_t> snapshots;
+        {
+            //a snapshot taken later sees every record of the buffer
+            std::lock_guard snapshot_lock(m_snapshot_mtx);
+            snapshots.assign(m_snapshots.begin(), m_snapshots.end());
+        }
+        lock.unlock();
+        get_storage_mngr().write_to_disk(*buffer, snapshots);
+        lock.lock();
+        //clear may have dropped the buffer meanwhile
+        if(!get_fbufs().empty() && get_fbufs().front() == buffer)
+        {
+            get_fbufs().erase(get_fbufs().begin());
+        }
+        ++m_flushes;
+        //the versions the records replaced are purged once no buffer waits any more
+        m_purge_due = true;
+        m_flushed.notify_all();
     }
-    sync().clear();
-    TRACE("Swap flush buffer with input buffer and set buffer size back to 0");
-    std::swap(get_ibuf(), get_fbuf());
+}
+
+template<typename K, typename V>
+void WriteManager<K,V>::clear() noexcept
+{
+    //the storage manager waits for a running flush, so its records are dropped as well
+    std::lock_guard lock(input_mtx());
+    TRACE_INFO("Clear input buffer and storage manager");
+    get_ibuf().clear();
+    get_fbufs().clear();
     get_buf_size() = 0;
+    ++m_flushes;
+    get_storage_mngr().clear();
+    m_flushed.notify_all();
+}
+
+template<typename K, typename V>
+bool WriteManager<K,V>::put_if(const key_type& aKey, const value_type& aVal, uint64_t aVersion, uint64_t& aResult, uint64_t aExpiry)
+{
+    std::shared_ptr<key_val_type> data = std::make_shared<key_val_type>(aKey, aVal, MOD::kINSERT, 0, aExpiry);
+    while(true)
+    {
+        //the version on disk is read without blocking the writers. It is still the current one
+        //if no flush moved records to disk meanwhile and the key is not in the buffers
+        uint64_t flushes;
+        {
+            std::shared_lock lock(input_mtx());
+            flushes = m_flushes;
+        }
+        const read_handle_type stored = get_storage_mngr().find(aKey);
+
+        input_lock_type lock(input_mtx());
+        if(flushes != m_flushes)
+        {
+            TRACE("Records were flushed while reading the version, retry");
+            continue;
+        }
+        if(!get_ibuf().empty() && get_buf_size() + data->bytes() >= cb().buffer_size())
+        {
+            //the flush may release the lock, the version is read again afterwards
+            flush_no_lock(lock);
+            continue;
+        }
+        key_val_spvt<K,V> operands;
+        const read_handle_type handle = find_no_lock(aKey, operands, snapshot_t());
+        const read_handle_type& newest = handle.absent() ? stored : handle;
+        aResult = !operands.empty() ? operands.front()->seq() : (newest.found() ? newest.seq() : 0);
+        if(aResult != aVersion)
+        {
+            TRACE("Version mismatch of key '" + aKey.to_string() + "'");
+            return false;
+        }
+        append_no_lock(std::move(data));
+        m_visible.store(m_sequence, std::memory_order_release);
+        aResult = m_sequence;
+        return true;
+    }
+}
+
+template<typename K, typename V>
+size_t WriteManager<K,V>::del_expired(const std::vector<key_type>& aKeys)
+{
+    while(true)
+    {
+        //like put_if: the disk is read without blocking the writers, a flush meanwhile forces a retry
+        uint64_t flushes;
+        {
+            std::shared_lock lock(input_mtx());
+            flushes = m_flushes;
+        }
+        std::vector<read_handle_type> stored;
+        for(const auto& key : aKeys)
+        {
+            stored.push_back(get_storage_mngr().find(key));
+        }
 
-    TRACE("Spawn flusher thread to write flush buffer to disk...");
-    std::thread(&StorageManager<K,V>::write_to_disk, &StorageManager<K,V>::get_instance(), std::ref(get_fbuf()), std::ref(sync())).detach();
+        input_lock_type lock(input_mtx());
+        if(flushes != m_flushes)
+        {
+            TRACE("Records were flushed while reading the expired keys, retry");
+            continue;
+        }
+        std::vector<std::shared_ptr<key_val_type>> deletes;
+        size_t bytes = 0;
+        for(size_t i = 0; i < aKeys.size(); ++i)
+        {
+            //a key written again since it expired keeps its new value, operands give it a new one
+            key_val_spvt<K,V> operands;
+            const read_handle_type handle = find_no_lock(aKeys[i], operands, snapshot_t());
+            const read_handle_type& newest = handle.absent() ? stored[i] : handle;
+            if(!operands.empty() || !newest.expired())
+            {
+                continue;
+            }
+            deletes.push_back(std::make_shared<key_val_type>(aKeys[i], V(), MOD::kDELETE));
+            bytes += deletes.back()->bytes();
+        }
+        if(!get_ibuf().empty() && get_buf_size() + bytes >= cb().buffer_size())
+        {
+            //like a batch the deletes go into one buffer. The flush may release the lock, the keys
+            //are looked at again afterwards
+            flush_no_lock(lock);
+            continue;
+        }
+        for(auto& data : deletes)
+        {
+            append_no_lock(std::move(data));
+        }
+        m_visible.store(m_sequence, std::memory_order_release);
+        TRACE("Deleted " + std::to_string(deletes.size()) + " expired keys");
+        return deletes.size();
+    }
 }
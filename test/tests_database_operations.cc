@@ -1,11 +1,13 @@
 #include <catch2/catch.hpp>
 
 #include "../src/database.hh"
+#include "../src/protocol.hh"
 
 #include <thread>
 #include <string>
 #include <vector>
 #include <iostream>
+#include <fstream>
 
 using key_type = string_t;
 using value_type = string_t;
@@ -92,7 +94,7 @@ void del(KeyValueStore<key_type, value_type>& aKVS, uint aThreadNo)
 
 TEST_CASE( "database I/O tests", "[logic]" ) {
 
-    const CB lCB(false, "", 10000, 8080u);
+    static const CB lCB(false, "", 10000, 8080u);
     Trace::get_instance().init(lCB);
 
     auto& kv_store = KeyValueStore<key_type, value_type>::get_instance();
@@ -167,3 +169,830 @@ TEST_CASE( "database I/O tests", "[logic]" ) {
     }
 }
 
+
+TEST_CASE( "request parsing", "[logic]" ) {
+
+    request_t request;
+
+    parse_request("  PUT PARSE_Key PARSE_Value \r\n", request);
+    REQUIRE(request.m_cmd == CMD::kPUT);
+    REQUIRE(request.size() == 3);
+    REQUIRE(request.arg(1) == "PARSE_Key");
+    REQUIRE(request.arg(2) == "PARSE_Value");
+    REQUIRE(valid_request(request));
+
+    auto& kv_store = KeyValueStore<key_type, value_type>::get_instance();
+    REQUIRE(kv_store.request_handler(request).second == "Successful Insert");
+
+    parse_request("GET PARSE_Key", request);
+    REQUIRE(request.m_cmd == CMD::kGET);
+    REQUIRE(kv_store.request_handler(request).second == "<'PARSE_Key', 'PARSE_Value'>");
+
+    parse_request("GETS PARSE_Key", request);
+    REQUIRE(request.m_cmd == CMD::kINVALID);
+    REQUIRE(!valid_request(request));
+
+    parse_request("DEL", request);
+    REQUIRE(request.m_cmd == CMD::kDEL);
+    REQUIRE(!valid_request(request));
+
+    //empty and blank lines leave a single empty token
+    for(const char* line : {"", "\n", " \t\r\n"})
+    {
+        parse_request(line, request);
+        REQUIRE(request.size() == 1);
+        REQUIRE(request.arg(0).empty());
+        REQUIRE(request.m_cmd == CMD::kINVALID);
+        REQUIRE(!valid_request(request));
+    }
+
+    //every single space separates, so repeated spaces give empty arguments
+    parse_request("GET  PARSE_Key", request);
+    REQUIRE(request.m_cmd == CMD::kGET);
+    REQUIRE(request.size() == 3);
+    REQUIRE(request.arg(1).empty());
+    REQUIRE(request.arg(2) == "PARSE_Key");
+
+    //other whitespace inside the line does not separate
+    parse_request("GET\tPARSE_Key", request);
+    REQUIRE(request.size() == 1);
+    REQUIRE(request.m_cmd == CMD::kINVALID);
+
+    //commands are case sensitive and need their exact length
+    for(const char* line : {"get PARSE_Key", "GE PARSE_Key", "FLUSHX", "FLUSS", "PUX PARSE_Key 1"})
+    {
+        parse_request(line, request);
+        REQUIRE(request.m_cmd == CMD::kINVALID);
+        REQUIRE(!valid_request(request));
+    }
+    parse_request("FLUSH", request);
+    REQUIRE(request.m_cmd == CMD::kFLUSH);
+    REQUIRE(valid_request(request));
+    parse_request("PUT PARSE_Key", request);
+    REQUIRE(request.m_cmd == CMD::kPUT);
+    REQUIRE(!valid_request(request));
+
+    //the arguments view the parsed line
+    const std::string line = "PUT PARSE_Key PARSE_Value";
+    parse_request(line, request);
+    REQUIRE(request.arg(1).data() == line.data() + 4);
+}
+
+TEST_CASE( "wire protocols", "[logic]" ) {
+
+    static const CB lCB(false, "", 10000, 8080u);
+    auto& kv_store = KeyValueStore<key_type, value_type>::get_instance(8);
+    kv_store.init(lCB);
+    request_t request;
+    std::string answer;
+    Protocol::string_sink_t sink{answer};
+    bool error;
+
+    //binary frames: the size is known after the header, a partial frame waits for the rest
+    auto frame = [](uint8_t aOpcode, uint32_t aId, const std::string& aKey, const std::string& aVal)
+    {
+        std::string result(Binary::HEADER_SIZE, '\0');
+        Binary::encode({Binary::REQUEST_MAGIC, aOpcode, 0, 0, static_cast<uint32_t>(aKey.size()), static_cast<uint32_t>(aVal.size()), aId}, result.data());
+        return result + aKey + aVal;
+    };
+    const auto opcode = [](CMD aCmd){ return static_cast<uint8_t>(aCmd); };
+    const std::string put = frame(opcode(CMD::kPUT), 7, "Wire_Key", std::string("Wire\0Value", 10));
+    REQUIRE(Binary::frame_size(std::string_view(put).substr(0, Binary::HEADER_SIZE - 1), error) == 0);
+    REQUIRE(!error);
+    REQUIRE(Binary::frame_size(std::string_view(put).substr(0, Binary::HEADER_SIZE + 3), error) == put.size());
+    REQUIRE(!error);
+    std::string bad_magic = put;
+    bad_magic[0] = 'P';
+    REQUIRE(Binary::frame_size(bad_magic, error) == 0);
+    REQUIRE(error);
+    std::string oversize(Binary::HEADER_SIZE, '\0');
+    Binary::encode({Binary::REQUEST_MAGIC, opcode(CMD::kPUT), 0, 0, 1, static_cast<uint32_t>(Binary::MAX_FRAME_SIZE), 1}, oversize.data());
+    REQUIRE(Binary::frame_size(oversize, error) == 0);
+    REQUIRE(error);
+
+    Binary::parse_request(put, request);
+    REQUIRE(request.m_cmd == CMD::kPUT);
+    REQUIRE(request.m_protocol == PROTOCOL::kBINARY);
+    REQUIRE(request.m_id == 7);
+    REQUIRE(request.arg(1) == "Wire_Key");
+    REQUIRE(request.arg(2) == std::string_view("Wire\0Value", 10));
+    Protocol::execute(sink, kv_store, request);
+    REQUIRE(answer.size() == Binary::HEADER_SIZE);
+    Binary::header_t header = Binary::decode(answer.data());
+    REQUIRE(header.m_magic == Binary::RESPONSE_MAGIC);
+    REQUIRE(header.m_status == static_cast<uint8_t>(Binary::STATUS::kOK));
+    REQUIRE(header.m_request_id == 7);
+
+    //the value follows the header of a GET answer
+    const std::string get = frame(opcode(CMD::kGET), 8, "Wire_Key", "");
+    Binary::parse_request(get, request);
+    answer.clear();
+    Protocol::execute(sink, kv_store, request);
+    header = Binary::decode(answer.data());
+    REQUIRE(header.m_status == static_cast<uint8_t>(Binary::STATUS::kOK));
+    REQUIRE(header.m_request_id == 8);
+    REQUIRE(header.m_val_length == 10);
+    REQUIRE(answer.substr(Binary::HEADER_SIZE) == std::string("Wire\0Value", 10));
+
+    const std::string missing = frame(opcode(CMD::kGET), 9, "Wire_Missing", "");
+    Binary::parse_request(missing, request);
+    answer.clear();
+    Protocol::execute(sink, kv_store, request);
+    REQUIRE(Binary::decode(answer.data()).m_status == static_cast<uint8_t>(Binary::STATUS::kNOT_FOUND));
+
+    const std::string del = frame(opcode(CMD::kDEL), 10, "Wire_Key", "");
+    Binary::parse_request(del, request);
+    answer.clear();
+    Protocol::execute(sink, kv_store, request);
+    REQUIRE(Binary::decode(answer.data()).m_status == static_cast<uint8_t>(Binary::STATUS::kOK));
+    Binary::parse_request(get, request);
+    answer.clear();
+    Protocol::execute(sink, kv_store, request);
+    REQUIRE(Binary::decode(answer.data()).m_status == static_cast<uint8_t>(Binary::STATUS::kDELETED));
+
+    //a CAS without the version is invalid
+    const std::string cas = frame(opcode(CMD::kCAS), 11, "Wire_Key", "1234");
+    Binary::parse_request(cas, request);
+    answer.clear();
+    Protocol::execute(sink, kv_store, request);
+    header = Binary::decode(answer.data());
+    REQUIRE(header.m_status == static_cast<uint8_t>(Binary::STATUS::kERROR));
+    REQUIRE(answer.substr(Binary::HEADER_SIZE) == "INVALID REQUEST");
+
+    //an unknown opcode is invalid, the error carries its message
+    const std::string unknown = frame(0x7F, 12, "Wire_Key", "");
+    Binary::parse_request(unknown, request);
+    REQUIRE(request.m_cmd == CMD::kINVALID);
+    answer.clear();
+    Protocol::execute(sink, kv_store, request);
+    header = Binary::decode(answer.data());
+    REQUIRE(header.m_status == static_cast<uint8_t>(Binary::STATUS::kERROR));
+    REQUIRE(header.m_request_id == 12);
+    REQUIRE(answer.substr(Binary::HEADER_SIZE) == "INVALID REQUEST");
+
+    //RESP: bulk strings may hold any byte, a request is parsed once it is complete
+    const std::string set = "*3\r\n$3\r\nSET\r\n$8\r\nWire_Key\r\n$5\r\nv\r\nxy\r\n";
+    for(size_t i = 0; i < set.size(); ++i)
+    {
+        REQUIRE(Resp::parse_request(set.substr(0, i), request, error) == 0);
+        REQUIRE(!error);
+    }
+    const std::string pipelined = set + "*1\r\n";
+    REQUIRE(Resp::parse_request(pipelined, request, error) == set.size());
+    REQUIRE(request.m_cmd == CMD::kPUT);
+    REQUIRE(request.m_protocol == PROTOCOL::kRESP);
+    REQUIRE(request.arg(2) == "v\r\nxy");
+
+    auto resp = [&](const std::string& aRaw)
+    {
+        REQUIRE(Resp::parse_request(aRaw, request, error) == aRaw.size());
+        answer.clear();
+        Protocol::execute(sink, kv_store, request);
+        return answer;
+    };
+    REQUIRE(resp(set) == "+OK\r\n");
+    REQUIRE(resp("*2\r\n$3\r\nget\r\n$8\r\nWire_Key\r\n") == "$5\r\nv\r\nxy\r\n");
+    REQUIRE(resp("*3\r\n$4\r\nMGET\r\n$8\r\nWire_Key\r\n$12\r\nWire_Missing\r\n") == "*2\r\n$5\r\nv\r\nxy\r\n$-1\r\n");
+    REQUIRE(resp("*3\r\n$3\r\nDEL\r\n$8\r\nWire_Key\r\n$12\r\nWire_Missing\r\n") == ":1\r\n");
+    REQUIRE(resp("*2\r\n$3\r\nGET\r\n$8\r\nWire_Key\r\n") == "$-1\r\n");
+    REQUIRE(resp("*1\r\n$4\r\nPING\r\n") == "+PONG\r\n");
+    REQUIRE(resp("*2\r\n$4\r\nPING\r\n$2\r\nhi\r\n") == "$2\r\nhi\r\n");
+
+    //errors are answered, the connection stays usable
+    REQUIRE(resp("*1\r\n$4\r\nGETS\r\n") == "-ERR unknown command\r\n");
+    REQUIRE(resp("*1\r\n$3\r\nGET\r\n") == "-ERR wrong number of arguments\r\n");
+    REQUIRE(resp("*5\r\n$3\r\nSET\r\n$1\r\nk\r\n$1\r\nv\r\n$2\r\nEX\r\n$2\r\n10\r\n") == "-ERR syntax error\r\n");
+    REQUIRE(resp("*3\r\n$3\r\nCAS\r\n$8\r\nWire_Key\r\n$1\r\nv\r\n") == "-ERR wrong number of arguments\r\n");
+
+    //malformed requests close the connection
+    for(const std::string& raw : std::vector<std::string>{"*0\r\n", "$3\r\nGET\r\n", "*1\r\n$3\r\nGETX\r\n", "*1\r\n$x\r\n", "*1\r\n$99999999999\r\n", "*" + std::string(40, '1')})
+    {
+        REQUIRE(Resp::parse_request(raw, request, error) == 0);
+        REQUIRE(error);
+    }
+}
+
+
+TEST_CASE( "multi get", "[logic]" ) {
+
+    auto& kv_store = KeyValueStore<key_type, value_type>::get_instance();
+    const std::string TEST_PREFIX = "MGET_";
+    for(size_t i = 0; i < 50; ++i)
+    {
+        kv_store.put(key_type(TEST_PREFIX + "Disk" + std::to_string(i)), value_type(TEST_PREFIX + "Value" + std::to_string(i)));
+    }
+    kv_store.flush();
+    kv_store.put(key_type(TEST_PREFIX + "Memory"), value_type(TEST_PREFIX + "MemoryValue"));
+    kv_store.del(key_type(TEST_PREFIX + "Disk7"));
+
+    std::vector<key_type> keys;
+    for(size_t i = 0; i < 50; ++i)
+    {
+        keys.emplace_back(TEST_PREFIX + "Disk" + std::to_string(i));
+    }
+    keys.emplace_back(TEST_PREFIX + "Memory");
+    keys.emplace_back(TEST_PREFIX + "Missing");
+
+    auto handles = kv_store.multi_get(keys);
+    REQUIRE(handles.size() == keys.size());
+    for(size_t i = 0; i < 50; ++i)
+    {
+        if(i == 7)
+        {
+            REQUIRE(handles[i].deleted());
+            continue;
+        }
+        REQUIRE(handles[i].found());
+        REQUIRE(handles[i].val() == TEST_PREFIX + "Value" + std::to_string(i));
+    }
+    REQUIRE(handles[50].val() == TEST_PREFIX + "MemoryValue");
+    REQUIRE(handles[51].absent());
+}
+
+
+TEST_CASE( "write batch", "[logic]" ) {
+
+    auto& kv_store = KeyValueStore<key_type, value_type>::get_instance();
+    const std::string TEST_PREFIX = "BATCH_";
+    kv_store.put(key_type(TEST_PREFIX + "Old"), value_type(TEST_PREFIX + "OldValue"));
+
+    write_batch_t<key_type, value_type> batch;
+    for(size_t i = 0; i < 1000; ++i)
+    {
+        batch.put(key_type(TEST_PREFIX + "Key" + std::to_string(i)), value_type(TEST_PREFIX + "Value" + std::to_string(i)));
+    }
+    batch.del(key_type(TEST_PREFIX + "Old"));
+    REQUIRE(batch.size() == 1001);
+    kv_store.write(batch);
+    REQUIRE(batch.empty());
+
+    REQUIRE(kv_store.find(key_type(TEST_PREFIX + "Old")).deleted());
+    for(size_t i = 0; i < 1000; i += 111)
+    {
+        REQUIRE(kv_store.find(key_type(TEST_PREFIX + "Key" + std::to_string(i))).val() == TEST_PREFIX + "Value" + std::to_string(i));
+    }
+
+    request_t request;
+    parse_request("BATCH PUT BATCH_A 1 DEL BATCH_Key0", request);
+    REQUIRE(request.m_cmd == CMD::kBATCH);
+    REQUIRE(valid_request(request));
+    size_t operations = 0;
+    REQUIRE(Protocol::for_each_operation(request, [&](CMD, std::string_view, std::string_view){ ++operations; }));
+    REQUIRE(operations == 2);
+    parse_request("BATCH PUT BATCH_A", request);
+    REQUIRE(!Protocol::for_each_operation(request, [](CMD, std::string_view, std::string_view){}));
+}
+
+
+TEST_CASE( "merge operators", "[logic]" ) {
+
+    using merge_type = merge_operator_t<value_type>;
+    auto& kv_store = KeyValueStore<key_type, value_type>::get_instance();
+    const key_type counter("MERGE_Counter");
+    const key_type list("MERGE_List");
+
+    kv_store.merge(counter, merge_type::increment(5));
+    kv_store.merge(counter, merge_type::increment(-2));
+    REQUIRE(kv_store.find(counter).val() == "3");
+    //without a value in the memtable the operands may apply to one on disk
+    REQUIRE(kv_store.find_in_memory(counter).absent());
+
+    //operands on top of a value on disk are folded on read and at the next flush
+    kv_store.flush();
+    kv_store.merge(counter, merge_type::increment(10));
+    REQUIRE(kv_store.find(counter).val() == "13");
+    kv_store.flush();
+    REQUIRE(kv_store.find(counter).val() == "13");
+
+    //the value needs to stay in the memtable, no automatic flush may move it in between
+    kv_store.flush();
+    kv_store.put(list, value_type("a"));
+    kv_store.merge(list, merge_type::append(",b"));
+    kv_store.merge(list, merge_type::increment(1));
+    REQUIRE(kv_store.find_in_memory(list).val() == "a,b");
+    auto handles = kv_store.multi_get({counter, list});
+    REQUIRE(handles[0].val() == "13");
+    REQUIRE(handles[1].val() == "a,b");
+
+    request_t request;
+    parse_request("INCRBY MERGE_Counter x", request);
+    REQUIRE(kv_store.request_handler(request).first == "ERROR");
+    parse_request("INCRBY MERGE_Counter -20", request);
+    REQUIRE(kv_store.request_handler(request).second == "Successful Merge");
+    REQUIRE(kv_store.find(counter).val() == "-7");
+
+    //RESP answers the sum, a key without value counts as 0
+    bool error;
+    std::string answer;
+    Protocol::string_sink_t sink{answer};
+    auto resp = [&](const std::string& aKey, const std::string& aDelta)
+    {
+        const std::string raw = "*3\r\n$6\r\nINCRBY\r\n$" + std::to_string(aKey.size()) + "\r\n" + aKey + "\r\n$"
+                              + std::to_string(aDelta.size()) + "\r\n" + aDelta + "\r\n";
+        REQUIRE(Resp::parse_request(raw, request, error) == raw.size());
+        answer.clear();
+        Protocol::execute(sink, kv_store, request);
+        return answer;
+    };
+    REQUIRE(resp("MERGE_Counter", "9") == ":2\r\n");
+    REQUIRE(resp("MERGE_Counter", "-12") == ":-10\r\n");
+    REQUIRE(kv_store.find(counter).val() == "-10");
+    REQUIRE(resp("MERGE_Fresh", "4") == ":4\r\n");
+    REQUIRE(resp("MERGE_List", "1") == "-ERR value is not an integer or out of range\r\n");
+    REQUIRE(resp("MERGE_Counter", "x") == "-ERR value is not an integer or out of range\r\n");
+    REQUIRE(resp("MERGE_Counter", "-9223372036854775807") == "-ERR value is not an integer or out of range\r\n");
+    REQUIRE(kv_store.find(list).val() == "a,b");
+    REQUIRE(kv_store.find(counter).val() == "-10");
+}
+
+
+TEST_CASE( "compare and set", "[logic]" ) {
+
+    auto& kv_store = KeyValueStore<key_type, value_type>::get_instance();
+    const key_type key("CAS_Key");
+    uint64_t version;
+
+    //version 0 stands for a key without value
+    REQUIRE(kv_store.put_if(key, value_type("first"), 0, version));
+    const uint64_t first = version;
+    REQUIRE(kv_store.find(key).seq() == first);
+    REQUIRE(!kv_store.put_if(key, value_type("lost"), 0, version));
+    REQUIRE(version == first);
+
+    //the version is persisted with the record
+    kv_store.flush();
+    REQUIRE(kv_store.find(key).seq() == first);
+    REQUIRE(kv_store.put_if(key, value_type("second"), first, version));
+    REQUIRE(version > first);
+    REQUIRE(kv_store.find(key).val() == "second");
+    REQUIRE(!kv_store.put_if(key, value_type("lost"), first, version));
+    kv_store.flush();
+    REQUIRE(kv_store.find(key).val() == "second");
+    REQUIRE(kv_store.find(key).seq() == version);
+}
+
+TEST_CASE( "snapshot reads", "[logic]" ) {
+
+    auto& kv_store = KeyValueStore<key_type, value_type>::get_instance();
+    const key_type key("Snapshot_Key");
+    const key_type other("Snapshot_Other");
+    kv_store.put(key, value_type("old"));
+    kv_store.put(other, value_type("old"));
+    kv_store.flush();
+    kv_store.put(key, value_type("older"));
+    kv_store.put(key, value_type("before"));
+
+    {
+        const snapshot_t snapshot = kv_store.snapshot();
+        kv_store.put(key, value_type("after"));
+        kv_store.del(other);
+        REQUIRE(kv_store.find(key, snapshot).val() == "before");
+        REQUIRE(kv_store.find(other, snapshot).val() == "old");
+        REQUIRE(kv_store.find(key).val() == "after");
+        REQUIRE(kv_store.find(other).deleted());
+
+        //the flush keeps the versions the snapshot sees, the delete leaves a tombstone
+        kv_store.flush(true);
+        REQUIRE(kv_store.find(key, snapshot).val() == "before");
+        REQUIRE(kv_store.find(other, snapshot).val() == "old");
+        const auto handles = kv_store.multi_get({key, other}, snapshot);
+        REQUIRE(handles[0].val() == "before");
+        REQUIRE(handles[1].val() == "old");
+        REQUIRE(kv_store.find(key).val() == "after");
+        REQUIRE(!kv_store.find(other));
+    }
+
+    //without a snapshot only the newest version is written
+    kv_store.put(key, value_type("lost"));
+    kv_store.put(key, value_type("last"));
+    kv_store.del(other);
+    kv_store.flush(true);
+    REQUIRE(kv_store.find(key).val() == "last");
+    REQUIRE(!kv_store.find(other));
+}
+
+TEST_CASE( "key expiry", "[logic]" ) {
+
+    auto& kv_store = KeyValueStore<key_type, value_type>::get_instance();
+    const key_type gone("Expiry_Gone");
+    const key_type kept("Expiry_Kept");
+    const key_type swept("Expiry_Swept");
+    kv_store.put(gone, value_type("value"), now_ms() - 1);
+    kv_store.put(kept, value_type("value"), now_ms() + 60000);
+    REQUIRE(kv_store.find(gone).expired());
+    REQUIRE(kv_store.find(kept).val() == "value");
+    REQUIRE(kv_store.find(kept).expiry() > now_ms());
+    bool fits;
+    REQUIRE(!kv_store.expire(key_type("Expiry_Missing"), now_ms() + 60000, fits));
+    REQUIRE(fits);
+
+    //an expired value is not written to disk, the expiry time of the other one is
+    kv_store.flush(true);
+    REQUIRE(!kv_store.find(gone));
+    REQUIRE(kv_store.find(kept).expiry() > now_ms());
+    REQUIRE(kv_store.expire(kept, now_ms() - 1, fits));
+    const auto handles = kv_store.multi_get({gone, kept});
+    REQUIRE(!handles[0]);
+    REQUIRE(handles[1].expired());
+
+    //the sweeper deletes a key that expired on disk
+    const uint64_t expiry = now_ms() + 100;
+    kv_store.put(swept, value_type("value"), expiry);
+    kv_store.flush(true);
+    std::this_thread::sleep_until(std::chrono::system_clock::time_point(std::chrono::seconds((expiry + 999) / 1000 + 1)));
+    REQUIRE(kv_store.find(swept).expired());
+    REQUIRE(kv_store.sweep() > 0);
+    kv_store.flush(true);
+    REQUIRE(!kv_store.find(swept));
+}
+
+TEST_CASE( "cache mode", "[logic]" ) {
+
+    //the cache is shard 1, shard 0 stores its keys on disk
+    static const CB lCB(false, "", 10000, 8080u, 3, 0, false, 64 * 1024, EVICTION::kLRU);
+    auto& cache = KeyValueStore<key_type, value_type>::get_instance(1);
+    cache.init(lCB);
+    REQUIRE(cache.cache_mode());
+    REQUIRE(!std::ifstream("./part_1.dat").good());
+
+    const key_type hot("Cache_Hot");
+    cache.put(hot, value_type("1"));
+    cache.merge(hot, merge_operator_t<value_type>::increment(1));
+    uint64_t version;
+    REQUIRE(!cache.put_if(hot, value_type("x"), 0, version));
+    REQUIRE(cache.put_if(hot, value_type("3"), version, version));
+    REQUIRE(cache.find(hot).val() == "3");
+    REQUIRE(cache.find(hot).seq() == version);
+
+    //the recently used key survives while the others are evicted to stay within the budget
+    for(size_t i = 0; i < 2000; ++i)
+    {
+        cache.put(key_type("Cache_Key" + std::to_string(i)), value_type(std::string(100, 'v')));
+        REQUIRE(cache.find(hot));
+        REQUIRE(cache.used_memory() <= lCB.max_memory());
+    }
+    REQUIRE(cache.used_memory() > lCB.max_memory() / 2);
+    REQUIRE(cache.find(key_type("Cache_Key1999")));
+    REQUIRE(!cache.find(key_type("Cache_Key0")));
+
+    REQUIRE(cache.del(hot));
+    REQUIRE(!cache.del(hot));
+    cache.flush();
+    REQUIRE(cache.find(hot).absent());
+    cache.clear();
+    REQUIRE(cache.find(key_type("Cache_Key1999")).absent());
+}
+
+TEST_CASE( "row cache", "[logic]" ) {
+
+    //shard 2 caches the rows it reads from disk, the storage manager is asked directly since the
+    //write manager answers for keys it still buffers
+    static const CB lCB(false, "", 10000, 8080u, 3, 0, false, 0, EVICTION::kLRU, 64 * 1024);
+    auto& kv_store = KeyValueStore<key_type, value_type>::get_instance(2);
+    kv_store.init(lCB);
+    auto& storage = StorageManager<key_type, value_type>::get_instance(2);
+    REQUIRE(storage.rows().enabled());
+
+    const key_type hot("Row_Hot");
+    kv_store.put(hot, value_type("1"));
+    kv_store.flush(true);
+    REQUIRE(storage.find(hot).val() == "1");
+    uint64_t hits = storage.rows().hits();
+    REQUIRE(storage.find(hot).val() == "1");
+    REQUIRE(storage.rows().hits() == hits + 1);
+
+    //a flush of the key drops its row, an older snapshot does not use the newer row
+    const snapshot_t before = kv_store.snapshot();
+    kv_store.put(hot, value_type("2"));
+    kv_store.flush(true);
+    REQUIRE(storage.find(hot).val() == "2");
+    REQUIRE(storage.find(hot).val() == "2");
+    REQUIRE(kv_store.find(hot, before).val() == "1");
+
+    //a scan over cold keys does not evict the hot one
+    for(size_t i = 0; i < 2000; ++i)
+    {
+        kv_store.put(key_type("Row_Cold" + std::to_string(i)), value_type(std::string(100, 'v')));
+    }
+    kv_store.flush(true);
+    for(size_t i = 0; i < 10; ++i)
+    {
+        REQUIRE(storage.find(hot));
+    }
+    std::vector<key_type> cold;
+    std::vector<size_t> pending;
+    for(size_t i = 0; i < 2000; ++i)
+    {
+        cold.emplace_back("Row_Cold" + std::to_string(i));
+        pending.push_back(i);
+        REQUIRE(storage.find(cold.back()).val().size() == 100);
+    }
+    REQUIRE(storage.rows().used_memory() <= lCB.row_cache());
+    hits = storage.rows().hits();
+    REQUIRE(storage.find(hot).val() == "2");
+    REQUIRE(storage.rows().hits() == hits + 1);
+    std::vector<read_handle_t<key_type, value_type>> handles(cold.size());
+    storage.multi_find(cold, pending, handles);
+    for(const auto& handle : handles)
+    {
+        REQUIRE(handle.val().size() == 100);
+    }
+
+    kv_store.del(hot);
+    kv_store.flush(true);
+    REQUIRE(!storage.find(hot));
+    REQUIRE(!storage.find(hot));
+    kv_store.clear();
+    REQUIRE(storage.rows().size() == 0);
+}
+
+TEST_CASE( "coalesced disk reads", "[logic]" ) {
+
+    //shard 3 has no row cache, every lookup of the key needs its page
+    static const CB lCB(false, "", 10000, 8080u);
+    auto& kv_store = KeyValueStore<key_type, value_type>::get_instance(3);
+    kv_store.init(lCB);
+    auto& storage = StorageManager<key_type, value_type>::get_instance(3);
+    REQUIRE(!storage.rows().enabled());
+
+    const key_type hot("Flight_Hot");
+    kv_store.put(hot, value_type("hot"));
+    kv_store.flush(true);
+
+    //every lookup either reads the page or shares the read of another thread
+    constexpr size_t lookups = 500;
+    const uint64_t reads = storage.page_reads();
+    const uint64_t joined = storage.joined_reads();
+    std::vector<std::thread> threads;
+    std::atomic<size_t> found(0);
+    for(uint t = 0; t < std::max(no_threads, 4u); ++t)
+    {
+        threads.emplace_back([&](){
+            for(size_t i = 0; i < lookups; ++i)
+            {
+                const auto handle = storage.find(hot);
+                found += handle && handle.val() == "hot";
+            }
+        });
+    }
+    for(auto& thread : threads)
+    {
+        thread.join();
+    }
+    REQUIRE(found == threads.size() * lookups);
+    REQUIRE(storage.page_reads() - reads + storage.joined_reads() - joined == threads.size() * lookups);
+    kv_store.clear();
+}
+
+TEST_CASE( "deferred purge of deletes", "[logic]" ) {
+
+    static const CB lCB(false, "", 10000, 8080u);
+    auto& kv_store = KeyValueStore<key_type, value_type>::get_instance(4);
+    kv_store.init(lCB);
+    auto& storage = StorageManager<key_type, value_type>::get_instance(4);
+    const std::string TEST_PREFIX = "PURGE_";
+    for(size_t i = 0; i < 100; ++i)
+    {
+        kv_store.put(key_type(TEST_PREFIX + std::to_string(i)), value_type(std::to_string(i)));
+    }
+    kv_store.flush(true);
+
+    //the flush only writes tombstones, a key that never got to disk not even that. The flusher
+    //purges them with the versions they delete
+    for(size_t i = 0; i < 100; i += 2)
+    {
+        REQUIRE(kv_store.del(key_type(TEST_PREFIX + std::to_string(i))));
+    }
+    REQUIRE(!kv_store.del(key_type(TEST_PREFIX + "Missing")));
+    REQUIRE(!kv_store.del(key_type(TEST_PREFIX + "0")));
+    kv_store.flush(true);
+    REQUIRE(storage.pending_purges() == 0);
+    REQUIRE(storage.find(key_type(TEST_PREFIX + "0")).absent());
+    REQUIRE(storage.find(key_type(TEST_PREFIX + "Missing")).absent());
+    REQUIRE(storage.purge(1000, {}) == 0);
+
+    //a key written again after its delete keeps the new value
+    kv_store.put(key_type(TEST_PREFIX + "2"), value_type("again"));
+    kv_store.flush(true);
+    REQUIRE(storage.pending_purges() == 0);
+    for(size_t i = 0; i < 100; ++i)
+    {
+        const auto handle = storage.find(key_type(TEST_PREFIX + std::to_string(i)));
+        if(i == 2)
+        {
+            REQUIRE(handle.val() == "again");
+        }
+        else if(i % 2 == 0)
+        {
+            REQUIRE(handle.absent());
+        }
+        else
+        {
+            REQUIRE(handle.val() == std::to_string(i));
+        }
+    }
+
+    //the older versions a snapshot sees stay with the tombstone until it is released
+    {
+        const snapshot_t before = kv_store.snapshot();
+        kv_store.del(key_type(TEST_PREFIX + "1"));
+        kv_store.flush(true);
+        REQUIRE(storage.pending_purges() == 1);
+        REQUIRE(kv_store.find(key_type(TEST_PREFIX + "1"), before).val() == "1");
+        REQUIRE(kv_store.find(key_type(TEST_PREFIX + "1")).deleted());
+    }
+    kv_store.flush(true);
+    REQUIRE(storage.pending_purges() == 0);
+    REQUIRE(storage.find(key_type(TEST_PREFIX + "1")).absent());
+    kv_store.clear();
+}
+
+TEST_CASE( "one record per key", "[logic]" ) {
+
+    static const CB lCB(false, "", 10000, 8080u);
+    auto& kv_store = KeyValueStore<key_type, value_type>::get_instance(5);
+    kv_store.init(lCB);
+    auto& storage = StorageManager<key_type, value_type>::get_instance(5);
+    const key_type key("Replace_Key");
+
+    //every flush writes a new version, the ones it replaced are purged
+    for(size_t i = 0; i < 5; ++i)
+    {
+        kv_store.put(key, value_type(std::string(i * 10 + 1, 'v')));
+        kv_store.flush(true);
+    }
+    REQUIRE(storage.pending_purges() == 0);
+    const uint64_t reads = storage.page_reads();
+    REQUIRE(storage.find(key).val().size() == 41);
+    REQUIRE(storage.page_reads() == reads + 1);
+
+    //a snapshot keeps the version it sees, the purge waits until it is released
+    {
+        const snapshot_t before = kv_store.snapshot();
+        kv_store.put(key, value_type("new"));
+        kv_store.flush(true);
+        REQUIRE(storage.pending_purges() == 1);
+        REQUIRE(kv_store.find(key, before).val().size() == 41);
+    }
+    kv_store.put(key, value_type("newer"));
+    kv_store.flush(true);
+    REQUIRE(storage.pending_purges() == 0);
+    REQUIRE(storage.find(key).val() == "newer");
+
+    //a purged delete leaves nothing of the key on disk
+    kv_store.del(key);
+    kv_store.flush(true);
+    REQUIRE(storage.find(key).absent());
+    kv_store.clear();
+}
+
+TEST_CASE( "reads during a purge", "[logic]" ) {
+
+    static const CB lCB(false, "", 10000, 8080u);
+    auto& kv_store = KeyValueStore<key_type, value_type>::get_instance(9);
+    kv_store.init(lCB);
+    auto& storage = StorageManager<key_type, value_type>::get_instance(9);
+    constexpr size_t KEYS = 200;
+    constexpr size_t ROUNDS = 20;
+    auto key = [](size_t i){ return key_type("PurgeRead_" + std::to_string(i)); };
+    for(size_t i = 0; i < KEYS; ++i)
+    {
+        kv_store.put(key(i), value_type("v0"));
+    }
+    kv_store.flush(true);
+
+    //every flush replaces all keys, the flusher purges the older versions while the keys are read
+    std::atomic<bool> stop(false);
+    std::atomic<size_t> reads(0);
+    std::atomic<size_t> wrong(0);
+    std::vector<std::thread> readers;
+    for(uint t = 0; t < std::max(no_threads, 4u); ++t)
+    {
+        readers.emplace_back([&, t](){
+            for(size_t i = t; !stop; i = (i + 7) % KEYS)
+            {
+                const auto handle = kv_store.find(key(i));
+                wrong += !handle || handle.val().substr(0, 1) != "v";
+                ++reads;
+            }
+        });
+    }
+    for(size_t round = 1; round <= ROUNDS; ++round)
+    {
+        for(size_t i = 0; i < KEYS; ++i)
+        {
+            kv_store.put(key(i), value_type("v" + std::to_string(round)));
+        }
+        kv_store.flush(true);
+    }
+    stop = true;
+    for(auto& thread : readers)
+    {
+        thread.join();
+    }
+    REQUIRE(reads > 0);
+    REQUIRE(wrong == 0);
+    //the purges the reads in progress held back run once no read sees the older versions
+    kv_store.flush(true);
+    REQUIRE(storage.pending_purges() == 0);
+    for(size_t i = 0; i < KEYS; ++i)
+    {
+        REQUIRE(storage.find(key(i)).val() == "v" + std::to_string(ROUNDS));
+    }
+    kv_store.clear();
+}
+
+TEST_CASE( "index entries skip page reads", "[logic]" ) {
+
+    static const CB lCB(false, "", 10000, 8080u);
+    auto& kv_store = KeyValueStore<key_type, value_type>::get_instance(6);
+    kv_store.init(lCB);
+    auto& storage = StorageManager<key_type, value_type>::get_instance(6);
+    const key_type key("Index_Key");
+
+    //the snapshot keeps both versions on disk, each one on the page of its flush
+    kv_store.put(key, value_type("old"));
+    kv_store.flush(true);
+    const snapshot_t before = kv_store.snapshot();
+    kv_store.put(key, value_type("new"));
+    kv_store.flush(true);
+
+    //the version the snapshot does not see is skipped by its index entry, only one page is read
+    uint64_t reads = storage.page_reads();
+    REQUIRE(storage.find(key, before).val() == "old");
+    REQUIRE(storage.page_reads() == reads + 1);
+    reads = storage.page_reads();
+    REQUIRE(storage.find(key).val() == "new");
+    REQUIRE(storage.page_reads() == reads + 1);
+
+    std::vector<key_type> keys{key, key_type("Index_Missing")};
+    std::vector<size_t> pending{0, 1};
+    std::vector<read_handle_t<key_type, value_type>> handles(keys.size());
+    reads = storage.page_reads();
+    storage.multi_find(keys, pending, handles, before);
+    REQUIRE(handles[0].val() == "old");
+    REQUIRE(handles[1].absent());
+    REQUIRE(storage.page_reads() == reads + 1);
+    kv_store.clear();
+}
+
+
+TEST_CASE( "records larger than a page", "[logic]" ) {
+
+    static const CB lCB(false, "", 10000, 8080u);
+    auto& kv_store = KeyValueStore<key_type, value_type>::get_instance(7);
+    kv_store.init(lCB);
+    const key_type key("Big_Key");
+
+    //the key takes 8 bytes on disk, the value 2 more than its characters and the version 8
+    const std::string largest(MAX_RECORD_SIZE - 18, 'x');
+    REQUIRE(kv_store.put(key, value_type(largest)));
+    REQUIRE(!kv_store.put(key, value_type(largest + "x")));
+    REQUIRE(!kv_store.put(key, value_type(largest), now_ms() + 60000));
+    write_batch_t<key_type, value_type> batch;
+    batch.put(key_type("Big_Other"), value_type("small"));
+    batch.put(key, value_type(largest + "x"));
+    REQUIRE(!kv_store.write(batch));
+    REQUIRE(kv_store.find(key_type("Big_Other")).absent());
+
+    //an append that would grow the value beyond a page leaves it unchanged, in memory and on disk
+    REQUIRE(kv_store.merge(key, merge_operator_t<value_type>::append("y")));
+    REQUIRE(kv_store.find(key).val() == largest);
+    kv_store.flush(true);
+    REQUIRE(kv_store.find(key).val() == largest);
+
+    //the protocols answer with an error before the value is copied
+    request_t request;
+    const std::string line = "PUT Big_Key " + largest + "x";
+    parse_request(line, request);
+    std::string answer;
+    Protocol::string_sink_t sink{answer};
+    Protocol::execute(sink, kv_store, request);
+    REQUIRE(answer == "ERROR:Record too large\n");
+    REQUIRE(kv_store.find(key).val() == largest);
+
+    //the store answers requests that bypass the protocol check the same way, MSET (a RESP command)
+    //stores no pair
+    const std::string mset = "MSET Big_Pair 1 Big_Key " + largest + "x";
+    parse_request(mset, request);
+    request.m_cmd = CMD::kMSET;
+    REQUIRE(kv_store.request_handler(request) == answer_t("ERROR", "Record too large"));
+    REQUIRE(kv_store.find(key_type("Big_Pair")).absent());
+    parse_request(line, request);
+    REQUIRE(kv_store.request_handler(request) == answer_t("ERROR", "Record too large"));
+    const std::string append = "APPEND Big_Key " + largest + "x";
+    parse_request(append, request);
+    REQUIRE(kv_store.request_handler(request) == answer_t("ERROR", "Record too large"));
+    REQUIRE(kv_store.find(key).val() == largest);
+
+    //the expiry time makes the stored value too large, it stays without one
+    bool fits;
+    REQUIRE(!kv_store.expire(key, now_ms() + 60000, fits));
+    REQUIRE(!fits);
+    answer.clear();
+    parse_request("EXPIRE Big_Key 60", request);
+    Protocol::execute(sink, kv_store, request);
+    REQUIRE(answer == "ERROR:Record too large\n");
+    REQUIRE(kv_store.find(key).expiry() == 0);
+    kv_store.clear();
+}
@@ -0,0 +1,44 @@
+#include <catch2/catch.hpp>
+
+#include "../src/shard_router.hh"
+
+#include <functional>
+#include <string_view>
+
+TEST_CASE( "shard routing", "[logic]" ) {
+
+    constexpr size_t CORES = 4;
+    //port 0: every core listens on its own free port, the test never connects
+    static const CB lCB(false, "", 10000, 0u);
+    shard_router router(lCB, CORES);
+    REQUIRE(router.cores() == CORES);
+
+    const auto shard = [](std::string_view aKey){ return std::hash<std::string_view>{}(aKey) % CORES; };
+
+    //without a hash tag the whole key is hashed
+    for(std::string_view key : {"Shard_Key", "", "Shard_{", "Shard_}{", "Shard_{}", "Shard_{}x}", "}Shard_{"})
+    {
+        REQUIRE(router.shard_of(key) == shard(key));
+    }
+
+    //only the first non-empty {hash tag} is hashed, so keys sharing it share their shard
+    REQUIRE(router.shard_of("{user1000}.following") == shard("user1000"));
+    REQUIRE(router.shard_of("{user1000}.followers") == shard("user1000"));
+    REQUIRE(router.shard_of("Shard_{user1000}") == shard("user1000"));
+    REQUIRE(router.shard_of("x{a}y{b}") == shard("a"));
+    REQUIRE(router.shard_of("}{a}") == shard("a"));
+    REQUIRE(router.shard_of("{{a}}") == shard("{a"));
+
+    //every shard gets keys
+    bool used[CORES] = {};
+    for(size_t i = 0; i < 1000; ++i)
+    {
+        const size_t s = router.shard_of("Shard_Key" + std::to_string(i));
+        REQUIRE(s < CORES);
+        used[s] = true;
+    }
+    for(bool u : used)
+    {
+        REQUIRE(u);
+    }
+}
@@ -0,0 +1,95 @@
+#include <catch2/catch.hpp>
+
+#include "../src/spsc_queue.hh"
+
+#include <memory>
+#include <thread>
+
+TEST_CASE( "spsc queue", "[logic]" ) {
+
+    constexpr size_t CAPACITY = 8;
+    spsc_queue_t<std::unique_ptr<size_t>> queue(CAPACITY);
+    std::unique_ptr<size_t> element;
+
+    //empty queue
+    REQUIRE(!queue.try_pop(element));
+    REQUIRE(!element);
+
+    //a full queue rejects the push and leaves the element with the caller
+    for(size_t i = 0; i < CAPACITY; ++i)
+    {
+        REQUIRE(queue.try_push(std::make_unique<size_t>(i)));
+    }
+    auto rejected = std::make_unique<size_t>(CAPACITY);
+    REQUIRE(!queue.try_push(std::move(rejected)));
+    REQUIRE(rejected);
+    REQUIRE(*rejected == CAPACITY);
+
+    //elements leave in FIFO order, the emptied queue rejects the pop again
+    for(size_t i = 0; i < CAPACITY; ++i)
+    {
+        REQUIRE(queue.try_pop(element));
+        REQUIRE(*element == i);
+    }
+    REQUIRE(!queue.try_pop(element));
+
+    //head and tail wrap around the slots many times
+    size_t pushed = 0;
+    size_t popped = 0;
+    for(size_t round = 0; round < 10 * CAPACITY + 3; ++round)
+    {
+        for(size_t i = 0; i < round % CAPACITY + 1; ++i)
+        {
+            REQUIRE(queue.try_push(std::make_unique<size_t>(pushed++)));
+        }
+        while(queue.try_pop(element))
+        {
+            REQUIRE(*element == popped++);
+        }
+        REQUIRE(popped == pushed);
+    }
+
+    //the slots of a full queue now wrap around the end of the array
+    REQUIRE(pushed % CAPACITY != 0);
+    for(size_t i = 0; i < CAPACITY; ++i)
+    {
+        REQUIRE(queue.try_push(std::make_unique<size_t>(pushed++)));
+    }
+    REQUIRE(!queue.try_push(std::make_unique<size_t>(pushed)));
+    while(queue.try_pop(element))
+    {
+        REQUIRE(*element == popped++);
+    }
+    REQUIRE(popped == pushed);
+
+    //one producer and one consumer thread, every element arrives once and in order
+    constexpr size_t ELEMENTS = 100000;
+    std::thread producer([&queue]() noexcept
+    {
+        for(size_t i = 0; i < ELEMENTS; ++i)
+        {
+            auto lElement = std::make_unique<size_t>(i);
+            while(!queue.try_push(std::move(lElement)))
+            {
+                std::this_thread::yield();
+            }
+        }
+    });
+    size_t expected = 0;
+    bool ordered = true;
+    while(expected < ELEMENTS)
+    {
+        if(queue.try_pop(element))
+        {
+            ordered = ordered && *element == expected;
+            ++expected;
+        }
+        else
+        {
+            std::this_thread::yield();
+        }
+    }
+    producer.join();
+    REQUIRE(ordered);
+    REQUIRE(!queue.try_pop(element));
+}
@@ -8,7 +8,7 @@
 
 TEST_CASE( "testing storage manager", "[logic]" ) {
 
-    const CB lCB(true, "", 300, 8080u);
+    static const CB lCB(true, "", 300, 8080u);
     Trace::get_instance().init(lCB);
 
     using key_type = string_t;
@@ -24,7 +24,8 @@ TEST_CASE( "testing storage manager", "[logic]" ) {
 
     SECTION("test to disk and to memory tranformation for storage manager"){
         std::cout << "Create and initialize Storage Manager" << std::endl;
-        auto& sm = StorageManager<key_type,value_type>::get_instance();
+        //a shard of its own: the manager keeps the control block it is initialised with first
+        auto& sm = StorageManager<key_type,value_type>::get_instance(11);
         sm.init(lCB);
 
         sm.partition().open();
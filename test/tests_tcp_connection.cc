@@ -0,0 +1,196 @@
+#include <catch2/catch.hpp>
+
+#include "../src/database.hh"
+#include "../src/tcp_connection.hh"
+#include "../src/tcp_server.hh"
+#include "../src/protocol.hh"
+
+#include <map>
+#include <thread>
+#include <string>
+
+// a client connected over loopback to a tcp_connection, whose handlers run on their own thread
+class loopback_t final
+{
+    public:
+        loopback_t()
+            : m_io_context()
+            , m_client(m_io_context)
+            , m_buffer()
+            , m_server()
+        {
+            tcp::acceptor acceptor(m_io_context, tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+            auto connection = tcp_connection::create(m_io_context);
+            m_client.connect(acceptor.local_endpoint());
+            acceptor.accept(connection->socket());
+            connection->start();
+            m_server = std::thread([this]() noexcept { m_io_context.run(); });
+        }
+
+        ~loopback_t()
+        {
+            boost::system::error_code ec;
+            m_client.shutdown(tcp::socket::shutdown_send, ec);
+            m_server.join();
+        }
+
+        void send(const std::string& aData)
+        {
+            boost::asio::write(m_client, boost::asio::buffer(aData));
+        }
+
+        std::string answer()
+        {
+            const size_t length = boost::asio::read_until(m_client, m_buffer, '\n');
+            const auto begin = boost::asio::buffers_begin(m_buffer.data());
+            const std::string line(begin, begin + static_cast<std::ptrdiff_t>(length) - 1);
+            m_buffer.consume(length);
+            return line;
+        }
+
+        std::string read(size_t aSize)
+        {
+            if(m_buffer.size() < aSize)
+            {
+                boost::asio::read(m_client, m_buffer, boost::asio::transfer_exactly(aSize - m_buffer.size()));
+            }
+            const auto begin = boost::asio::buffers_begin(m_buffer.data());
+            const std::string data(begin, begin + static_cast<std::ptrdiff_t>(aSize));
+            m_buffer.consume(aSize);
+            return data;
+        }
+
+    private:
+        boost::asio::io_context m_io_context;
+        tcp::socket             m_client;
+        boost::asio::streambuf  m_buffer;
+        std::thread             m_server;
+};
+
+TEST_CASE( "connection request parsing", "[logic]" ) {
+
+    static const CB lCB(false, "", 10000, 8080u);
+    Trace::get_instance().init(lCB);
+    KeyValueStore<str_key, str_val>::get_instance().init(lCB);
+
+    loopback_t lb;
+
+    //several requests on one connection
+    lb.send("PUT CONN_a 1\n");
+    REQUIRE(lb.answer() == "OK:Successful Insert");
+    lb.send("GET CONN_a\n");
+    REQUIRE(lb.answer() == "OK:<'CONN_a', '1'>");
+
+    //a request split over several writes is answered once its line is complete
+    lb.send("PUT CO");
+    lb.send("NN_b 2");
+    lb.send("\nGET CONN_b\n");
+    REQUIRE(lb.answer() == "OK:Successful Insert");
+    REQUIRE(lb.answer() == "OK:<'CONN_b', '2'>");
+
+    //bytes behind a newline belong to the next request
+    lb.send("GET CONN_a\nGET CONN_b\nGET CO");
+    lb.send("NN_c\nFOO\n");
+    REQUIRE(lb.answer() == "OK:<'CONN_a', '1'>");
+    REQUIRE(lb.answer() == "OK:<'CONN_b', '2'>");
+    REQUIRE(lb.answer() == "ERROR:Requested key was not found.");
+    REQUIRE(lb.answer() == "ERROR:INVALID REQUEST: 'FOO'");
+}
+
+TEST_CASE( "connection pipelining", "[logic]" ) {
+
+    constexpr size_t REQUESTS = 500;
+    loopback_t lb;
+
+    //all requests are sent before the first answer is read, the answers keep their order
+    std::string requests;
+    for(size_t i = 0; i < REQUESTS; ++i)
+    {
+        requests += "PUT CONN_P" + std::to_string(i) + " " + std::to_string(i) + "\n";
+    }
+    for(size_t i = 0; i < REQUESTS; ++i)
+    {
+        requests += "GET CONN_P" + std::to_string(i) + "\n";
+    }
+    //the trailing request is incomplete and stays buffered until its line ends
+    requests += "GET CONN_P0";
+    lb.send(requests);
+
+    for(size_t i = 0; i < REQUESTS; ++i)
+    {
+        REQUIRE(lb.answer() == "OK:Successful Insert");
+    }
+    for(size_t i = 0; i < REQUESTS; ++i)
+    {
+        REQUIRE(lb.answer() == "OK:<'CONN_P" + std::to_string(i) + "', '" + std::to_string(i) + "'>");
+    }
+    lb.send("\n");
+    REQUIRE(lb.answer() == "OK:<'CONN_P0', '0'>");
+}
+
+TEST_CASE( "connection unordered answers", "[logic]" ) {
+
+    constexpr uint32_t KEYS = 20;
+    loopback_t lb;
+
+    auto frame = [](CMD aCmd, uint8_t aFlags, uint32_t aId, const std::string& aKey, const std::string& aVal)
+    {
+        std::string result(Binary::HEADER_SIZE, '\0');
+        Binary::encode({Binary::REQUEST_MAGIC, static_cast<uint8_t>(aCmd), aFlags, 0, static_cast<uint32_t>(aKey.size()), static_cast<uint32_t>(aVal.size()), aId}, result.data());
+        return result + aKey + aVal;
+    };
+
+    //the values are flushed, so the unordered GETs read them from disk
+    std::string requests;
+    for(uint32_t i = 0; i < KEYS; ++i)
+    {
+        requests += frame(CMD::kPUT, 0, i, "CONN_U" + std::to_string(i), "u" + std::to_string(i));
+    }
+    requests += frame(CMD::kFLUSH, 0, KEYS, "", "");
+    lb.send(requests);
+    for(uint32_t i = 0; i <= KEYS; ++i)
+    {
+        const Binary::header_t header = Binary::decode(lb.read(Binary::HEADER_SIZE).data());
+        REQUIRE(header.m_status == static_cast<uint8_t>(Binary::STATUS::kOK));
+        REQUIRE(header.m_request_id == i);
+    }
+
+    //every answer carries the id and flags of its request, whatever order the answers arrive in
+    requests.clear();
+    for(uint32_t i = 0; i < KEYS; ++i)
+    {
+        requests += frame(CMD::kGET, Binary::FLAG_UNORDERED, 100 + i, "CONN_U" + std::to_string(i), "");
+    }
+    requests += frame(CMD::kGET, Binary::FLAG_UNORDERED, 200, "CONN_Missing", "");
+    requests += frame(CMD::kGET, 0, 300, "CONN_U0", "");
+    lb.send(requests);
+
+    std::map<uint32_t, std::pair<Binary::header_t, std::string>> answers;
+    for(uint32_t i = 0; i < KEYS + 2; ++i)
+    {
+        const Binary::header_t header = Binary::decode(lb.read(Binary::HEADER_SIZE).data());
+        REQUIRE(header.m_magic == Binary::RESPONSE_MAGIC);
+        REQUIRE(header.m_key_length == 0);
+        REQUIRE(answers.count(header.m_request_id) == 0);
+        answers[header.m_request_id] = std::make_pair(header, lb.read(header.m_val_length));
+    }
+    for(uint32_t i = 0; i < KEYS; ++i)
+    {
+        const auto& [header, value] = answers.at(100 + i);
+        REQUIRE(header.m_status == static_cast<uint8_t>(Binary::STATUS::kOK));
+        REQUIRE(header.m_flags == Binary::FLAG_UNORDERED);
+        REQUIRE(value == "u" + std::to_string(i));
+    }
+    REQUIRE(answers.at(200).first.m_status == static_cast<uint8_t>(Binary::STATUS::kNOT_FOUND));
+    REQUIRE(answers.at(200).first.m_flags == Binary::FLAG_UNORDERED);
+    REQUIRE(answers.at(300).first.m_flags == 0);
+    REQUIRE(answers.at(300).second == "u0");
+}
+
+TEST_CASE( "server on a port in use", "[logic]" ) {
+
+    //the failure to listen reaches the caller instead of terminating the process
+    boost::asio::io_context io_context;
+    tcp::acceptor taken(io_context, tcp::endpoint(tcp::v4(), 0));
+    REQUIRE_THROWS_AS(tcp_server(io_context, taken.local_endpoint().port()), boost::system::system_error);
+}
@@ -0,0 +1,80 @@
+#include <catch2/catch.hpp>
+
+#include "../src/trace.hh"
+#include "../src/trace_ring.hh"
+
+#include <string>
+#include <vector>
+
+TEST_CASE( "trace levels", "[logic]" ) {
+
+    //other tests may have turned tracing on, their level is restored at the end
+    const LEVEL before = Trace::enabled(LEVEL::kDEBUG) ? LEVEL::kDEBUG : Trace::enabled(LEVEL::kINFO) ? LEVEL::kINFO : Trace::enabled(LEVEL::kERROR) ? LEVEL::kERROR : LEVEL::kOFF;
+
+    //the message is only built if its level is enabled
+    size_t built = 0;
+    auto message = [&built](){ ++built; return std::string("traced"); };
+    Trace::level(LEVEL::kOFF);
+    TRACE_ERROR(message());
+    REQUIRE(built == 0);
+
+    Trace::level(LEVEL::kERROR);
+    REQUIRE(Trace::enabled(LEVEL::kERROR));
+    REQUIRE(!Trace::enabled(LEVEL::kINFO));
+    TRACE(message());
+    TRACE_INFO(message());
+    REQUIRE(built == 0);
+    TRACE_ERROR(message());
+    REQUIRE(built == 1);
+    Trace::level(LEVEL::kOFF);
+    TRACE_ERROR(message());
+    REQUIRE(built == 1);
+    Trace::level(before);
+}
+
+TEST_CASE( "trace rings", "[logic]" ) {
+
+    trace_ring_t ring;
+    std::vector<std::string> drained;
+    auto drain = [&ring, &drained]()
+    {
+        drained.clear();
+        ring.drain([&drained](const trace_record_t& aRecord){ drained.emplace_back(aRecord.m_msg, aRecord.m_length); });
+    };
+
+    //the writer is woken once the ring is half full, a full ring drops and counts the records
+    for(size_t i = 0; i < TRACE_RING_SIZE; ++i)
+    {
+        const bool wake = ring.push(__FILE__, __LINE__, "test", LEVEL::kDEBUG, std::to_string(i), 0);
+        REQUIRE(wake == (i + 1 == TRACE_RING_SIZE / 2));
+    }
+    REQUIRE(ring.push(__FILE__, __LINE__, "test", LEVEL::kDEBUG, "dropped", 0));
+    REQUIRE(ring.take_dropped() == 1);
+    REQUIRE(ring.take_dropped() == 0);
+    drain();
+    REQUIRE(drained.size() == TRACE_RING_SIZE);
+    REQUIRE(drained.front() == "0");
+    REQUIRE(drained.back() == std::to_string(TRACE_RING_SIZE - 1));
+
+    //the records wrap around, a drained ring is empty
+    for(size_t i = 0; i < 3; ++i)
+    {
+        ring.push(__FILE__, __LINE__, "test", LEVEL::kDEBUG, "again " + std::to_string(i), 0);
+    }
+    drain();
+    REQUIRE(drained == std::vector<std::string>{"again 0", "again 1", "again 2"});
+    drain();
+    REQUIRE(drained.empty());
+
+    //long messages are truncated
+    ring.push(__FILE__, __LINE__, "test", LEVEL::kDEBUG, std::string(TRACE_MSG_SIZE + 1, 'x'), 0);
+    bool truncated = false;
+    ring.drain([&truncated](const trace_record_t& aRecord){ truncated = aRecord.m_truncated && aRecord.m_length == TRACE_MSG_SIZE; });
+    REQUIRE(truncated);
+
+    //a released ring goes to the next thread, but only to one
+    REQUIRE(!ring.acquire());
+    ring.release();
+    REQUIRE(ring.acquire());
+    REQUIRE(!ring.acquire());
+}
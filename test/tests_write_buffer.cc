@@ -9,13 +9,15 @@
 
 TEST_CASE( "testing write buffer", "[logic]" ) {
 
-    const CB lCB(true, "", 300, 8080u);
+    static const CB lCB(true, "", 300, 8080u);
     Trace::get_instance().init(lCB);
 
     using key_type = string_t;
     using value_type = string_t;
     using key_value_type = key_val_t<key_type,value_type>;
-    auto& sm = StorageManager<key_type,value_type>::get_instance();
+    //a shard of its own: the managers keep the control block they are initialised with first
+    constexpr size_t SHARD = 10;
+    auto& sm = StorageManager<key_type,value_type>::get_instance(SHARD);
     sm.init(lCB);
 
     using str_key_val_t = key_val_pt<key_type, value_type>;
@@ -48,9 +50,31 @@ TEST_CASE( "testing write buffer", "[logic]" ) {
 
     }
 
+    SECTION("test length prefixed records with binary payload"){
+        std::unique_ptr<byte[]> page = std::make_unique<byte[]>(PAGE_SIZE);
+
+        const std::string binary("bin\0ary\nvalue", 13);
+        const key_value_type kv(key_type(TEST_PREFIX + "BinaryKey"), value_type(binary + std::string(200, 'x')), MOD::kINSERT, 42);
+        kv.to_disk(page.get());
+
+        REQUIRE(key_value_type::key_matches(page.get(), kv.key()));
+        REQUIRE(!key_value_type::key_matches(page.get(), key_type(TEST_PREFIX + "BinaryKe")));
+        REQUIRE(string_t::skip(page.get()) == page.get() + kv.key().size());
+
+        key_value_type kv_tmp;
+        kv_tmp.to_memory(page.get());
+
+        REQUIRE(kv_tmp == kv);
+        REQUIRE(kv_tmp.val().data().size() == binary.size() + 200);
+        REQUIRE(kv_tmp.seq() == 42);
+        REQUIRE(key_value_type::seq_of(page.get()) == 42);
+        //the sequence number follows the key and the value
+        REQUIRE(kv.diskB() == kv.key().size() + kv.val().size() + sizeof(uint64_t));
+    }
+
     SECTION("add data to buffer")
     {
-        auto& wbuf = WriteManager<key_type, value_type>::get_instance();
+        auto& wbuf = WriteManager<key_type, value_type>::get_instance(SHARD);
         wbuf.init(lCB);
         std::vector<str_key_val_t> kv_vec = {kv1, kv2, kv3, kv4};
 
@@ -63,6 +87,7 @@ TEST_CASE( "testing write buffer", "[logic]" ) {
             try
             {
                 REQUIRE(key_value_type(kv.first, kv.second, MOD::kINSERT) == wbuf.get(kv.first));
+                REQUIRE(wbuf.read(kv.first).val() == kv.second.data());
             }
             catch(KeyNotInWriteManagerException& ex)
             {
@@ -72,6 +97,13 @@ TEST_CASE( "testing write buffer", "[logic]" ) {
         }
         std::cout << "Total Size: " << totalSize << std::endl;
 
+        REQUIRE(wbuf.find(key_type("NoKey")).absent());
+        REQUIRE(wbuf.del(kv4.first));
+        REQUIRE(wbuf.find(kv4.first).deleted());
+        REQUIRE(!wbuf.del(kv4.first));
+        wbuf.put(kv4, MOD::kINSERT);
+        REQUIRE(wbuf.find(kv4.first).found());
+
         try
         {
             wbuf.get(key_type("NoKey"));
@@ -82,12 +114,21 @@ TEST_CASE( "testing write buffer", "[logic]" ) {
             //std::cerr << "Error: " << ex.what() << std::endl;
         }
 
-
+        //the full buffers are written in the background
+        wbuf.flush(true);
 
         try
         {
             auto kv_tmp = sm.get(kv2.first);
             REQUIRE(kv_tmp == kv2);
+
+            auto handle = sm.read(kv2.first);
+            REQUIRE(handle);
+            REQUIRE(handle.key() == kv2.first.data());
+            REQUIRE(handle.val() == kv2.second.data());
+
+            REQUIRE(sm.find(kv2.first).status() == FIND::kFOUND);
+            REQUIRE(sm.find(key_type("NoKey")).status() == FIND::kABSENT);
         }
         catch(KeyNotInStorageManagerException& ex)
         {